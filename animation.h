@@ -0,0 +1,143 @@
+#pragma once
+
+// Time based move animation.
+//
+// Moves wait in a queue and each one turns its layer over a fixed number
+// of seconds, measured on the clock passed to animator_update(), so the
+// speed no longer depends on the frame rate. A move starts as soon as none
+// of its cubies is still turning, which lets moves on opposite faces run
+// at the same time, and a move that becomes free between two frames is
+// started at the moment it became free rather than at the next frame.
+
+#include "cube_math.h"
+#include "cube_state.h"
+
+#define ANIMATION_QUEUE_SIZE 256
+
+struct Animator {
+  // State once every started move has finished.
+  Cube_state shown;
+  int queue[ANIMATION_QUEUE_SIZE];
+  float queue_seconds[ANIMATION_QUEUE_SIZE];
+  int queue_head, queue_count;
+
+  // Per cubie: drawn orientation, the turn it is in, and when it is free.
+  Quat orientation[CORNER_COUNT];
+  Quat from[CORNER_COUNT];
+  Quat to[CORNER_COUNT];
+  double start[CORNER_COUNT];
+  double seconds[CORNER_COUNT];
+  bool turning[CORNER_COUNT];
+  double free_at[CORNER_COUNT];
+  double last_update;
+};
+
+static void animator_init(Animator *a, Cube_state s, double now)
+{
+  a->shown = s;
+  a->queue_head = a->queue_count = 0;
+  uint8_t r[CORNER_COUNT];
+  cube_state_rotations(s, r);
+  for (int i = 0; i < CORNER_COUNT; i++) {
+    a->orientation[i] = a->from[i] = a->to[i] = quat_from_rotation(rotations[r[i]].m);
+    a->turning[i] = false;
+    a->free_at[i] = now;
+  }
+  a->last_update = now;
+}
+
+// Queues a move that takes seconds to play. False if the queue is full.
+static bool animator_push(Animator *a, int move, float seconds)
+{
+  if (a->queue_count == ANIMATION_QUEUE_SIZE)
+    return false;
+  int i = (a->queue_head + a->queue_count++) % ANIMATION_QUEUE_SIZE;
+  a->queue[i] = move;
+  a->queue_seconds[i] = seconds;
+  return true;
+}
+
+static bool animator_idle(const Animator *a)
+{
+  if (a->queue_count)
+    return false;
+  for (int i = 0; i < CORNER_COUNT; i++)
+    if (a->turning[i])
+      return false;
+  return true;
+}
+
+// Starts the move at the head of the queue unless one of its cubies is
+// still turning. Moves are never reordered, since most pairs of moves do
+// not commute.
+static bool start_next_move(Animator *a)
+{
+  if (a->queue_count == 0)
+    return false;
+  int move = a->queue[a->queue_head];
+  Corner_cubies c = cube_state_to_cubies(a->shown);
+  int layer[4], n = 0;
+  double start = a->last_update;
+  for (int s = 0; s < CORNER_COUNT; s++) {
+    if (ivec3_dot(slot_position(s), face_normal[move >> 1]) < 0)
+      continue;
+    int cubie = c.cp[s];
+    if (a->turning[cubie])
+      return false;
+    if (a->free_at[cubie] > start)
+      start = a->free_at[cubie];
+    layer[n++] = cubie;
+  }
+
+  a->shown = apply_move(a->shown, move);
+  uint8_t r[CORNER_COUNT];
+  cube_state_rotations(a->shown, r);
+  for (int i = 0; i < n; i++) {
+    int cubie = layer[i];
+    Quat to = quat_from_rotation(rotations[r[cubie]].m);
+    // q and -q are the same rotation, take the one on the short arc.
+    if (quat_dot(to, a->to[cubie]) < 0)
+      to = Quat{ -to.x, -to.y, -to.z, -to.w };
+    a->from[cubie] = a->to[cubie];
+    a->to[cubie] = to;
+    a->start[cubie] = start;
+    a->seconds[cubie] = a->queue_seconds[a->queue_head];
+    a->turning[cubie] = true;
+  }
+  a->queue_head = (a->queue_head + 1) % ANIMATION_QUEUE_SIZE;
+  a->queue_count--;
+  return true;
+}
+
+// Finishes the turns that are over by now.
+static void settle_turns(Animator *a, double now)
+{
+  for (int i = 0; i < CORNER_COUNT; i++) {
+    if (!a->turning[i] || a->start[i] + a->seconds[i] > now)
+      continue;
+    a->turning[i] = false;
+    a->orientation[i] = a->to[i];
+    a->free_at[i] = a->start[i] + a->seconds[i];
+  }
+}
+
+// Advances every animation to now (in seconds).
+static void animator_update(Animator *a, double now)
+{
+  // Several short moves can start and finish between two frames.
+  settle_turns(a, now);
+  while (start_next_move(a))
+    settle_turns(a, now);
+
+  for (int i = 0; i < CORNER_COUNT; i++) {
+    if (!a->turning[i])
+      continue;
+    float t = (float)((now - a->start[i]) / a->seconds[i]);
+    if (t < 0)
+      t = 0;
+    // Ease in and out.
+    t = t * t * (3.0f - 2.0f * t);
+    a->orientation[i] = slerp(a->from[i], a->to[i], t);
+  }
+  a->last_update = now;
+}
@@ -0,0 +1,225 @@
+#pragma once
+
+// Headless batch solving: one scramble per input line (see notation.h),
+// one solution per output line, no window or GL context.
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include "notation.h"
+#include "table_file.h"
+#include "thread_pool.h"
+
+#define BATCH_LINE_MAX (1 << 16)
+#define BATCH_IO_BUFFER (1 << 20)
+// Lines handed to a worker at a time, and blocks in flight per thread.
+#define BATCH_BLOCK_LINES 4096
+#define BATCH_BLOCKS_PER_THREAD 4
+
+struct Batch_stats {
+  uint64_t lines;
+  uint64_t errors;
+  uint64_t solution_moves;
+};
+
+// Solves one scramble line into out, which must hold BATCH_LINE_MAX bytes.
+// Returns false and writes an error line if the scramble is malformed.
+static bool batch_solve_line(const char *line, char *out, uint64_t *solution_moves)
+{
+  Cube_state s = cube_state_solved();
+  if (!apply_move_text(&s, line)) {
+    strcpy(out, "error: bad move");
+    return false;
+  }
+  int moves[SOLVER_MAX_DEPTH];
+  int n = table_solve(s, moves, SOLVER_MAX_DEPTH);
+  if (n < 0) {
+    strcpy(out, "error: no solution");
+    return false;
+  }
+  *solution_moves += n;
+  format_moves(moves, n, out, BATCH_LINE_MAX);
+  return true;
+}
+
+// Reads the rest of an over long line so the next read starts afresh.
+static void skip_line(FILE *in)
+{
+  int c;
+  while ((c = fgetc(in)) != EOF && c != '\n')
+    ;
+}
+
+static void batch_solve_stream(FILE *in, FILE *out, Batch_stats *stats)
+{
+  static char line[BATCH_LINE_MAX];
+  static char solution[BATCH_LINE_MAX];
+  while (fgets(line, sizeof(line), in)) {
+    stats->lines++;
+    size_t len = strlen(line);
+    if (len == sizeof(line) - 1 && line[len - 1] != '\n') {
+      skip_line(in);
+      fputs("error: line too long\n", out);
+      stats->errors++;
+      continue;
+    }
+    if (!batch_solve_line(line, solution, &stats->solution_moves))
+      stats->errors++;
+    fputs(solution, out);
+    fputc('\n', out);
+  }
+}
+
+// A run of input lines and, once a worker is done with it, their output.
+struct Batch_block {
+  std::vector<char> text;
+  std::vector<uint32_t> line_start;
+  // Lines that did not fit BATCH_LINE_MAX; their text is empty.
+  std::vector<uint8_t> too_long;
+  std::vector<char> out;
+  Batch_stats stats;
+  bool done;
+};
+
+// Scratch a worker keeps for the whole run.
+struct Batch_worker {
+  char solution[BATCH_LINE_MAX];
+};
+
+struct Batch_context {
+  Batch_worker *workers;
+  std::mutex done_lock;
+  std::condition_variable done;
+};
+
+static void batch_solve_block(void *task, int worker, void *context)
+{
+  Batch_block *b = (Batch_block *)task;
+  Batch_context *ctx = (Batch_context *)context;
+  char *solution = ctx->workers[worker].solution;
+  b->out.clear();
+  for (size_t i = 0; i < b->line_start.size(); i++) {
+    b->stats.lines++;
+    const char *text = "error: line too long";
+    if (b->too_long[i]) {
+      b->stats.errors++;
+    } else {
+      if (!batch_solve_line(&b->text[b->line_start[i]], solution, &b->stats.solution_moves))
+        b->stats.errors++;
+      text = solution;
+    }
+    b->out.insert(b->out.end(), text, text + strlen(text));
+    b->out.push_back('\n');
+  }
+  std::lock_guard<std::mutex> lock(ctx->done_lock);
+  b->done = true;
+  ctx->done.notify_all();
+}
+
+// Fills b with up to BATCH_BLOCK_LINES lines. Returns false at end of input.
+static bool batch_read_block(FILE *in, Batch_block *b)
+{
+  static char line[BATCH_LINE_MAX];
+  b->text.clear();
+  b->line_start.clear();
+  b->too_long.clear();
+  b->stats = Batch_stats();
+  b->done = false;
+  while (b->line_start.size() < BATCH_BLOCK_LINES && fgets(line, sizeof(line), in)) {
+    size_t len = strlen(line);
+    bool too_long = len == sizeof(line) - 1 && line[len - 1] != '\n';
+    if (too_long) {
+      skip_line(in);
+      len = 0;
+    }
+    b->line_start.push_back((uint32_t)b->text.size());
+    b->too_long.push_back(too_long);
+    b->text.insert(b->text.end(), line, line + len);
+    b->text.push_back(0);
+  }
+  return !b->line_start.empty();
+}
+
+// Reads blocks on this thread while the pool solves them. Finished blocks
+// wait in a ring (the reorder buffer) until every earlier block is written,
+// so output order matches input order. The ring also bounds the memory in
+// flight: a block is only refilled once it has been written.
+static void batch_solve_stream_parallel(FILE *in, FILE *out, Batch_stats *stats, int threads)
+{
+  int ring_size = threads * BATCH_BLOCKS_PER_THREAD;
+  std::vector<Batch_block> ring(ring_size);
+  Batch_context ctx;
+  ctx.workers = new Batch_worker[threads];
+  Thread_pool pool;
+  thread_pool_start(&pool, threads, batch_solve_block, &ctx);
+
+  uint64_t read_seq = 0, write_seq = 0;
+  bool eof = false;
+  while (!eof || write_seq < read_seq) {
+    if (!eof && read_seq - write_seq < (uint64_t)ring_size) {
+      Batch_block *b = &ring[read_seq % ring_size];
+      if (batch_read_block(in, b)) {
+        thread_pool_submit(&pool, b);
+        read_seq++;
+      } else {
+        eof = true;
+      }
+      continue;
+    }
+    Batch_block *b = &ring[write_seq % ring_size];
+    {
+      std::unique_lock<std::mutex> lock(ctx.done_lock);
+      ctx.done.wait(lock, [b] { return b->done; });
+    }
+    fwrite(b->out.data(), 1, b->out.size(), out);
+    stats->lines += b->stats.lines;
+    stats->errors += b->stats.errors;
+    stats->solution_moves += b->stats.solution_moves;
+    write_seq++;
+  }
+
+  thread_pool_stop(&pool);
+  delete[] ctx.workers;
+}
+
+// --batch [input] [output] [threads]: solves every scramble in input
+// (default or "-" is stdin) and writes the solutions to output (default
+// stdout), on every core unless threads says otherwise.
+static int batch_main(int argc, char *argv[])
+{
+  FILE *in = stdin, *out = stdout;
+  if (argc > 2 && strcmp(argv[2], "-") != 0)
+    in = fopen(argv[2], "rb");
+  if (argc > 3 && strcmp(argv[3], "-") != 0)
+    out = fopen(argv[3], "wb");
+  if (!in || !out) {
+    fprintf(stderr, "could not open %s\n", !in ? argv[2] : argv[3]);
+    return 1;
+  }
+  int threads = argc > 4 ? atoi(argv[4]) : (int)std::thread::hardware_concurrency();
+  if (threads < 1)
+    threads = 1;
+  setvbuf(in, NULL, _IOFBF, BATCH_IO_BUFFER);
+  setvbuf(out, NULL, _IOFBF, BATCH_IO_BUFFER);
+
+  tables_init(TABLE_FILE_NAME);
+
+  Batch_stats stats = {};
+  auto start = std::chrono::steady_clock::now();
+  if (threads == 1)
+    batch_solve_stream(in, out, &stats);
+  else
+    batch_solve_stream_parallel(in, out, &stats, threads);
+  fflush(out);
+  double ms = elapsed_ms(start);
+
+  fprintf(stderr, "%llu scrambles on %d threads, %llu errors, %.2f moves per solution, %.1f ms, %.0f per second\n",
+          (unsigned long long)stats.lines, threads, (unsigned long long)stats.errors,
+          stats.lines > stats.errors ? (double)stats.solution_moves / (stats.lines - stats.errors) : 0.0,
+          ms, ms > 0 ? stats.lines * 1000.0 / ms : 0.0);
+  if (in != stdin)
+    fclose(in);
+  if (out != stdout)
+    fclose(out);
+  return stats.errors ? 2 : 0;
+}
@@ -0,0 +1,430 @@
+#pragma once
+
+// --bench: throughput and latency of the cube engine and the solvers, and
+// how long the tables take to build. Results are JSON so they can be
+// compared between releases. Random input comes from a fixed seed.
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "cube_math.h"
+#include "distance_table.h"
+#include "facelet_kernel.h"
+#include "nxn_cube.h"
+#include "rng.h"
+#include "scramble.h"
+#include "soft_render.h"
+#include "state_batch.h"
+#include "two_phase.h"
+
+#define BENCH_SEED 20240601ull
+// The solve corpus has a seed of its own, so it stays the same whatever
+// the benchmarks before it draw.
+#define BENCH_SOLVE_SEED 20240602ull
+#define BENCH_MOVES 100000000ull
+#define BENCH_LEGACY_MOVES 10000000ull
+#define BENCH_DERIVE_STATES 1000000
+#define BENCH_SOLVES 10000
+#define BENCH_TABLE_SOLVES 1000000
+#define BENCH_SCRAMBLES 1000000
+#define BENCH_CUBE3_SOLVES 200
+#define BENCH_NXN_MOVES 10000000
+#define BENCH_FACELET_MOVES 20000000
+#define BENCH_BATCH_STATES (1 << 20)
+#define BENCH_BATCH_PASSES 64
+#define BENCH_RENDER_FRAMES 1000
+#define BENCH_RENDER_SIZE 600
+// Length of the precomputed move sequence the move benchmarks cycle over.
+#define BENCH_SEQUENCE 4096
+
+// The pointer shuffle and four quat_mul calls per move that the rotate_*
+// functions did before the state engine, kept to measure against.
+struct Legacy_cubie {
+  Quat target_orientation;
+};
+
+struct Legacy_move {
+  int from[4];
+  int to[4];
+  Vector3 axis;
+};
+
+static Legacy_move legacy_moves[MOVE_COUNT];
+
+static void init_legacy_moves()
+{
+  for (int m = 0; m < MOVE_COUNT; m++) {
+    int r = move_rotation[m], n = 0;
+    for (int s = 0; s < CORNER_COUNT; s++) {
+      if (ivec3_dot(slot_position(s), face_normal[m >> 1]) < 0)
+        continue;
+      legacy_moves[m].from[n] = s;
+      legacy_moves[m].to[n] = rotation_slot[r][s];
+      n++;
+    }
+    Ivec3 n3 = face_normal[m >> 1];
+    float sign = (m & 1) ? 1.0f : -1.0f;
+    legacy_moves[m].axis = Vector3{ sign * n3.x, sign * n3.y, sign * n3.z };
+  }
+}
+
+static void legacy_rotate(Legacy_cubie **positions, int move)
+{
+  const Legacy_move &l = legacy_moves[move];
+  Legacy_cubie *moved[4];
+  for (int i = 0; i < 4; i++)
+    moved[i] = positions[l.from[i]];
+  for (int i = 0; i < 4; i++)
+    positions[l.to[i]] = moved[i];
+
+  float rot = to_radians(90);
+  Quat q = quat_angle_axis(l.axis, rot);
+  for (int i = 0; i < 4; i++)
+    positions[l.to[i]]->target_orientation = quat_mul(q, positions[l.to[i]]->target_orientation);
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point since)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+static void random_moves(Rng *rng, int *moves, int n)
+{
+  for (int i = 0; i < n; i++)
+    moves[i] = rng_below(rng, MOVE_COUNT);
+}
+
+// Every move depends on the one before, as in a search.
+static double bench_moves_chained(const int *moves)
+{
+  Cube_state s = cube_state_solved();
+  auto start = std::chrono::steady_clock::now();
+  for (uint64_t i = 0; i < BENCH_MOVES; i++)
+    s = apply_move(s, moves[i % BENCH_SEQUENCE]);
+  double t = seconds_since(start);
+  volatile uint32_t sink = s.perm ^ s.twist;
+  (void)sink;
+  return BENCH_MOVES / t;
+}
+
+// Eight independent states, as when simulating many cubes.
+static double bench_moves_independent(const int *moves)
+{
+  Cube_state s[8];
+  for (int j = 0; j < 8; j++)
+    s[j] = apply_move(cube_state_solved(), j);
+  auto start = std::chrono::steady_clock::now();
+  for (uint64_t i = 0; i < BENCH_MOVES / 8; i++)
+    for (int j = 0; j < 8; j++)
+      s[j] = apply_move(s[j], moves[(i + j) % BENCH_SEQUENCE]);
+  double t = seconds_since(start);
+  uint32_t x = 0;
+  for (int j = 0; j < 8; j++)
+    x ^= s[j].perm ^ s[j].twist;
+  volatile uint32_t sink = x;
+  (void)sink;
+  return BENCH_MOVES / 8 * 8 / t;
+}
+
+static double bench_moves_legacy(const int *moves)
+{
+  Legacy_cubie cubies[CORNER_COUNT];
+  Legacy_cubie *positions[CORNER_COUNT];
+  for (int i = 0; i < CORNER_COUNT; i++) {
+    cubies[i].target_orientation = quat_identity();
+    positions[i] = cubies + i;
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (uint64_t i = 0; i < BENCH_LEGACY_MOVES; i++)
+    legacy_rotate(positions, moves[i % BENCH_SEQUENCE]);
+  double t = seconds_since(start);
+  volatile float sink = positions[0]->target_orientation.w;
+  (void)sink;
+  return BENCH_LEGACY_MOVES / t;
+}
+
+// What the renderer does per state: a quaternion for every cubie.
+static double bench_derive_orientations(Rng *rng)
+{
+  std::vector<Cube_state> states(BENCH_DERIVE_STATES);
+  for (auto &s : states)
+    s = random_state(rng);
+  float sum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (auto &s : states) {
+    uint8_t r[CORNER_COUNT];
+    cube_state_rotations(s, r);
+    for (int i = 0; i < CORNER_COUNT; i++)
+      sum += quat_from_rotation(rotations[r[i]].m).w;
+  }
+  double t = seconds_since(start);
+  volatile float sink = sum;
+  (void)sink;
+  return BENCH_DERIVE_STATES / t;
+}
+
+// Software rendered frames of random states per second, with the given
+// number of tile threads.
+static double bench_soft_render(Rng *rng, int threads, bool avx2)
+{
+  std::vector<Cube_state> states(BENCH_RENDER_FRAMES);
+  for (auto &s : states)
+    s = random_state(rng);
+  Soft_renderer r;
+  soft_renderer_init(&r, threads);
+  r.avx2 = r.avx2 && avx2;
+  Image im;
+  image_alloc(&im, BENCH_RENDER_SIZE, BENCH_RENDER_SIZE);
+  Scene_view view;
+  scene_view_init(&view);
+  scene_view_update(&view, RENDER_ANGLE_X, RENDER_ANGLE_Y, 0, CAMERA_DISTANCE, 1.0f);
+  auto start = std::chrono::steady_clock::now();
+  for (auto &s : states)
+    soft_render_state(&r, &im, s, &view);
+  double t = seconds_since(start);
+  image_free(&im);
+  soft_renderer_free(&r);
+  return BENCH_RENDER_FRAMES / t;
+}
+
+// Random slice turns of any depth and amount on an NxN cube.
+static double bench_nxn_moves(Rng *rng, int n)
+{
+  Nxn_cube c;
+  nxn_cube_init(&c, n);
+  static int face[BENCH_SEQUENCE], depth[BENCH_SEQUENCE], turns[BENCH_SEQUENCE];
+  for (int i = 0; i < BENCH_SEQUENCE; i++) {
+    face[i] = rng_below(rng, NXN_FACES);
+    depth[i] = rng_below(rng, n);
+    turns[i] = 1 + rng_below(rng, 3);
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCH_NXN_MOVES; i++) {
+    int j = i % BENCH_SEQUENCE;
+    nxn_turn(&c, face[j], depth[j], turns[j]);
+  }
+  double t = seconds_since(start);
+  volatile uint8_t sink = c.facelets[0];
+  (void)sink;
+  nxn_cube_free(&c);
+  return BENCH_NXN_MOVES / t;
+}
+
+// Chained moves on a 2x2x2 or 3x3x3 facelet vector with one kernel.
+static double bench_facelet_moves(const Facelet_table *t, Facelet_move_fn fn, const int *moves)
+{
+  Facelets f;
+  facelets_solved(t, &f);
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCH_FACELET_MOVES; i++)
+    fn(t, &f, moves[i % BENCH_SEQUENCE]);
+  double t_s = seconds_since(start);
+  volatile uint8_t sink = f.b[0];
+  (void)sink;
+  return BENCH_FACELET_MOVES / t_s;
+}
+
+// Moves per second of every kernel the CPU runs, and of the one in use.
+static double bench_facelet_kernels(FILE *out, const Facelet_table *t, const int *moves)
+{
+  double best = 0;
+  fprintf(out, "    \"%dx%d\": {", t->n, t->n);
+  for (int k = 0; k < FACELET_KERNEL_COUNT; k++) {
+    if (!facelet_kernels[k])
+      continue;
+    double r = bench_facelet_moves(t, facelet_kernels[k], moves);
+    fprintf(out, "%s \"%s\": %.0f", k ? "," : "", facelet_kernel_names[k], r);
+    if (k == facelet_kernel)
+      best = r;
+  }
+  fprintf(out, " },\n");
+  return best;
+}
+
+// States per second through each batched operation, over a batch of
+// random states much larger than the caches.
+static void bench_state_batch(FILE *out, Rng *rng)
+{
+  State_batch b;
+  state_batch_alloc(&b, BENCH_BATCH_STATES);
+  std::vector<uint8_t> moves(BENCH_BATCH_STATES), result(BENCH_BATCH_STATES);
+  for (int i = 0; i < BENCH_BATCH_STATES; i++) {
+    state_batch_set(&b, i, random_state(rng));
+    moves[i] = (uint8_t)rng_below(rng, MOVE_COUNT);
+  }
+  double states = (double)BENCH_BATCH_STATES * BENCH_BATCH_PASSES;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int k = 0; k < BENCH_BATCH_PASSES; k++)
+    apply_move_batch(&b, k % MOVE_COUNT);
+  double one_move = states / seconds_since(start);
+  start = std::chrono::steady_clock::now();
+  for (int k = 0; k < BENCH_BATCH_PASSES; k++)
+    apply_moves_batch(&b, moves.data());
+  double own_moves = states / seconds_since(start);
+  start = std::chrono::steady_clock::now();
+  for (int k = 0; k < BENCH_BATCH_PASSES; k++)
+    state_batch_estimate(&b, result.data());
+  double estimate = states / seconds_since(start);
+  start = std::chrono::steady_clock::now();
+  for (int k = 0; k < BENCH_BATCH_PASSES; k++)
+    state_batch_solved(&b, result.data());
+  double solved = states / seconds_since(start);
+
+  fprintf(out, "  \"batch_states_per_second\": { \"avx2\": %s, \"apply_move\": %.0f, \"apply_moves\": %.0f, "
+          "\"estimate\": %.0f, \"solved\": %.0f },\n",
+          state_batch_avx2 ? "true" : "false", one_move, own_moves, estimate, solved);
+  state_batch_free(&b);
+}
+
+// Random state scrambles on one thread, with their mean length.
+static void bench_scrambles(FILE *out, Rng *rng)
+{
+  uint64_t moves_total = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCH_SCRAMBLES; i++) {
+    int moves[SOLVER_MAX_DEPTH];
+    moves_total += random_scramble(rng, moves, NULL);
+  }
+  double t = seconds_since(start);
+  fprintf(out, "  \"scrambles\": { \"per_second\": %.0f, \"mean_length\": %.3f },\n",
+          BENCH_SCRAMBLES / t, (double)moves_total / BENCH_SCRAMBLES);
+}
+
+typedef int (*Solve_fn)(Cube_state s, int *moves, int max_moves);
+
+// Solves the first count of states, the same corpus for every solver.
+static void bench_solver(FILE *out, const char *name, Solve_fn fn, const std::vector<Cube_state> &states, int count,
+                         bool last)
+{
+  std::vector<double> us(count);
+  uint64_t moves_total = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < count; i++) {
+    int moves[SOLVER_MAX_DEPTH];
+    auto t0 = std::chrono::steady_clock::now();
+    moves_total += fn(states[i], moves, SOLVER_MAX_DEPTH);
+    us[i] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+  }
+  double t = seconds_since(start);
+  std::sort(us.begin(), us.end());
+  fprintf(out, "    \"%s\": { \"solves\": %d, \"solves_per_second\": %.0f, \"mean_length\": %.3f, "
+          "\"p50_us\": %.3f, \"p99_us\": %.3f, \"max_us\": %.3f }%s\n",
+          name, count, count / t, (double)moves_total / count,
+          us[count / 2], us[(size_t)(count * 0.99)], us[count - 1], last ? "" : ",");
+}
+
+// 3x3x3 two-phase solves of random states within the default budget.
+static void bench_two_phase(FILE *out, Rng *rng, int threads)
+{
+  std::vector<double> ms(BENCH_CUBE3_SOLVES);
+  uint64_t turns_total = 0, nodes = 0;
+  int within_target = 0, failures = 0;
+  double ms_total = 0;
+  for (int i = 0; i < BENCH_CUBE3_SOLVES; i++) {
+    Cube3_state c = cube3_random(rng);
+    Two_phase_result r;
+    two_phase_solve(c, threads, TWO_PHASE_BUDGET_MS, TWO_PHASE_TARGET_LENGTH, &r);
+    for (int k = 0; k < r.length; k++)
+      c = cube3_apply_turn(c, r.turns[k]);
+    // No solution, or one that leaves the cube unsolved.
+    if (r.length < 0 || !cube3_equal(c, cube3_solved())) {
+      failures++;
+    } else {
+      turns_total += r.length;
+      within_target += r.length <= TWO_PHASE_TARGET_LENGTH;
+    }
+    nodes += r.nodes;
+    ms_total += r.ms;
+    ms[i] = r.ms;
+  }
+  std::sort(ms.begin(), ms.end());
+  int solved = BENCH_CUBE3_SOLVES - failures;
+  fprintf(out, "  \"solve3\": { \"solves\": %d, \"threads\": %d, \"budget_ms\": %.1f, \"failures\": %d, "
+          "\"mean_face_turns\": %.3f, \"within_%d\": %d, \"nodes_per_second\": %.0f, \"p50_ms\": %.3f, "
+          "\"p99_ms\": %.3f, \"max_ms\": %.3f }\n",
+          BENCH_CUBE3_SOLVES, threads, TWO_PHASE_BUDGET_MS, failures, solved ? (double)turns_total / solved : 0.0,
+          TWO_PHASE_TARGET_LENGTH, within_target, nodes / (ms_total / 1000), ms[BENCH_CUBE3_SOLVES / 2],
+          ms[(size_t)(BENCH_CUBE3_SOLVES * 0.99)], ms[BENCH_CUBE3_SOLVES - 1]);
+}
+
+static int bench_main(int argc, char *argv[])
+{
+  FILE *out = stdout;
+  if (argc > 2 && !(out = fopen(argv[2], "w"))) {
+    fprintf(stderr, "could not open %s\n", argv[2]);
+    return 1;
+  }
+  int threads = (int)std::thread::hardware_concurrency();
+  if (threads < 1)
+    threads = 1;
+
+  auto start = std::chrono::steady_clock::now();
+  cube_state_init();
+  double cube_state_ms = seconds_since(start) * 1000;
+  start = std::chrono::steady_clock::now();
+  solver_init();
+  double solver_ms = seconds_since(start) * 1000;
+  double distance_1_ms = distance_table_build(1);
+  double distance_n_ms = distance_table_build(threads);
+  double sym_distance_ms = sym_distance_table_build();
+  double two_phase_ms = two_phase_build();
+  init_legacy_moves();
+  facelet_init();
+  state_batch_init();
+
+  Rng rng;
+  rng_seed(&rng, BENCH_SEED);
+  int moves[BENCH_SEQUENCE];
+  random_moves(&rng, moves, BENCH_SEQUENCE);
+
+  fprintf(out, "{\n  \"benchmark_version\": 10,\n  \"seed\": %llu,\n  \"solve_seed\": %llu,\n  \"threads\": %d,\n",
+          (unsigned long long)BENCH_SEED, (unsigned long long)BENCH_SOLVE_SEED, threads);
+  fprintf(out, "  \"tables_ms\": { \"move_tables\": %.3f, \"solver_tables\": %.3f, "
+          "\"distance_table_1_thread\": %.3f, \"distance_table_all_threads\": %.3f, "
+          "\"symmetric_distance_table_1_thread\": %.3f, \"two_phase_tables\": %.3f },\n",
+          cube_state_ms, solver_ms, distance_1_ms, distance_n_ms, sym_distance_ms, two_phase_ms);
+  fprintf(out, "  \"distance_table_bytes\": { \"full\": %d, \"symmetric\": %d, \"permutation_classes\": %d },\n",
+          DISTANCE_TABLE_BYTES, SYM_DISTANCE_TABLE_BYTES, SYM_PERM_CLASS_COUNT);
+
+  double chained = bench_moves_chained(moves);
+  double independent = bench_moves_independent(moves);
+  double legacy = bench_moves_legacy(moves);
+  fprintf(out, "  \"moves_per_second\": { \"state_chained\": %.0f, \"state_independent\": %.0f, "
+          "\"legacy_rotate\": %.0f, \"speedup\": %.2f },\n",
+          chained, independent, legacy, chained / legacy);
+  bench_state_batch(out, &rng);
+  fprintf(out, "  \"facelet_moves_per_second\": {\n    \"kernel\": \"%s\",\n", facelet_kernel_names[facelet_kernel]);
+  double facelet_2 = bench_facelet_kernels(out, &facelet_table_2, moves);
+  bench_facelet_kernels(out, &facelet_table_3, moves);
+  fprintf(out, "    \"2x2_speedup_over_legacy_rotate\": %.2f\n  },\n", facelet_2 / legacy);
+  static const int nxn_sizes[] = { 3, 5, 10, 20, 33 };
+  fprintf(out, "  \"nxn_moves_per_second\": {");
+  for (int i = 0; i < 5; i++)
+    fprintf(out, " \"%d\": %.0f%s", nxn_sizes[i], bench_nxn_moves(&rng, nxn_sizes[i]), i < 4 ? "," : "");
+  fprintf(out, " },\n");
+  fprintf(out, "  \"render\": { \"states_to_quaternions_per_second\": %.0f,\n", bench_derive_orientations(&rng));
+  fprintf(out, "    \"soft_frames_per_second\": { \"size\": %d, \"avx2\": %s, \"scalar\": %.0f, \"simd\": %.0f, "
+          "\"simd_tiles_all_threads\": %.0f } },\n",
+          BENCH_RENDER_SIZE, soft_render_has_avx2() ? "true" : "false", bench_soft_render(&rng, 1, false),
+          bench_soft_render(&rng, 1, true), bench_soft_render(&rng, threads, true));
+
+  bench_scrambles(out, &rng);
+  Rng solve_rng;
+  rng_seed(&solve_rng, BENCH_SOLVE_SEED);
+  std::vector<Cube_state> solve_states(std::max(BENCH_SOLVES, BENCH_TABLE_SOLVES));
+  for (auto &s : solve_states)
+    s = random_state(&solve_rng);
+  fprintf(out, "  \"solve\": {\n");
+  bench_solver(out, "ida_star", solve, solve_states, BENCH_SOLVES, false);
+  bench_solver(out, "distance_table", table_solve, solve_states, BENCH_TABLE_SOLVES, false);
+  bench_solver(out, "distance_table_symmetric", sym_table_solve, solve_states, BENCH_TABLE_SOLVES, true);
+  fprintf(out, "  },\n");
+  bench_two_phase(out, &rng, threads);
+  fprintf(out, "}\n");
+  if (out != stdout)
+    fclose(out);
+  return 0;
+}
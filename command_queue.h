@@ -0,0 +1,96 @@
+#pragma once
+
+// Bounded lock-free queue of move commands from one producer thread to one
+// consumer thread.
+//
+// A ring of COMMAND_QUEUE_SIZE slots with a head only the consumer moves
+// and a tail only the producer moves, each on its own cache line. The
+// producer fills a slot before it publishes the new tail, and the consumer
+// reads a slot before it gives it back with the new head, so neither side
+// ever waits. A command that finds the ring full is dropped and counted;
+// the consumer may leave commands waiting until it is ready for them.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// A power of two, so positions wrap with a mask.
+#define COMMAND_QUEUE_SIZE 256
+
+struct Move_command {
+  // What to do and to what; the consumer gives the types their meaning.
+  int type;
+  int arg;
+  int flags;
+  // When the command was made, in seconds.
+  double time;
+};
+
+struct Command_queue {
+  alignas(64) std::atomic<uint32_t> head;
+  alignas(64) std::atomic<uint32_t> tail;
+  // Written by the producer.
+  std::atomic<uint64_t> pushed;
+  std::atomic<uint64_t> dropped;
+  // The most commands the consumer has seen waiting at once.
+  alignas(64) std::atomic<uint32_t> max_depth;
+  Move_command slots[COMMAND_QUEUE_SIZE];
+};
+
+static void command_queue_init(Command_queue *q)
+{
+  q->head = 0;
+  q->tail = 0;
+  q->pushed = 0;
+  q->dropped = 0;
+  q->max_depth = 0;
+}
+
+// Producer: false, and the command counted as dropped, if the ring is full.
+static bool command_queue_push(Command_queue *q, const Move_command &c)
+{
+  uint32_t tail = q->tail.load(std::memory_order_relaxed);
+  if (tail - q->head.load(std::memory_order_acquire) == COMMAND_QUEUE_SIZE) {
+    q->dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  q->slots[tail & (COMMAND_QUEUE_SIZE - 1)] = c;
+  q->tail.store(tail + 1, std::memory_order_release);
+  q->pushed.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+// Producer: pushes all n commands, or none of them, counted as dropped,
+// if the ring has no room for all. The consumer only ever makes room, so
+// the room seen at the start lasts.
+static bool command_queue_push_all(Command_queue *q, const Move_command *c, int n)
+{
+  uint32_t tail = q->tail.load(std::memory_order_relaxed);
+  if (COMMAND_QUEUE_SIZE - (tail - q->head.load(std::memory_order_acquire)) < (uint32_t)n) {
+    q->dropped.fetch_add(n, std::memory_order_relaxed);
+    return false;
+  }
+  for (int i = 0; i < n; i++)
+    q->slots[(tail + i) & (COMMAND_QUEUE_SIZE - 1)] = c[i];
+  q->tail.store(tail + n, std::memory_order_release);
+  q->pushed.fetch_add(n, std::memory_order_relaxed);
+  return true;
+}
+
+// Consumer: the oldest command, left in the queue, or NULL if it is empty.
+static const Move_command *command_queue_front(Command_queue *q)
+{
+  uint32_t head = q->head.load(std::memory_order_relaxed);
+  uint32_t depth = q->tail.load(std::memory_order_acquire) - head;
+  if (depth == 0)
+    return NULL;
+  if (depth > q->max_depth.load(std::memory_order_relaxed))
+    q->max_depth.store(depth, std::memory_order_relaxed);
+  return &q->slots[head & (COMMAND_QUEUE_SIZE - 1)];
+}
+
+// Consumer: removes the command command_queue_front() returned.
+static void command_queue_pop(Command_queue *q)
+{
+  q->head.store(q->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+// Which vector instructions the CPU running us has.
+//
+// Kernels for an instruction set are compiled with CPU_TARGET, so the rest
+// of the program needs no -m flags, and are only called after the matching
+// cpu_has_* check.
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define CPU_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CPU_TARGET(isa)
+#else
+#define CPU_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+static bool cpu_has_ssse3()
+{
+#ifdef _MSC_VER
+  int r[4];
+  __cpuid(r, 1);
+  return (r[2] & (1 << 9)) != 0;
+#else
+  return __builtin_cpu_supports("ssse3");
+#endif
+}
+
+static bool cpu_has_avx2()
+{
+#ifdef _MSC_VER
+  int r[4];
+  __cpuid(r, 0);
+  if (r[0] < 7)
+    return false;
+  __cpuid(r, 1);
+  // The OS must save the YMM registers too.
+  if (!(r[2] & (1 << 27)) || !(r[2] & (1 << 28)) || (_xgetbv(0) & 6) != 6)
+    return false;
+  __cpuidex(r, 7, 0);
+  return (r[1] & (1 << 5)) != 0;
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
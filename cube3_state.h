@@ -0,0 +1,240 @@
+#pragma once
+
+// 3x3x3 state as cubies.
+//
+// The corners are a Cube_state, so they turn through the 2x2x2 move tables
+// of cube_state.h. The twelve edges are kept slot by slot: ep[slot] is the
+// edge cubie there and eo[slot] whether it is flipped. Edge slots 0..7 are
+// the U and D layers and 8..11 the middle (UD slice) layer. An edge's
+// reference face is U or D in slots 0..7 and F or B in the slice; it is
+// unflipped when the sticker of its own reference face is on the slot's.
+// With that choice only F and B quarter turns flip edges.
+
+#include <string.h>
+#include "nxn_cube.h"
+#include "notation.h"
+#include "rng.h"
+
+#define EDGE_COUNT 12
+#define CUBE3_FACELETS (NXN_FACES * 9)
+
+struct Cube3_state {
+  Cube_state corners;
+  uint8_t ep[EDGE_COUNT];
+  uint8_t eo[EDGE_COUNT];
+};
+
+// Edge slot centres: UF UL UR UB, DF DL DR DB, FL FR BL BR.
+static const Ivec3 edge_positions[EDGE_COUNT] = {
+  { 0, 1, 1}, {-1, 1, 0}, { 1, 1, 0}, { 0, 1,-1},
+  { 0,-1, 1}, {-1,-1, 0}, { 1,-1, 0}, { 0,-1,-1},
+  {-1, 0, 1}, { 1, 0, 1}, {-1, 0,-1}, { 1, 0,-1},
+};
+
+// edge_move_slot[m][s] is where quarter turn m takes edge slot s, and
+// edge_move_flip[m][s] whether it flips the edge on the way.
+static uint8_t edge_move_slot[MOVE_COUNT][EDGE_COUNT];
+static uint8_t edge_move_flip[MOVE_COUNT][EDGE_COUNT];
+static bool cube3_initialized = false;
+
+static int edge_slot_at(Ivec3 p)
+{
+  for (int s = 0; s < EDGE_COUNT; s++)
+    if (edge_positions[s].x == p.x && edge_positions[s].y == p.y && edge_positions[s].z == p.z)
+      return s;
+  return -1;
+}
+
+// Outward normal of the slot's reference face, and of its other face.
+static Ivec3 edge_reference_face(int s)
+{
+  Ivec3 p = edge_positions[s];
+  return p.y ? Ivec3{ 0, p.y, 0 } : Ivec3{ 0, 0, p.z };
+}
+
+static Ivec3 edge_other_face(int s)
+{
+  Ivec3 p = edge_positions[s];
+  return p.x ? Ivec3{ p.x, 0, 0 } : Ivec3{ 0, 0, p.z };
+}
+
+static void cube3_init()
+{
+  if (cube3_initialized)
+    return;
+  cube3_initialized = true;
+  cube_state_init();
+  for (int m = 0; m < MOVE_COUNT; m++) {
+    const Rotation &r = rotations[move_rotation[m]];
+    for (int s = 0; s < EDGE_COUNT; s++) {
+      edge_move_slot[m][s] = s;
+      edge_move_flip[m][s] = 0;
+      if (ivec3_dot(edge_positions[s], face_normal[m >> 1]) <= 0)
+        continue;
+      int d = edge_slot_at(rotate_ivec3(r, edge_positions[s]));
+      Ivec3 f = rotate_ivec3(r, edge_reference_face(s)), g = edge_reference_face(d);
+      edge_move_slot[m][s] = d;
+      edge_move_flip[m][s] = f.x != g.x || f.y != g.y || f.z != g.z;
+    }
+  }
+}
+
+static Cube3_state cube3_solved()
+{
+  Cube3_state c;
+  c.corners = cube_state_solved();
+  for (int s = 0; s < EDGE_COUNT; s++) {
+    c.ep[s] = s;
+    c.eo[s] = 0;
+  }
+  return c;
+}
+
+static bool cube3_equal(const Cube3_state &a, const Cube3_state &b)
+{
+  return cube_state_equal(a.corners, b.corners) && memcmp(a.ep, b.ep, EDGE_COUNT) == 0 &&
+         memcmp(a.eo, b.eo, EDGE_COUNT) == 0;
+}
+
+static inline Cube3_state cube3_apply_move(const Cube3_state &c, int move)
+{
+  Cube3_state o;
+  o.corners = apply_move(c.corners, move);
+  const uint8_t *slot = edge_move_slot[move], *flip = edge_move_flip[move];
+  for (int s = 0; s < EDGE_COUNT; s++) {
+    o.ep[slot[s]] = c.ep[s];
+    o.eo[slot[s]] = c.eo[s] ^ flip[s];
+  }
+  return o;
+}
+
+// Like apply_move_text (notation.h), for the whole cube.
+static bool cube3_apply_move_text(Cube3_state *c, const char *text)
+{
+  int move, turns, token;
+  while ((token = next_move_token(&text, &move, &turns)) == TOKEN_MOVE) {
+    for (int i = 0; i < turns; i++)
+      *c = cube3_apply_move(*c, move);
+  }
+  return token == TOKEN_END;
+}
+
+static int permutation_parity(const uint8_t *p, int n)
+{
+  int parity = 0;
+  for (int i = 0; i < n; i++)
+    for (int j = i + 1; j < n; j++)
+      parity ^= p[j] < p[i];
+  return parity;
+}
+
+// Reads 54 face letters, one per sticker in the order of Nxn_cube (face by
+// face F L R B U D, rows from the top left as seen from outside), each
+// naming the face whose colour the sticker has. False unless the centres
+// are home and the stickers make a cube that can be solved.
+static bool cube3_from_facelets(const char *text, Cube3_state *out)
+{
+  // colour[x + 1][y + 1][z + 1][face] of the cubie centred at (x, y, z).
+  int8_t colour[3][3][3][NXN_FACES];
+  memset(colour, -1, sizeof(colour));
+  for (int i = 0; i < CUBE3_FACELETS; i++) {
+    const char *letter = text[i] ? strchr(face_letters, text[i]) : NULL;
+    if (!letter)
+      return false;
+    int face = i / 9;
+    Ivec3 f = face_normal[face], q = nxn_sticker_position(3, face, i % 9 / 3, i % 3);
+    colour[(q.x - f.x) / 2 + 1][(q.y - f.y) / 2 + 1][(q.z - f.z) / 2 + 1][face] = (int8_t)(letter - face_letters);
+  }
+  for (int face = 0; face < NXN_FACES; face++) {
+    Ivec3 f = face_normal[face];
+    if (colour[f.x + 1][f.y + 1][f.z + 1][face] != face)
+      return false;
+  }
+
+  Corner_cubies cc;
+  int twist_sum = 0;
+  for (int s = 0; s < CORNER_COUNT; s++) {
+    Ivec3 p = slot_position(s), faces[3], home = { 0, 0, 0 };
+    corner_faces(s, faces);
+    int c[3], twist = -1;
+    for (int k = 0; k < 3; k++) {
+      c[k] = colour[p.x + 1][p.y + 1][p.z + 1][nxn_face_of(faces[k])];
+      home.x += face_normal[c[k]].x;
+      home.y += face_normal[c[k]].y;
+      home.z += face_normal[c[k]].z;
+      if (c[k] >= 4)
+        twist = k;
+    }
+    if (twist < 0 || home.x * home.y * home.z == 0)
+      return false;
+    // The colours must run clockwise like the cubie's own faces.
+    int cubie = slot_at(home);
+    Ivec3 home_faces[3];
+    corner_faces(cubie, home_faces);
+    for (int k = 0; k < 3; k++)
+      if (c[(twist + k) % 3] != nxn_face_of(home_faces[k]))
+        return false;
+    cc.cp[s] = cubie;
+    cc.co[s] = twist;
+    twist_sum += twist;
+  }
+
+  Cube3_state e;
+  int flip_sum = 0;
+  for (int s = 0; s < EDGE_COUNT; s++) {
+    Ivec3 p = edge_positions[s];
+    int a = colour[p.x + 1][p.y + 1][p.z + 1][nxn_face_of(edge_reference_face(s))];
+    int b = colour[p.x + 1][p.y + 1][p.z + 1][nxn_face_of(edge_other_face(s))];
+    Ivec3 na = face_normal[a], nb = face_normal[b];
+    int cubie = edge_slot_at(Ivec3{ na.x + nb.x, na.y + nb.y, na.z + nb.z });
+    if (cubie < 0 || ivec3_dot(na, nb) != 0)
+      return false;
+    e.ep[s] = cubie;
+    e.eo[s] = a != nxn_face_of(edge_reference_face(cubie));
+    flip_sum += e.eo[s];
+  }
+
+  uint8_t seen_corners = 0;
+  uint16_t seen_edges = 0;
+  for (int s = 0; s < CORNER_COUNT; s++)
+    seen_corners |= 1 << cc.cp[s];
+  for (int s = 0; s < EDGE_COUNT; s++)
+    seen_edges |= 1 << e.ep[s];
+  if (seen_corners != 0xff || seen_edges != 0xfff || twist_sum % 3 || flip_sum % 2 ||
+      permutation_parity(cc.cp, CORNER_COUNT) != permutation_parity(e.ep, EDGE_COUNT))
+    return false;
+  e.corners = cube_state_from_cubies(cc);
+  *out = e;
+  return true;
+}
+
+static void shuffle_bytes(Rng *rng, uint8_t *p, int n)
+{
+  for (int i = n - 1; i > 0; i--) {
+    int j = rng_below(rng, i + 1);
+    uint8_t t = p[i];
+    p[i] = p[j];
+    p[j] = t;
+  }
+}
+
+// A uniformly random solvable state.
+static Cube3_state cube3_random(Rng *rng)
+{
+  Cube3_state c = cube3_solved();
+  Corner_cubies cc = corner_cubies_solved();
+  shuffle_bytes(rng, cc.cp, CORNER_COUNT);
+  shuffle_bytes(rng, c.ep, EDGE_COUNT);
+  if (permutation_parity(cc.cp, CORNER_COUNT) != permutation_parity(c.ep, EDGE_COUNT)) {
+    uint8_t t = c.ep[0];
+    c.ep[0] = c.ep[1];
+    c.ep[1] = t;
+  }
+  c.corners.perm = perm_rank(cc.cp, CORNER_COUNT);
+  c.corners.twist = rng_below(rng, CORNER_TWIST_COUNT);
+  int flips = 0;
+  for (int s = 0; s < EDGE_COUNT - 1; s++)
+    flips += c.eo[s] = rng_below(rng, 2);
+  c.eo[EDGE_COUNT - 1] = flips & 1;
+  return c;
+}
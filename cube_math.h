@@ -0,0 +1,300 @@
+#pragma once
+
+// Vector, matrix and quaternion math shared by the renderer and tools.
+// Matrices are column major, as glMultMatrixf expects.
+
+#include <math.h>
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define MATH_SSE 1
+#include <xmmintrin.h>
+#endif
+
+struct Vector3
+{
+	float x, y, z;
+};
+
+struct Matrix {
+	float e[16];
+};
+
+struct Quat {
+  float x,y,z,w;
+};
+
+#define MATH_PI 3.141592653589793238f
+float to_radians(float d)
+{
+	return MATH_PI / 180.0f * d;
+}
+
+float lerp(float from, float to, float alpha) {
+	return from + (to - from) * alpha;
+}
+
+Matrix translation(Vector3 t) {
+	Matrix m = {
+		1.0f, 0.0f, 0.0f, 0.0f,
+		0.0f, 1.0f, 0.0f, 0.0f,
+		0.0f, 0.0f, 1.0f, 0.0f,
+		t.x,t.y, t.z, 1.0f,
+	};
+	return m;
+}
+
+Matrix rotation_z(float angle) {
+	float c = cosf(angle);
+	float s = sinf(angle);
+	Matrix m = {
+		c,       s, 0.0f, 0.0f,
+		-s,       c, 0.0f, 0.0f,
+		0.0f,  0.0f, 1.0f, 0.0f,
+		0.0f,  0.0f, 0.0f, 1.0f,
+	};
+	return m;
+}
+
+Matrix rotation_x(float angle) {
+	float c = cosf(angle);
+	float s = sinf(angle);
+	Matrix m = {
+		1.0f,  0.0f, 0.0f, 0.0f,
+		0.0f,  c, -s, 0.0f,
+		0.0f,  s, c, 0.0f,
+		0.0f,  0.0f, 0.0f, 1.0f,
+	};
+	return m;
+}
+
+Matrix rotation_y(float angle) {
+	float c = cosf(angle);
+	float s = sinf(angle);
+	Matrix m = {
+		c,  0.0f, s, 0.0f,
+		0.0f,  1.0f, 0.0f, 0.0f,
+		-s,  0.0f, c, 0.0f,
+		0.0f,  0.0f, 0.0f, 1.0f,
+	};
+	return m;
+}
+
+Matrix scalar(Vector3 s) {
+	Matrix m = {
+		s.x, 0.0f, 0.0f, 0.0f,
+		0.0f, s.y, 0.0f, 0.0f,
+		0.0f, 0.0f, s.z, 0.0f,
+		0.0f, 0.0f, 0.0f, 1.0f,
+	};
+	return m;
+}
+
+Matrix perspective_projection(float fov, float aspect_ratio, float n, float f) {
+  float  cot = 1.0f / tanf(fov * 0.5f);
+  float  fpn = f + n;
+  float  fmn = f - n;
+  Matrix m = {cot / aspect_ratio,0.0f, 0.0f, 0.0f,
+              0.0f, cot, 0.0f, 0.0f,
+              0.0f, 0.0f,-fpn / fmn, -1.0f,
+              0.0f, 0.0f,-2.0f*f*n/fmn, 0.0f};
+  return m;
+}
+
+Quat quat_identity() {
+  return Quat{0, 0, 0, 1};
+}
+
+Quat normalize(Quat q) {
+  float len = q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w;
+  len = sqrtf(len);
+  if (len !=0) {
+    q.x /= len;
+    q.y /= len;
+    q.z /= len;
+    q.w /= len;
+    return q;
+  }
+  return Quat{0,0,0,1};
+}
+
+Quat lerp(Quat from, Quat to, float alpha) {
+  Quat res;
+  res.x = from.x + (to.x - from.x) * alpha;
+  res.y = from.y + (to.y - from.y) * alpha;
+  res.z = from.z + (to.z - from.z) * alpha;
+  res.w = from.w + (to.w - from.w) * alpha;
+  return normalize(res);
+}
+
+Quat quat_mul(Quat q1, Quat q2) {
+  float a = q1.w;
+  float b = q1.x;
+  float c = q1.y;
+  float d = q1.z;
+
+  float e = q2.w;
+  float f = q2.x;
+  float g = q2.y;
+  float h = q2.z;
+
+  Quat res;
+  res.w = a * e - b * f - c * g - d * h;
+  res.x = a * f + b * e + c * h - d * g;
+  res.y = a * g - b * h + c * e + d * f;
+  res.z = a * h + b * g - c * f + d * e;
+  return res;
+}
+
+Quat quat_angle_axis(Vector3 axis, float angle) {
+  float r = cosf(angle * 0.5f);
+  float s = sinf(angle * 0.5f);
+  float i = s * axis.x;
+  float j = s * axis.y;
+  float k = s * axis.z;
+  return Quat{i, j, k, r};
+}
+
+Matrix quat_get_matrix(Quat q) {
+  float i = q.x;
+  float j = q.y;
+  float k = q.z;
+  float r = q.w;
+
+  float ii = i * i;
+  float jj = j * j;
+  float kk = k * k;
+
+  float ij = i * j;
+  float jk = j * k;
+  float kr = k * r;
+  float jr = j * r;
+  float ir = i * r;
+  float ik = i * k;
+
+  Matrix m;
+
+  m.e[0] = 1 - 2 * (jj + kk);
+  m.e[4] = 2 * (ij - kr);
+  m.e[8] = 2 * (ik + jr);
+  m.e[12] = 0;
+
+  m.e[1] = 2 * (ij + kr);
+  m.e[5] = 1 - 2 * (ii + kk);
+  m.e[9] = 2 * (jk - ir);
+  m.e[13] = 0;
+
+  m.e[2] = 2 * (ik - jr);
+  m.e[6] = 2 * (jk + ir);
+  m.e[10] = 1 - 2 * (ii + jj);
+  m.e[14] = 0;
+
+  m.e[3] = 0;
+  m.e[7] = 0;
+  m.e[11] = 0;
+  m.e[15] = 1;
+
+  return m;
+}
+
+// m is a proper rotation with integer entries, m[row][col].
+Quat quat_from_rotation(const int m[3][3]) {
+  float trace = (float)(m[0][0] + m[1][1] + m[2][2]);
+  Quat q;
+  if (trace > 0) {
+    float s = sqrtf(trace + 1.0f) * 2.0f;
+    q.w = 0.25f * s;
+    q.x = (m[2][1] - m[1][2]) / s;
+    q.y = (m[0][2] - m[2][0]) / s;
+    q.z = (m[1][0] - m[0][1]) / s;
+  } else if (m[0][0] > m[1][1] && m[0][0] > m[2][2]) {
+    float s = sqrtf(1.0f + m[0][0] - m[1][1] - m[2][2]) * 2.0f;
+    q.w = (m[2][1] - m[1][2]) / s;
+    q.x = 0.25f * s;
+    q.y = (m[0][1] + m[1][0]) / s;
+    q.z = (m[0][2] + m[2][0]) / s;
+  } else if (m[1][1] > m[2][2]) {
+    float s = sqrtf(1.0f + m[1][1] - m[0][0] - m[2][2]) * 2.0f;
+    q.w = (m[0][2] - m[2][0]) / s;
+    q.x = (m[0][1] + m[1][0]) / s;
+    q.y = 0.25f * s;
+    q.z = (m[1][2] + m[2][1]) / s;
+  } else {
+    float s = sqrtf(1.0f + m[2][2] - m[0][0] - m[1][1]) * 2.0f;
+    q.w = (m[1][0] - m[0][1]) / s;
+    q.x = (m[0][2] + m[2][0]) / s;
+    q.y = (m[1][2] + m[2][1]) / s;
+    q.z = 0.25f * s;
+  }
+  return q;
+}
+
+float quat_dot(Quat a, Quat b) {
+  return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+}
+
+// Constant speed along the shorter arc from one orientation to the other.
+Quat slerp(Quat from, Quat to, float alpha) {
+  float d = quat_dot(from, to);
+  if (d < 0) {
+    to = Quat{-to.x, -to.y, -to.z, -to.w};
+    d = -d;
+  }
+  // Nearly parallel, where sin(theta) gets too small to divide by.
+  if (d > 0.9995f)
+    return lerp(from, to, alpha);
+  float theta = acosf(d);
+  float s = sinf(theta);
+  float a = sinf((1.0f - alpha) * theta) / s;
+  float b = sinf(alpha * theta) / s;
+  return Quat{a * from.x + b * to.x, a * from.y + b * to.y, a * from.z + b * to.z, a * from.w + b * to.w};
+}
+
+// a * b, which applies b first. With SSE every column of the result is the
+// columns of a scaled by one column of b, summed in the same order as the
+// scalar loop, so both give the same bits.
+Matrix matrix_mul(const Matrix &a, const Matrix &b) {
+  Matrix m;
+#ifdef MATH_SSE
+  __m128 a0 = _mm_loadu_ps(a.e), a1 = _mm_loadu_ps(a.e + 4), a2 = _mm_loadu_ps(a.e + 8), a3 = _mm_loadu_ps(a.e + 12);
+  for (int c = 0; c < 4; c++) {
+    const float *bc = b.e + c * 4;
+    __m128 col = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(a0, _mm_set1_ps(bc[0])), _mm_mul_ps(a1, _mm_set1_ps(bc[1]))),
+                                       _mm_mul_ps(a2, _mm_set1_ps(bc[2]))),
+                            _mm_mul_ps(a3, _mm_set1_ps(bc[3])));
+    _mm_storeu_ps(m.e + c * 4, col);
+  }
+#else
+  for (int c = 0; c < 4; c++)
+    for (int r = 0; r < 4; r++)
+      m.e[c * 4 + r] = a.e[r] * b.e[c * 4] + a.e[4 + r] * b.e[c * 4 + 1] +
+                       a.e[8 + r] * b.e[c * 4 + 2] + a.e[12 + r] * b.e[c * 4 + 3];
+#endif
+  return m;
+}
+
+// Inverse by cofactors. False if m is singular.
+bool matrix_inverse(const Matrix &m, Matrix *out) {
+  const float *a = m.e;
+  float inv[16];
+  inv[0] = a[5] * a[10] * a[15] - a[5] * a[11] * a[14] - a[9] * a[6] * a[15] + a[9] * a[7] * a[14] + a[13] * a[6] * a[11] - a[13] * a[7] * a[10];
+  inv[4] = -a[4] * a[10] * a[15] + a[4] * a[11] * a[14] + a[8] * a[6] * a[15] - a[8] * a[7] * a[14] - a[12] * a[6] * a[11] + a[12] * a[7] * a[10];
+  inv[8] = a[4] * a[9] * a[15] - a[4] * a[11] * a[13] - a[8] * a[5] * a[15] + a[8] * a[7] * a[13] + a[12] * a[5] * a[11] - a[12] * a[7] * a[9];
+  inv[12] = -a[4] * a[9] * a[14] + a[4] * a[10] * a[13] + a[8] * a[5] * a[14] - a[8] * a[6] * a[13] - a[12] * a[5] * a[10] + a[12] * a[6] * a[9];
+  inv[1] = -a[1] * a[10] * a[15] + a[1] * a[11] * a[14] + a[9] * a[2] * a[15] - a[9] * a[3] * a[14] - a[13] * a[2] * a[11] + a[13] * a[3] * a[10];
+  inv[5] = a[0] * a[10] * a[15] - a[0] * a[11] * a[14] - a[8] * a[2] * a[15] + a[8] * a[3] * a[14] + a[12] * a[2] * a[11] - a[12] * a[3] * a[10];
+  inv[9] = -a[0] * a[9] * a[15] + a[0] * a[11] * a[13] + a[8] * a[1] * a[15] - a[8] * a[3] * a[13] - a[12] * a[1] * a[11] + a[12] * a[3] * a[9];
+  inv[13] = a[0] * a[9] * a[14] - a[0] * a[10] * a[13] - a[8] * a[1] * a[14] + a[8] * a[2] * a[13] + a[12] * a[1] * a[10] - a[12] * a[2] * a[9];
+  inv[2] = a[1] * a[6] * a[15] - a[1] * a[7] * a[14] - a[5] * a[2] * a[15] + a[5] * a[3] * a[14] + a[13] * a[2] * a[7] - a[13] * a[3] * a[6];
+  inv[6] = -a[0] * a[6] * a[15] + a[0] * a[7] * a[14] + a[4] * a[2] * a[15] - a[4] * a[3] * a[14] - a[12] * a[2] * a[7] + a[12] * a[3] * a[6];
+  inv[10] = a[0] * a[5] * a[15] - a[0] * a[7] * a[13] - a[4] * a[1] * a[15] + a[4] * a[3] * a[13] + a[12] * a[1] * a[7] - a[12] * a[3] * a[5];
+  inv[14] = -a[0] * a[5] * a[14] + a[0] * a[6] * a[13] + a[4] * a[1] * a[14] - a[4] * a[2] * a[13] - a[12] * a[1] * a[6] + a[12] * a[2] * a[5];
+  inv[3] = -a[1] * a[6] * a[11] + a[1] * a[7] * a[10] + a[5] * a[2] * a[11] - a[5] * a[3] * a[10] - a[9] * a[2] * a[7] + a[9] * a[3] * a[6];
+  inv[7] = a[0] * a[6] * a[11] - a[0] * a[7] * a[10] - a[4] * a[2] * a[11] + a[4] * a[3] * a[10] + a[8] * a[2] * a[7] - a[8] * a[3] * a[6];
+  inv[11] = -a[0] * a[5] * a[11] + a[0] * a[7] * a[9] + a[4] * a[1] * a[11] - a[4] * a[3] * a[9] - a[8] * a[1] * a[7] + a[8] * a[3] * a[5];
+  inv[15] = a[0] * a[5] * a[10] - a[0] * a[6] * a[9] - a[4] * a[1] * a[10] + a[4] * a[2] * a[9] + a[8] * a[1] * a[6] - a[8] * a[2] * a[5];
+  float det = a[0] * inv[0] + a[1] * inv[4] + a[2] * inv[8] + a[3] * inv[12];
+  if (det == 0)
+    return false;
+  for (int i = 0; i < 16; i++)
+    out->e[i] = inv[i] / det;
+  return true;
+}
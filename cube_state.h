@@ -0,0 +1,366 @@
+#pragma once
+
+// Render-independent 2x2x2 state.
+//
+// A state is the corner permutation (Lehmer rank, 0..40319) and the corner
+// twist (base 3 over slots 0..6, slot 7 is implied, 0..2186) packed into one
+// 32 bit word, so applying a move is two lookups in tables built once by
+// cube_state_init().
+
+#include <stdint.h>
+
+// Move ids are the values pushed onto the history stack in main():
+// face = move >> 1 in the order F, L, R, B, U, D, even ids turn the face
+// clockwise and odd ids anti-clockwise, so the inverse of a move is move ^ 1.
+enum {
+  MOVE_FR, MOVE_FL,
+  MOVE_LR, MOVE_LL,
+  MOVE_RR, MOVE_RL,
+  MOVE_BR, MOVE_BL,
+  MOVE_UR, MOVE_UL,
+  MOVE_DR, MOVE_DL,
+  MOVE_COUNT
+};
+
+#define CORNER_COUNT 8
+#define CORNER_PERM_COUNT 40320
+#define CORNER_TWIST_COUNT 2187
+#define ROTATION_COUNT 24
+
+struct Cube_state {
+  uint16_t perm;
+  uint16_t twist;
+};
+
+// Cubie level view of a state: slot i holds cubie cp[i] twisted by co[i].
+// Slots and cubies are numbered like Cube_info cubes[8] in main().
+struct Corner_cubies {
+  uint8_t cp[CORNER_COUNT];
+  uint8_t co[CORNER_COUNT];
+};
+
+struct Ivec3 {
+  int x, y, z;
+};
+
+// Proper rotation of the cube with integer entries, m[row][col].
+struct Rotation {
+  int m[3][3];
+};
+
+// The move tables point at this storage once cube_state_init() has filled
+// it, or into a mapped table file (see table_file.h).
+static uint16_t perm_move_storage[CORNER_PERM_COUNT][MOVE_COUNT];
+static uint16_t twist_move_storage[CORNER_TWIST_COUNT][MOVE_COUNT];
+static const uint16_t (*perm_move_table)[MOVE_COUNT] = perm_move_storage;
+static const uint16_t (*twist_move_table)[MOVE_COUNT] = twist_move_storage;
+static bool cube_state_initialized = false;
+
+static Rotation rotations[ROTATION_COUNT];
+// rotation_slot[r][s] is where rotation r takes slot s, rotation_twist[r][s]
+// is the twist it adds to the cubie it moves.
+static uint8_t rotation_slot[ROTATION_COUNT][CORNER_COUNT];
+static uint8_t rotation_twist[ROTATION_COUNT][CORNER_COUNT];
+// rotation_of[cubie][slot][twist] is the rotation that carries a cubie from
+// its home into that slot with that twist.
+static uint8_t rotation_of[CORNER_COUNT][CORNER_COUNT][3];
+static uint8_t rotation_inverse[ROTATION_COUNT];
+// move_rotation[m] is the quarter turn that move m applies to its layer.
+static uint8_t move_rotation[MOVE_COUNT];
+
+// Outward normals of F, L, R, B, U, D.
+static const Ivec3 face_normal[6] = {
+  { 0, 0, 1}, {-1, 0, 0}, { 1, 0, 0}, { 0, 0,-1}, { 0, 1, 0}, { 0,-1, 0},
+};
+
+static Ivec3 slot_position(int s)
+{
+  // Doubled centre of cubes[s].p in main().
+  Ivec3 p = { (s & 1) ? -1 : 1, (s & 2) ? 1 : -1, (s & 4) ? -1 : 1 };
+  return p;
+}
+
+static int slot_at(Ivec3 p)
+{
+  return (p.x < 0 ? 1 : 0) | (p.y > 0 ? 2 : 0) | (p.z < 0 ? 4 : 0);
+}
+
+static int ivec3_dot(Ivec3 a, Ivec3 b)
+{
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static Ivec3 rotate_ivec3(const Rotation &r, Ivec3 v)
+{
+  Ivec3 o = {
+    r.m[0][0] * v.x + r.m[0][1] * v.y + r.m[0][2] * v.z,
+    r.m[1][0] * v.x + r.m[1][1] * v.y + r.m[1][2] * v.z,
+    r.m[2][0] * v.x + r.m[2][1] * v.y + r.m[2][2] * v.z,
+  };
+  return o;
+}
+
+static Rotation rotation_mul(const Rotation &a, const Rotation &b)
+{
+  Rotation o;
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+      o.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j];
+  return o;
+}
+
+static bool rotation_equal(const Rotation &a, const Rotation &b)
+{
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+      if (a.m[i][j] != b.m[i][j])
+        return false;
+  return true;
+}
+
+// Quarter turn about an axis parallel to x, y or z (right handed).
+static Rotation quarter_turn(Ivec3 axis)
+{
+  Rotation r = {{{0,0,0},{0,0,0},{0,0,0}}};
+  int a[3] = { axis.x, axis.y, axis.z };
+  for (int i = 0; i < 3; i++) {
+    if (a[i] == 0)
+      continue;
+    int j = (i + 1) % 3, k = (i + 2) % 3;
+    r.m[i][i] = 1;
+    r.m[j][k] = -a[i];
+    r.m[k][j] = a[i];
+  }
+  return r;
+}
+
+static int find_rotation(const Rotation &r)
+{
+  for (int i = 0; i < ROTATION_COUNT; i++)
+    if (rotation_equal(rotations[i], r))
+      return i;
+  return -1;
+}
+
+// Faces around a corner slot, clockwise seen from outside, starting with the
+// U or D face. A twist is the index here of the face holding the U/D sticker.
+static void corner_faces(int s, Ivec3 faces[3])
+{
+  Ivec3 p = slot_position(s);
+  Ivec3 x = { p.x, 0, 0 }, y = { 0, p.y, 0 }, z = { 0, 0, p.z };
+  faces[0] = y;
+  // y, x, z is clockwise exactly when its triple product is negative.
+  if (p.x * p.y * p.z > 0) {
+    faces[1] = x;
+    faces[2] = z;
+  } else {
+    faces[1] = z;
+    faces[2] = x;
+  }
+}
+
+static int corner_face_index(int s, Ivec3 f)
+{
+  Ivec3 faces[3];
+  corner_faces(s, faces);
+  for (int i = 0; i < 3; i++)
+    if (ivec3_dot(faces[i], f) > 0)
+      return i;
+  return -1;
+}
+
+// Applies rotation r to every slot whose centre lies on the positive side of
+// layer, or to the whole cube when layer is zero.
+static Corner_cubies corner_cubies_turn(const Corner_cubies &c, int r, Ivec3 layer)
+{
+  Corner_cubies o = c;
+  for (int s = 0; s < CORNER_COUNT; s++) {
+    if (ivec3_dot(slot_position(s), layer) < 0)
+      continue;
+    int d = rotation_slot[r][s];
+    o.cp[d] = c.cp[s];
+    o.co[d] = (c.co[s] + rotation_twist[r][s]) % 3;
+  }
+  return o;
+}
+
+static Corner_cubies corner_cubies_move(const Corner_cubies &c, int move)
+{
+  return corner_cubies_turn(c, move_rotation[move], face_normal[move >> 1]);
+}
+
+static Corner_cubies corner_cubies_solved()
+{
+  Corner_cubies c;
+  for (int i = 0; i < CORNER_COUNT; i++) {
+    c.cp[i] = i;
+    c.co[i] = 0;
+  }
+  return c;
+}
+
+static int perm_rank(const uint8_t *p, int n)
+{
+  int rank = 0;
+  for (int i = 0; i < n; i++) {
+    int smaller = 0;
+    for (int j = i + 1; j < n; j++)
+      if (p[j] < p[i])
+        smaller++;
+    rank = rank * (n - i) + smaller;
+  }
+  return rank;
+}
+
+static void perm_unrank(int rank, uint8_t *p, int n)
+{
+  // Lehmer digits come out last first.
+  int digits[CORNER_COUNT];
+  for (int i = n - 1; i >= 0; i--) {
+    digits[i] = rank % (n - i);
+    rank /= n - i;
+  }
+  bool used[CORNER_COUNT] = {};
+  for (int i = 0; i < n; i++) {
+    int k = digits[i];
+    for (int v = 0; v < n; v++) {
+      if (used[v])
+        continue;
+      if (k-- == 0) {
+        p[i] = v;
+        used[v] = true;
+        break;
+      }
+    }
+  }
+}
+
+static int twist_rank(const uint8_t *co)
+{
+  int rank = 0;
+  for (int i = 0; i < CORNER_COUNT - 1; i++)
+    rank = rank * 3 + co[i];
+  return rank;
+}
+
+static void twist_unrank(int rank, uint8_t *co)
+{
+  int sum = 0;
+  for (int i = CORNER_COUNT - 2; i >= 0; i--) {
+    co[i] = rank % 3;
+    sum += co[i];
+    rank /= 3;
+  }
+  co[CORNER_COUNT - 1] = (3 - sum % 3) % 3;
+}
+
+static Cube_state cube_state_from_cubies(const Corner_cubies &c)
+{
+  Cube_state s;
+  s.perm = perm_rank(c.cp, CORNER_COUNT);
+  s.twist = twist_rank(c.co);
+  return s;
+}
+
+static Corner_cubies cube_state_to_cubies(Cube_state s)
+{
+  Corner_cubies c;
+  perm_unrank(s.perm, c.cp, CORNER_COUNT);
+  twist_unrank(s.twist, c.co);
+  return c;
+}
+
+static Cube_state cube_state_solved()
+{
+  Cube_state s = { 0, 0 };
+  return s;
+}
+
+static bool cube_state_equal(Cube_state a, Cube_state b)
+{
+  return a.perm == b.perm && a.twist == b.twist;
+}
+
+static inline Cube_state apply_move(Cube_state s, int move)
+{
+  Cube_state o;
+  o.perm = perm_move_table[s.perm][move];
+  o.twist = twist_move_table[s.twist][move];
+  return o;
+}
+
+// Rotation that carries each cubie from its home to where s has put it.
+static void cube_state_rotations(Cube_state s, uint8_t out[CORNER_COUNT])
+{
+  Corner_cubies c = cube_state_to_cubies(s);
+  for (int i = 0; i < CORNER_COUNT; i++)
+    out[c.cp[i]] = rotation_of[c.cp[i]][i][c.co[i]];
+}
+
+static void init_rotations()
+{
+  Ivec3 x = { 1, 0, 0 }, y = { 0, 1, 0 };
+  Rotation gen[2] = { quarter_turn(x), quarter_turn(y) };
+  Rotation id = {{{1,0,0},{0,1,0},{0,0,1}}};
+  rotations[0] = id;
+  int count = 1;
+  for (int i = 0; i < count; i++) {
+    for (int g = 0; g < 2; g++) {
+      Rotation r = rotation_mul(gen[g], rotations[i]);
+      bool seen = false;
+      for (int j = 0; j < count && !seen; j++)
+        seen = rotation_equal(rotations[j], r);
+      if (!seen)
+        rotations[count++] = r;
+    }
+  }
+
+  for (int r = 0; r < ROTATION_COUNT; r++) {
+    Rotation t;
+    for (int i = 0; i < 3; i++)
+      for (int j = 0; j < 3; j++)
+        t.m[i][j] = rotations[r].m[j][i];
+    rotation_inverse[r] = find_rotation(t);
+
+    for (int s = 0; s < CORNER_COUNT; s++) {
+      Ivec3 faces[3];
+      corner_faces(s, faces);
+      int d = slot_at(rotate_ivec3(rotations[r], slot_position(s)));
+      int t = corner_face_index(d, rotate_ivec3(rotations[r], faces[0]));
+      rotation_slot[r][s] = d;
+      rotation_twist[r][s] = t;
+      rotation_of[s][d][t] = r;
+    }
+  }
+
+  for (int m = 0; m < MOVE_COUNT; m++) {
+    Ivec3 n = face_normal[m >> 1];
+    // Clockwise seen from outside turns about the inward normal.
+    Ivec3 axis = { -n.x, -n.y, -n.z };
+    if (m & 1)
+      axis = n;
+    move_rotation[m] = find_rotation(quarter_turn(axis));
+  }
+}
+
+static void cube_state_init()
+{
+  if (cube_state_initialized)
+    return;
+  cube_state_initialized = true;
+
+  init_rotations();
+
+  Corner_cubies c = corner_cubies_solved();
+  for (int p = 0; p < CORNER_PERM_COUNT; p++) {
+    perm_unrank(p, c.cp, CORNER_COUNT);
+    for (int m = 0; m < MOVE_COUNT; m++)
+      perm_move_storage[p][m] = perm_rank(corner_cubies_move(c, m).cp, CORNER_COUNT);
+  }
+  c = corner_cubies_solved();
+  for (int t = 0; t < CORNER_TWIST_COUNT; t++) {
+    twist_unrank(t, c.co);
+    for (int m = 0; m < MOVE_COUNT; m++)
+      twist_move_storage[t][m] = twist_rank(corner_cubies_move(c, m).co);
+  }
+}
@@ -0,0 +1,351 @@
+#pragma once
+
+// Exact distance to solved for every reduced position.
+//
+// Quarter turns flip the corner permutation parity, so neighbouring
+// positions are always exactly one move nearer or further. Storing the
+// distance mod 3 in 2 bits is then enough to walk downhill: the neighbour
+// one move nearer is the only one holding (d - 1) mod 3. Unvisited entries
+// hold DISTANCE_UNKNOWN.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "solver.h"
+#include "symmetry.h"
+
+#define DISTANCE_UNKNOWN 3
+// Sixteen 2 bit entries per 32 bit word.
+#define DISTANCE_TABLE_WORDS ((REDUCED_STATE_COUNT + 15) / 16)
+#define DISTANCE_TABLE_BYTES (DISTANCE_TABLE_WORDS * 4)
+#define FRONTIER_WORDS ((REDUCED_STATE_COUNT + 63) / 64)
+// The same packing over symmetry classes (symmetry.h), about a tenth of
+// the size.
+#define SYM_DISTANCE_TABLE_WORDS ((SYM_STATE_COUNT + 15) / 16)
+#define SYM_DISTANCE_TABLE_BYTES (SYM_DISTANCE_TABLE_WORDS * 4)
+// Frontier words a BFS thread takes at a time.
+#define FRONTIER_CHUNK 256
+
+static inline int lowest_bit(uint64_t bits)
+{
+#ifdef _MSC_VER
+  unsigned long i;
+  _BitScanForward64(&i, bits);
+  return (int)i;
+#else
+  return __builtin_ctzll(bits);
+#endif
+}
+
+// Points at distance_storage after distance_table_build(), or into a mapped
+// table file.
+static std::atomic<uint32_t> *distance_storage = NULL;
+static const uint32_t *distance_table = NULL;
+static uint32_t distance_histogram[SOLVER_MAX_DEPTH + 1];
+static double distance_layer_ms[SOLVER_MAX_DEPTH + 1];
+static int distance_max_depth = -1;
+// Points at sym_distance_storage after sym_distance_table_build(), or into
+// a mapped table file.
+static uint32_t *sym_distance_storage = NULL;
+static const uint32_t *sym_distance_table = NULL;
+
+static inline int distance_get(const uint32_t *table, int i)
+{
+  return (table[i >> 4] >> ((i & 15) * 2)) & 3;
+}
+
+static inline int reduced_neighbour(int index, int m)
+{
+  int perm = index / REDUCED_TWIST_COUNT, twist = index % REDUCED_TWIST_COUNT;
+  return reduced_perm_move[perm][m] * REDUCED_TWIST_COUNT + reduced_twist_move[twist][m];
+}
+
+// One BFS layer, shared by all threads expanding it.
+struct Bfs_layer {
+  std::atomic<uint32_t> *table;
+  const std::atomic<uint64_t> *frontier;
+  std::atomic<uint64_t> *next;
+  int mark;
+  std::atomic<int> next_chunk;
+  std::atomic<uint32_t> found;
+};
+
+static void expand_frontier(Bfs_layer *l)
+{
+  uint32_t found = 0;
+  for (;;) {
+    int begin = l->next_chunk.fetch_add(FRONTIER_CHUNK, std::memory_order_relaxed);
+    if (begin >= FRONTIER_WORDS)
+      break;
+    int end = begin + FRONTIER_CHUNK < FRONTIER_WORDS ? begin + FRONTIER_CHUNK : FRONTIER_WORDS;
+    for (int w = begin; w < end; w++) {
+      for (uint64_t bits = l->frontier[w].load(std::memory_order_relaxed); bits; bits &= bits - 1) {
+        int index = w * 64 + lowest_bit(bits);
+        for (int m = 0; m < REDUCED_MOVE_COUNT; m++) {
+          int j = reduced_neighbour(index, m);
+          std::atomic<uint32_t> &word = l->table[j >> 4];
+          int shift = (j & 15) * 2;
+          if (((word.load(std::memory_order_relaxed) >> shift) & 3) != DISTANCE_UNKNOWN)
+            continue;
+          // Clearing the bits in which DISTANCE_UNKNOWN and mark differ
+          // turns the entry into mark. Only the thread that still saw it
+          // unknown owns the position.
+          uint32_t old = word.fetch_and(~((uint32_t)(DISTANCE_UNKNOWN ^ l->mark) << shift), std::memory_order_relaxed);
+          if (((old >> shift) & 3) != DISTANCE_UNKNOWN)
+            continue;
+          l->next[j >> 6].fetch_or(1ull << (j & 63), std::memory_order_relaxed);
+          found++;
+        }
+      }
+    }
+  }
+  l->found.fetch_add(found, std::memory_order_relaxed);
+}
+
+static double elapsed_ms(std::chrono::steady_clock::time_point since)
+{
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+}
+
+// Breadth first search from solved, one layer per pass over a frontier
+// bitmap, each layer split across threads. Per layer times go to
+// distance_layer_ms. Returns the total time in milliseconds.
+static double distance_table_build(int threads = 1)
+{
+  solver_init();
+  if (threads < 1)
+    threads = 1;
+  auto start = std::chrono::steady_clock::now();
+
+  if (!distance_storage)
+    distance_storage = new std::atomic<uint32_t>[DISTANCE_TABLE_WORDS];
+  std::atomic<uint32_t> *table = distance_storage;
+  for (int i = 0; i < DISTANCE_TABLE_WORDS; i++)
+    table[i].store(0xffffffffu, std::memory_order_relaxed);
+  memset(distance_histogram, 0, sizeof(distance_histogram));
+  memset(distance_layer_ms, 0, sizeof(distance_layer_ms));
+
+  std::atomic<uint64_t> *frontier = new std::atomic<uint64_t>[FRONTIER_WORDS];
+  std::atomic<uint64_t> *next = new std::atomic<uint64_t>[FRONTIER_WORDS];
+  for (int i = 0; i < FRONTIER_WORDS; i++) {
+    frontier[i].store(0, std::memory_order_relaxed);
+    next[i].store(0, std::memory_order_relaxed);
+  }
+
+  int solved = reduced_index(reduced_solved());
+  table[solved >> 4].fetch_and(~(3u << ((solved & 15) * 2)));
+  frontier[solved >> 6].store(1ull << (solved & 63));
+  distance_histogram[0] = 1;
+
+  int depth = 0;
+  for (; depth < SOLVER_MAX_DEPTH; depth++) {
+    auto layer_start = std::chrono::steady_clock::now();
+    Bfs_layer l;
+    l.table = table;
+    l.frontier = frontier;
+    l.next = next;
+    l.mark = (depth + 1) % 3;
+    l.next_chunk = 0;
+    l.found = 0;
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads; t++)
+      workers.push_back(std::thread(expand_frontier, &l));
+    expand_frontier(&l);
+    for (auto &w : workers)
+      w.join();
+
+    uint32_t found = l.found.load();
+    distance_layer_ms[depth + 1] = elapsed_ms(layer_start);
+    if (found == 0)
+      break;
+    distance_histogram[depth + 1] = found;
+    std::atomic<uint64_t> *t = frontier;
+    frontier = next;
+    next = t;
+    for (int i = 0; i < FRONTIER_WORDS; i++)
+      next[i].store(0, std::memory_order_relaxed);
+  }
+  distance_max_depth = depth;
+  static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "distance words must be plain words");
+  distance_table = (const uint32_t *)table;
+
+  delete[] frontier;
+  delete[] next;
+  return elapsed_ms(start);
+}
+
+// Walks downhill through the distance table, one lookup per neighbour.
+// Falls back to the IDA* solver when no table is loaded. Returns -1 if the
+// solution would not fit in max_moves, or if no neighbour is one closer,
+// which only a damaged table can cause.
+static int table_solve(Cube_state s, int *moves, int max_moves)
+{
+  if (!distance_table)
+    return solve(s, moves, max_moves);
+
+  int view;
+  int index = reduced_index(reduce_state(s, &view));
+  int d = distance_get(distance_table, index);
+  int len = 0;
+  // The solved position is reduced index 0.
+  while (index != 0) {
+    if (len == max_moves)
+      return -1;
+    int want = (d + 2) % 3, m = 0;
+    for (; m < REDUCED_MOVE_COUNT; m++) {
+      int j = reduced_neighbour(index, m);
+      if (distance_get(distance_table, j) == want) {
+        moves[len++] = unreduce_move(m, view);
+        index = j;
+        d = want;
+        break;
+      }
+    }
+    if (m == REDUCED_MOVE_COUNT)
+      return -1;
+  }
+  return len;
+}
+
+// Breadth first search over symmetry classes. A class member's neighbours
+// are symmetric to neighbours of the representative, or, for members
+// reached through inversion, to neighbours of its inverse, so expanding
+// both reaches every class one move away. Each entry found also fills the
+// entries its representative's stabilizer takes it to. Entries are bytes
+// while building and packed like distance_table at the end. Returns the
+// time in milliseconds.
+static double sym_distance_table_build()
+{
+  symmetry_init();
+  auto start = std::chrono::steady_clock::now();
+  std::vector<uint8_t> depth(SYM_STATE_COUNT, 0xff);
+  depth[sym_index(reduced_solved())] = 0;
+  for (int d = 0, found = 1; found; d++) {
+    found = 0;
+    for (int i = 0; i < SYM_STATE_COUNT; i++) {
+      if (depth[i] != d)
+        continue;
+      Reduced_state r[2];
+      r[0].perm = sym_class_perm[i / REDUCED_TWIST_COUNT];
+      r[0].twist = i % REDUCED_TWIST_COUNT;
+      r[1] = sym_reduced(r[0], 1);
+      for (int k = 0; k < 2; k++)
+        for (int m = 0; m < REDUCED_MOVE_COUNT; m++) {
+          int j = sym_index(apply_reduced_move(r[k], m));
+          if (depth[j] != 0xff)
+            continue;
+          depth[j] = d + 1;
+          found++;
+          int cls = j / REDUCED_TWIST_COUNT;
+          Reduced_state q = { sym_class_perm[cls], (uint16_t)(j % REDUCED_TWIST_COUNT) };
+          for (int sym = 1; sym < SYM_COUNT; sym++) {
+            if (!(sym_class_stabilizer[cls] >> sym & 1))
+              continue;
+            int e = cls * REDUCED_TWIST_COUNT + sym_reduced(q, sym).twist;
+            if (depth[e] == 0xff) {
+              depth[e] = d + 1;
+              found++;
+            }
+          }
+        }
+    }
+  }
+  if (!sym_distance_storage)
+    sym_distance_storage = new uint32_t[SYM_DISTANCE_TABLE_WORDS];
+  memset(sym_distance_storage, 0xff, SYM_DISTANCE_TABLE_BYTES);
+  for (int i = 0; i < SYM_STATE_COUNT; i++)
+    sym_distance_storage[i >> 4] &= ~((uint32_t)(DISTANCE_UNKNOWN ^ depth[i] % 3) << ((i & 15) * 2));
+  sym_distance_table = sym_distance_storage;
+  return elapsed_ms(start);
+}
+
+// table_solve through the symmetry reduced table: the walk is the same,
+// every neighbour's entry is found through sym_index, and so is the -1 for
+// a damaged table. A mapped table leaves the symmetry tables behind
+// sym_index to the first call, which must not race another.
+static int sym_table_solve(Cube_state s, int *moves, int max_moves)
+{
+  if (!sym_distance_table)
+    return solve(s, moves, max_moves);
+  symmetry_init();
+
+  int view;
+  Reduced_state r = reduce_state(s, &view);
+  int d = distance_get(sym_distance_table, sym_index(r));
+  int len = 0;
+  while (r.perm != 0 || r.twist != 0) {
+    if (len == max_moves)
+      return -1;
+    int want = (d + 2) % 3, m = 0;
+    for (; m < REDUCED_MOVE_COUNT; m++) {
+      Reduced_state next = apply_reduced_move(r, m);
+      if (distance_get(sym_distance_table, sym_index(next)) == want) {
+        moves[len++] = unreduce_move(m, view);
+        r = next;
+        d = want;
+        break;
+      }
+    }
+    if (m == REDUCED_MOVE_COUNT)
+      return -1;
+  }
+  return len;
+}
+
+static void print_distance_histogram(FILE *f)
+{
+  uint64_t total = 0;
+  for (int d = 0; d <= distance_max_depth; d++)
+    total += distance_histogram[d];
+  fprintf(f, "%llu positions, max distance %d\n", (unsigned long long)total, distance_max_depth);
+  for (int d = 0; d <= distance_max_depth; d++)
+    fprintf(f, "%2d: %u\n", d, distance_histogram[d]);
+}
+
+// --distance-table [threads]: builds the table with 1, 2, 4 ... threads
+// and prints the distance histogram, per layer times and scaling.
+static int distance_table_main(int argc, char *argv[])
+{
+  int max_threads = argc > 2 ? atoi(argv[2]) : (int)std::thread::hardware_concurrency();
+  if (max_threads < 1)
+    max_threads = 1;
+
+  std::vector<int> counts;
+  for (int t = 1; t < max_threads; t *= 2)
+    counts.push_back(t);
+  counts.push_back(max_threads);
+
+  std::vector<std::vector<double> > layer_ms;
+  std::vector<double> total_ms;
+  for (int t : counts) {
+    total_ms.push_back(distance_table_build(t));
+    layer_ms.push_back(std::vector<double>(distance_layer_ms, distance_layer_ms + SOLVER_MAX_DEPTH + 1));
+  }
+
+  print_distance_histogram(stdout);
+  printf("\nms per layer by thread count\nlayer");
+  for (int t : counts)
+    printf(" %9d", t);
+  printf("\n");
+  for (int d = 1; d <= distance_max_depth; d++) {
+    printf("%5d", d);
+    for (size_t i = 0; i < counts.size(); i++)
+      printf(" %9.2f", layer_ms[i][d]);
+    printf("\n");
+  }
+  printf("total");
+  for (size_t i = 0; i < counts.size(); i++)
+    printf(" %9.2f", total_ms[i]);
+  printf("\neff. ");
+  for (size_t i = 0; i < counts.size(); i++)
+    printf(" %8.0f%%", 100.0 * total_ms[0] / (counts[i] * total_ms[i]));
+  printf("\n");
+  double sym_ms = sym_distance_table_build();
+  printf("\nsymmetry reduced: %d permutation classes, %d bytes against %d, %.2f ms on 1 thread\n",
+         SYM_PERM_CLASS_COUNT, SYM_DISTANCE_TABLE_BYTES, DISTANCE_TABLE_BYTES, sym_ms);
+  return 0;
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+// Moves as byte shuffles of a facelet vector.
+//
+// On a fixed size cube a quarter turn is a fixed permutation of the
+// stickers, so with all stickers of a 2x2x2 (24 bytes) or 3x3x3 (54 bytes)
+// in one vector a move is out[i] = in[perm[i]]. The x86 kernels do that
+// with pshufb, which shuffles within 16 byte lanes: every output lane is
+// the OR of one shuffle per source lane, with 0x80 in the mask for bytes
+// that come from elsewhere. The 2x2x2 vector fits one AVX2 register and
+// the 3x3x3 one two. The best kernel the CPU runs is picked at startup;
+// the scalar one works everywhere.
+//
+// Stickers are in the order of Nxn_cube: face by face, rows from the top
+// left as seen from outside.
+
+#include <stdint.h>
+#include <string.h>
+#include "cpu_features.h"
+#include "nxn_cube.h"
+
+#define FACELET_MAX_BYTES 64
+
+struct Facelets {
+  alignas(32) uint8_t b[FACELET_MAX_BYTES];
+};
+
+struct Facelet_table {
+  int n;
+  int bytes;
+  // 32 or 64, a whole number of AVX2 registers. The tail stays zero.
+  int padded;
+  uint8_t perm[MOVE_COUNT][FACELET_MAX_BYTES];
+  // [move][output lane][source lane]
+  alignas(16) uint8_t sse_mask[MOVE_COUNT][4][4][16];
+  // [move][output register][source register * 2 + lanes swapped]
+  alignas(32) uint8_t avx_mask[MOVE_COUNT][2][4][32];
+};
+
+static Facelet_table facelet_table_2, facelet_table_3;
+
+static void facelet_table_build(Facelet_table *t, int n)
+{
+  memset(t, 0, sizeof(*t));
+  t->n = n;
+  t->bytes = NXN_FACES * n * n;
+  t->padded = t->bytes <= 32 ? 32 : 64;
+  int nn = n * n;
+  for (int m = 0; m < MOVE_COUNT; m++) {
+    // Label every sticker with its index and see where the move takes it.
+    Nxn_cube c;
+    nxn_cube_init(&c, n);
+    for (int i = 0; i < t->bytes; i++)
+      c.facelets[i] = (uint8_t)i;
+    nxn_apply_move(&c, m);
+    for (int i = 0; i < t->bytes; i++)
+      t->perm[m][i] = nxn_facelet(&c, i / nn, i % nn / n, i % n);
+    nxn_cube_free(&c);
+
+    memset(t->sse_mask[m], 0x80, sizeof(t->sse_mask[m]));
+    memset(t->avx_mask[m], 0x80, sizeof(t->avx_mask[m]));
+    for (int i = 0; i < t->bytes; i++) {
+      int s = t->perm[m][i];
+      t->sse_mask[m][i / 16][s / 16][i % 16] = (uint8_t)(s % 16);
+      int swapped = (i % 32) / 16 != (s % 32) / 16;
+      t->avx_mask[m][i / 32][s / 32 * 2 + swapped][i % 32] = (uint8_t)(s % 16);
+    }
+  }
+}
+
+static void facelets_solved(const Facelet_table *t, Facelets *f)
+{
+  memset(f->b, 0, sizeof(f->b));
+  int nn = t->n * t->n;
+  for (int i = 0; i < t->bytes; i++)
+    f->b[i] = (uint8_t)(i / nn);
+}
+
+typedef void (*Facelet_move_fn)(const Facelet_table *t, Facelets *f, int move);
+
+static void facelet_move_scalar(const Facelet_table *t, Facelets *f, int move)
+{
+  Facelets in = *f;
+  const uint8_t *perm = t->perm[move];
+  for (int i = 0; i < t->bytes; i++)
+    f->b[i] = in.b[perm[i]];
+}
+
+#ifdef CPU_X86
+// lanes is a constant at each call, so the loops unroll.
+CPU_TARGET("ssse3")
+static inline void ssse3_shuffle(const uint8_t (*mask)[4][16], Facelets *f, int lanes)
+{
+  __m128i in[4], out[4];
+  for (int j = 0; j < lanes; j++)
+    in[j] = _mm_load_si128((const __m128i *)f->b + j);
+  for (int i = 0; i < lanes; i++) {
+    __m128i acc = _mm_setzero_si128();
+    for (int j = 0; j < lanes; j++)
+      acc = _mm_or_si128(acc, _mm_shuffle_epi8(in[j], _mm_load_si128((const __m128i *)mask[i][j])));
+    out[i] = acc;
+  }
+  for (int i = 0; i < lanes; i++)
+    _mm_store_si128((__m128i *)f->b + i, out[i]);
+}
+
+CPU_TARGET("ssse3")
+static void facelet_move_ssse3(const Facelet_table *t, Facelets *f, int move)
+{
+  if (t->padded == 32)
+    ssse3_shuffle(t->sse_mask[move], f, 2);
+  else
+    ssse3_shuffle(t->sse_mask[move], f, 4);
+}
+
+// vpshufb shuffles each 128 bit lane on its own, so every source register
+// is also used with its lanes swapped.
+CPU_TARGET("avx2")
+static inline void avx2_shuffle(const uint8_t (*mask)[4][32], Facelets *f, int regs)
+{
+  __m256i src[4], out[2];
+  for (int j = 0; j < regs; j++) {
+    __m256i v = _mm256_load_si256((const __m256i *)f->b + j);
+    src[j * 2] = v;
+    src[j * 2 + 1] = _mm256_permute2x128_si256(v, v, 1);
+  }
+  for (int i = 0; i < regs; i++) {
+    __m256i acc = _mm256_setzero_si256();
+    for (int j = 0; j < regs * 2; j++)
+      acc = _mm256_or_si256(acc, _mm256_shuffle_epi8(src[j], _mm256_load_si256((const __m256i *)mask[i][j])));
+    out[i] = acc;
+  }
+  for (int i = 0; i < regs; i++)
+    _mm256_store_si256((__m256i *)f->b + i, out[i]);
+}
+
+// The 2x2x2 fits one register, but the lane swap adds three cycles to
+// every move, which two 128 bit halves do not pay.
+CPU_TARGET("avx2")
+static void facelet_move_avx2(const Facelet_table *t, Facelets *f, int move)
+{
+  if (t->padded == 32)
+    ssse3_shuffle(t->sse_mask[move], f, 2);
+  else
+    avx2_shuffle(t->avx_mask[move], f, 2);
+}
+#endif
+
+enum {
+  FACELET_KERNEL_SCALAR = 0,
+  FACELET_KERNEL_SSSE3,
+  FACELET_KERNEL_AVX2,
+  FACELET_KERNEL_COUNT
+};
+
+static const char *facelet_kernel_names[FACELET_KERNEL_COUNT] = { "scalar", "ssse3", "avx2" };
+
+// NULL where the build or the CPU lacks the instructions.
+static Facelet_move_fn facelet_kernels[FACELET_KERNEL_COUNT];
+static Facelet_move_fn facelet_move = facelet_move_scalar;
+static int facelet_kernel = FACELET_KERNEL_SCALAR;
+static bool facelet_initialized = false;
+
+// Builds the 2x2x2 and 3x3x3 tables and picks the fastest kernel.
+static void facelet_init()
+{
+  if (facelet_initialized)
+    return;
+  facelet_initialized = true;
+  facelet_table_build(&facelet_table_2, 2);
+  facelet_table_build(&facelet_table_3, 3);
+
+  facelet_kernels[FACELET_KERNEL_SCALAR] = facelet_move_scalar;
+#ifdef CPU_X86
+  if (cpu_has_ssse3())
+    facelet_kernels[FACELET_KERNEL_SSSE3] = facelet_move_ssse3;
+  if (cpu_has_avx2())
+    facelet_kernels[FACELET_KERNEL_AVX2] = facelet_move_avx2;
+#endif
+  for (int k = 0; k < FACELET_KERNEL_COUNT; k++) {
+    if (facelet_kernels[k]) {
+      facelet_move = facelet_kernels[k];
+      facelet_kernel = k;
+    }
+  }
+}
@@ -4,481 +4,307 @@
 #include "SDL2/include/SDL.h"
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
-#include <stack>
+#include "cube_math.h"
+#include "cube_state.h"
+#include "nxn_cube.h"
+#include "animation.h"
+#include "move_history.h"
+#include "replay.h"
+#include "renderer.h"
+#include "scramble.h"
+#include "soft_render.h"
+#include "batch.h"
+#include "bench.h"
+#include "two_phase.h"
+#include "solve_job.h"
+#include "triple_buffer.h"
+#include "command_queue.h"
+#include <thread>
 
 using namespace std;
 
-stack<int> s;
-
-struct Vector3
-{
-	float x, y, z;
-};
+// Moves made since the last solve, simplified as they are made. Only
+// the simulation thread touches these two once it runs.
+Move_history history;
+// Every move of this session, with its time.
+Replay_writer recorder;
+
+// Seconds a quarter turn takes on screen, when played by hand and when
+// playing a solution.
+#define MOVE_SECONDS 0.25f
+#define SOLVE_MOVE_SECONDS 0.15f
+// How long a solve may look for a shorter solution before it plays.
+#define SOLVE_BUDGET_MS 10.0
+// Milliseconds the simulation sleeps between steps.
+#define SIM_TICK_MS 1
+
+double seconds_now() {
+  return (double)SDL_GetPerformanceCounter() / (double)SDL_GetPerformanceFrequency();
+}
 
-struct Matrix {
-	float e[16];
-};
+// The cube state is the source of truth, the animator only catches up
+// with it. The move is recorded as made at time. Returns false if the
+// animation queue is full.
+bool do_move(Cube_state *state, Animator *animator, int move, float seconds, double time) {
+  if (!animator_push(animator, move, seconds))
+    return false;
+  *state = apply_move(*state, move);
+  replay_write_move(&recorder, move, time);
+  return true;
+}
 
-struct Camera {
-	Vector3 p;
+// What the window sends the simulation, as Move_command types.
+enum Sim_command_type {
+  // arg is the move.
+  SIM_MOVE,
+  SIM_SOLVE,
+  // arg is SDLK_PAGEUP, SDLK_PAGEDOWN or SDLK_HOME.
+  SIM_SEEK
 };
 
-struct Quat {
-  float x,y,z,w;
+// Move_command flags. Scripted moves, such as a scramble, play at solve
+// speed and lock the keys until they have played out. The first move of a
+// script decides whether the whole script is taken or ignored, and a
+// script is queued whole or not at all.
+#define COMMAND_SCRIPTED 1
+#define COMMAND_SCRIPT_START 2
+#define COMMAND_SCRIPT_END 4
+
+// What the window draws, as the simulation left it after a step.
+struct Sim_snapshot {
+  Quat orientation[CORNER_COUNT];
+  // Keys are locked while a solution, scramble or recording plays.
+  bool locked;
 };
 
-struct Cube_info {
-	Vector3 p;//centre_position
-	Vector3 c[3];//color
-  Quat orientation;
-  Quat target_orientation;
+// The simulation thread owns the cube state, the animator, the solve job
+// and the replay player, and publishes a snapshot after every step. The
+// window thread polls events, sends commands and draws the newest
+// snapshot, so a slow frame does not hold up input and a long step does
+// not hold up a frame.
+struct Simulation {
+  Cube_state state;
+  Animator animator;
+
+  bool solving;
+  bool script_accepted;
+  // A solve waits for the moves before it to start, taking the shortest
+  // solution the job has found by then.
+  Solve_job solve_job;
+  bool solve_pending;
+  int solve_serial;
+  int solution[SOLVE_JOB_MAX_MOVES];
+  int solution_len;
+
+  Replay_player player;
+  bool replaying;
+  double replay_speed;
+
+  // From the window thread, which is the only producer.
+  Command_queue commands;
+  std::atomic<bool> stop;
+
+  Triple_buffer snapshots;
+  Sim_snapshot snapshot[3];
 };
 
-#define MATH_PI 3.141592653589793238f
-float to_radians(float d)
+// Window thread: queues a command made now. False if it was dropped.
+static bool sim_send(Simulation *sim, int type, int arg, int flags = 0)
 {
-	return MATH_PI / 180.0f * d;
-}
-
-float lerp(float from, float to, float alpha) {
-	return from + (to - from) * alpha;
+  return command_queue_push(&sim->commands, Move_command{ type, arg, flags, seconds_now() });
 }
 
-int get_rand_move()
+static void sim_command(Simulation *sim, const Move_command &c, double now)
 {
-  return rand()%12;
-}
-
-Matrix translation(Vector3 t) {
-	Matrix m = {
-		1.0f, 0.0f, 0.0f, 0.0f,
-		0.0f, 1.0f, 0.0f, 0.0f,
-		0.0f, 0.0f, 1.0f, 0.0f,
-		t.x,t.y, t.z, 1.0f,
-	};
-	return m;
-}
-
-Matrix rotation_z(float angle) {
-	float c = cosf(angle);
-	float s = sinf(angle);
-	Matrix m = {
-		c,       s, 0.0f, 0.0f,
-		-s,       c, 0.0f, 0.0f,
-		0.0f,  0.0f, 1.0f, 0.0f,
-		0.0f,  0.0f, 0.0f, 1.0f,
-	};
-	return m;
-}
-
-Matrix rotation_x(float angle) {
-	float c = cosf(angle);
-	float s = sinf(angle);
-	Matrix m = {
-		1.0f,  0.0f, 0.0f, 0.0f,
-		0.0f,  c, -s, 0.0f,
-		0.0f,  s, c, 0.0f,
-		0.0f,  0.0f, 0.0f, 1.0f,
-	};
-	return m;
-}
-
-Matrix rotation_y(float angle) {
-	float c = cosf(angle);
-	float s = sinf(angle);
-	Matrix m = {
-		c,  0.0f, s, 0.0f,
-		0.0f,  1.0f, 0.0f, 0.0f,
-		-s,  0.0f, c, 0.0f,
-		0.0f,  0.0f, 0.0f, 1.0f,
-	};
-	return m;
-}
-
-Matrix scalar(Vector3 s) {
-	Matrix m = {
-		s.x, 0.0f, 0.0f, 0.0f,
-		0.0f, s.y, 0.0f, 0.0f,
-		0.0f, 0.0f, s.z, 0.0f,
-		0.0f, 0.0f, 0.0f, 1.0f,
-	};
-	return m;
-}
-
-Matrix perspective_projection(float fov, float aspect_ratio, float n, float f) {
-  float  cot = 1.0f / tanf(fov * 0.5f);
-  float  fpn = f + n;
-  float  fmn = f - n;
-  Matrix m = {cot / aspect_ratio,0.0f, 0.0f, 0.0f,
-              0.0f, cot, 0.0f, 0.0f,
-              0.0f, 0.0f,-fpn / fmn, -1.0f,
-              0.0f, 0.0f,-2.0f*f*n/fmn, 0.0f};
-  return m;
-}
-
-Quat quat_identity() {
-  return Quat{0, 0, 0, 1};
-}
-
-Quat normalize(Quat q) {
-  float len = q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w;
-  float swrtf(len);
-  if (len !=0) {
-    q.x /= len;
-    q.y /= len;
-    q.z /= len;
-    q.w /= len;
-    return q;
+  if (c.type == SIM_SEEK)
+  {
+    // Scrub through a recording: a twentieth of it back or ahead, or back
+    // to the start.
+    Replay_player &player = sim->player;
+    if (!sim->replaying || player.reader.move_total == 0)
+      return;
+    uint64_t total = player.reader.move_total;
+    uint64_t at = replay_player_move(&player), step = total / 20 + 1;
+    uint64_t to = 0;
+    if (c.arg == SDLK_PAGEUP)
+      to = at > step ? at - step : 0;
+    else if (c.arg == SDLK_PAGEDOWN)
+      to = at + step < total ? at + step : total - 1;
+    if (replay_player_seek(&player, to, &sim->state))
+      animator_init(&sim->animator, sim->state, now);
+    return;
+  }
+  if (c.flags & COMMAND_SCRIPT_START)
+  {
+    sim->script_accepted = !sim->solving && !sim->replaying;
+    if (sim->script_accepted)
+      sim->solving = true;
+  }
+  bool take = (c.flags & COMMAND_SCRIPTED) ? sim->script_accepted : !sim->solving && !sim->replaying;
+  if (c.flags & COMMAND_SCRIPT_END)
+    sim->script_accepted = false;
+  if (!take)
+    return;
+
+  switch (c.type)
+  {
+  case SIM_MOVE:
+    if (do_move(&sim->state, &sim->animator, c.arg, (c.flags & COMMAND_SCRIPTED) ? SOLVE_MOVE_SECONDS : MOVE_SECONDS,
+                c.time))
+      move_history_push(&history, c.arg);
+    break;
+
+  case SIM_SOLVE:
+  {
+    // Undoing the history solves the cube at once, if it fits the
+    // animation queue; the job looks for a shorter solution meanwhile.
+    int undo[ANIMATION_QUEUE_SIZE];
+    int n = move_history_undo(&history, undo, ANIMATION_QUEUE_SIZE);
+    solve_job_start(&sim->solve_job, sim->state, n >= 0 ? undo : NULL, n, SOLVE_BUDGET_MS);
+    sim->solve_serial = 0;
+    sim->solution_len = -1;
+    sim->solve_pending = true;
+    sim->solving = true;
+    break;
+  }
   }
-  return Quat{0,0,0,1};
-}
-
-Quat lerp(Quat from, Quat to, float alpha) {
-  Quat res;
-  res.x = from.x + (to.x - from.x) * alpha;
-  res.y = from.y + (to.y - from.y) * alpha;
-  res.z = from.z + (to.z - from.z) * alpha;
-  res.w = from.w + (to.w - from.w) * alpha;
-  return normalize(res);
-}
-
-Quat quat_mul(Quat q1, Quat q2) {
-  float a = q1.w;
-  float b = q1.x;
-  float c = q1.y;
-  float d = q1.z;
-
-  float e = q2.w;
-  float f = q2.x;
-  float g = q2.y;
-  float h = q2.z;
-
-  Quat res;
-  res.w = a * e - b * f - c * g - d * h;
-  res.x = a * f + b * e + c * h - d * g;
-  res.y = a * g - b * h + c * e + d * f;
-  res.z = a * h + b * g - c * f + d * e;
-  return res;
-}
-
-Quat quat_angle_axis(Vector3 axis, float angle) {
-  float r = cosf(angle * 0.5f);
-  float s = sinf(angle * 0.5f);
-  float i = s * axis.x;
-  float j = s * axis.y;
-  float k = s * axis.z;
-  return Quat{i, j, k, r};
-}
-
-Matrix quat_get_matrix(Quat q) {
-  float i = q.x;
-  float j = q.y;
-  float k = q.z;
-  float r = q.w;
-
-  float ii = i * i;
-  float jj = j * j;
-  float kk = k * k;
-
-  float ij = i * j;
-  float jk = j * k;
-  float kr = k * r;
-  float jr = j * r;
-  float ir = i * r;
-  float ik = i * k;
-
-  Matrix m;
-
-  m.e[0] = 1 - 2 * (jj + kk);
-  m.e[4] = 2 * (ij - kr);
-  m.e[8] = 2 * (ik + jr);
-  m.e[12] = 0;
-
-  m.e[1] = 2 * (ij + kr);
-  m.e[5] = 1 - 2 * (ii + kk);
-  m.e[9] = 2 * (jk - ir);
-  m.e[13] = 0;
-
-  m.e[2] = 2 * (ik - jr);
-  m.e[6] = 2 * (jk + ir);
-  m.e[10] = 1 - 2 * (ii + jj);
-  m.e[14] = 0;
-
-  m.e[3] = 0;
-  m.e[7] = 0;
-  m.e[11] = 0;
-  m.e[15] = 1;
-
-  return m;
 }
 
-void draw_cube(Vector3 a, Vector3 b, Vector3 c)
+static void sim_step(Simulation *sim, double now)
 {
-	//front face
-	glNormal3f(0.0f,0.0f,1.0f);
-	glColor3f(a.x, a.y, a.z);
-	glVertex3f(-0.5f, -0.5f, 0.5f);
-	glVertex3f(-0.5f, 0.5f, 0.5f);
-	glVertex3f(0.5f, 0.5f, 0.5f);
-
-	glNormal3f(0.0f,0.0f,1.0f);
-	glVertex3f(-0.5f, -0.5f, 0.5f);
-	glVertex3f(0.5f, 0.5f, 0.5f);
-	glVertex3f(0.5f, -0.5f, 0.5f);
-
-	//right face
-	glNormal3f(1.0f,0.0f,0.0f);
-	glColor3f(b.x, b.y, b.z);
-	glVertex3f(0.5f, -0.5f, 0.5f);
-	glVertex3f(0.5f, 0.5f, 0.5f);
-	glVertex3f(0.5f, 0.5f, -0.5f);
-
-	glNormal3f(1.0f,0.0f,0.0f);
-	glVertex3f(0.5f, -0.5f, 0.5f);
-	glVertex3f(0.5f, 0.5f, -0.5f);
-	glVertex3f(0.5f, -0.5f, -0.5f);
-
-	//back face
-	glNormal3f(0.0f,0.0f,-1.0f);
-	glColor3f(a.x, a.y, a.z);
-	glVertex3f(0.5f, -0.5f, -0.5f);
-	glVertex3f(0.5f, 0.5f, -0.5f);
-	glVertex3f(-0.5f, 0.5f, -0.5f);
-
-	glNormal3f(0.0f,0.0f,-1.0f);
-	glVertex3f(0.5f, -0.5f, -0.5f);
-	glVertex3f(-0.5f, 0.5f, -0.5f);
-	glVertex3f(-0.5f, -0.5f, -0.5f);
-
-	//leftface
-	glNormal3f(-1.0f,0.0f,0.0f);
-	glColor3f(b.x, b.y, b.z);
-	glVertex3f(-0.5f, -0.5f, -0.5f);
-	glVertex3f(-0.5f, 0.5f, -0.5f);
-	glVertex3f(-0.5f, 0.5f, 0.5f);
-
-	glNormal3f(-1.0f,0.0f,0.0f);
-	glVertex3f(-0.5f, -0.5f, -0.5f);
-	glVertex3f(-0.5f, 0.5f, 0.5f);
-	glVertex3f(-0.5f, -0.5f, 0.5f);
-
-	//top face
-	glNormal3f(0.0f,1.0f,0.0f);
-	glColor3f(c.x, c.y, c.z);
-	glVertex3f(-0.5f, 0.5f, 0.5f);
-	glVertex3f(-0.5f, 0.5f, -0.5f);
-	glVertex3f(0.5f, 0.5f, -0.5f);
-
-	glNormal3f(0.0f,1.0f,0.0f);
-	glVertex3f(-0.5f, 0.5f, 0.5f);
-	glVertex3f(0.5f, 0.5f, -0.5f);
-	glVertex3f(0.5f, 0.5f, 0.5f);
-
-	//buttom face
-	glNormal3f(0.0f,-1.0f,0.0f);
-	glColor3f(c.x, c.y, c.z);
-	glVertex3f(-0.5f, -0.5f, -0.5f);
-	glVertex3f(-0.5f, -0.5f, 0.5f);
-	glVertex3f(0.5f, -0.5f, 0.5f);
-
-	glNormal3f(0.0f,-1.0f,0.0f);
-	glVertex3f(-0.5f, -0.5f, -0.5f);
-	glVertex3f(0.5f, -0.5f, 0.5f);
-	glVertex3f(0.5f, -0.5f, -0.5f);
-}
-
-void rotate_fr(Cube_info **positions) {
-	Cube_info *temp = positions[0];
-	positions[0] = positions[2];
-	positions[2] = positions[3];
-	positions[3] = positions[1];
-	positions[1] = temp;
-
-	float rot = to_radians(90);
-	Quat q = quat_angle_axis({0,0,-1},rot);
-	positions[0]->target_orientation = quat_mul(q,positions[0]->target_orientation);
-	positions[1]->target_orientation = quat_mul(q,positions[1]->target_orientation);
-	positions[2]->target_orientation = quat_mul(q,positions[2]->target_orientation);
-	positions[3]->target_orientation = quat_mul(q,positions[3]->target_orientation);
-}
-
-void rotate_fl(Cube_info **positions) {
-	Cube_info *temp = positions[0];
-	positions[0] = positions[1];
-	positions[1] = positions[3];
-	positions[3] = positions[2];
-	positions[2] = temp;
-
-	float rot = to_radians(90);
-	Quat q = quat_angle_axis({0,0,1},rot);
-	positions[0]->target_orientation = quat_mul(q,positions[0]->target_orientation);
-	positions[1]->target_orientation = quat_mul(q,positions[1]->target_orientation);
-	positions[2]->target_orientation = quat_mul(q,positions[2]->target_orientation);
-	positions[3]->target_orientation = quat_mul(q,positions[3]->target_orientation);
-}
-
-void rotate_br(Cube_info **positions) {
-  Cube_info *temp = positions[7];
-  positions[7] = positions[6];
-  positions[6] = positions[4];
-  positions[4] = positions[5];
-  positions[5] = temp;
-
-  float rot = to_radians(90);
-  Quat q = quat_angle_axis({0,0,1},rot);
-  positions[4]->target_orientation = quat_mul(q,positions[4]->target_orientation);
-  positions[5]->target_orientation = quat_mul(q,positions[5]->target_orientation);
-  positions[6]->target_orientation = quat_mul(q,positions[6]->target_orientation);
-  positions[7]->target_orientation = quat_mul(q,positions[7]->target_orientation);
-}
-
-void rotate_bl(Cube_info **positions) {
-  Cube_info *temp = positions[7];
-  positions[7] = positions[5];
-  positions[5] = positions[4];
-  positions[4] = positions[6];
-  positions[6] = temp;
-
-  float rot = to_radians(90);
-  Quat q = quat_angle_axis({0,0,-1},rot);
-  positions[4]->target_orientation = quat_mul(q,positions[4]->target_orientation);
-  positions[5]->target_orientation = quat_mul(q,positions[5]->target_orientation);
-  positions[6]->target_orientation = quat_mul(q,positions[6]->target_orientation);
-  positions[7]->target_orientation = quat_mul(q,positions[7]->target_orientation);
-}
-
-void rotate_rr(Cube_info **positions) {
-	Cube_info *temp = positions[4];
-	positions[4] = positions[6];
-	positions[6] = positions[2];
-	positions[2] = positions[0];
-	positions[0] = temp;
-
-	float rot = to_radians(90);
-	Quat q = quat_angle_axis({-1,0,0},rot);
-	positions[0]->target_orientation = quat_mul(q,positions[0]->target_orientation);
-	positions[4]->target_orientation = quat_mul(q,positions[4]->target_orientation);
-	positions[6]->target_orientation = quat_mul(q,positions[6]->target_orientation);
-	positions[2]->target_orientation = quat_mul(q,positions[2]->target_orientation);
-}
-
-void rotate_rl(Cube_info **positions) {
-  Cube_info *temp = positions[4];
-  positions[4] = positions[0];
-  positions[0] = positions[2];
-  positions[2] = positions[6];
-  positions[6] = temp;
-
-  float rot = to_radians(90);
-  Quat q = quat_angle_axis({1,0,0},rot);
-  positions[0]->target_orientation = quat_mul(q,positions[0]->target_orientation);
-  positions[4]->target_orientation = quat_mul(q,positions[4]->target_orientation);
-  positions[6]->target_orientation = quat_mul(q,positions[6]->target_orientation);
-  positions[2]->target_orientation = quat_mul(q,positions[2]->target_orientation);
-}
-void rotate_lr(Cube_info **positions) {
-  Cube_info *temp = positions[1];
-  positions[1] = positions[3];
-  positions[3] = positions[7];
-  positions[7] = positions[5];
-  positions[5] = temp;
-
-  float rot = to_radians(90);
-  Quat q = quat_angle_axis({1,0,0},rot);
-  positions[1]->target_orientation = quat_mul(q,positions[1]->target_orientation);
-  positions[3]->target_orientation = quat_mul(q,positions[3]->target_orientation);
-  positions[5]->target_orientation = quat_mul(q,positions[5]->target_orientation);
-  positions[7]->target_orientation = quat_mul(q,positions[7]->target_orientation);
-}
-
-void rotate_ll(Cube_info **positions) {
-  Cube_info *temp = positions[1];
-  positions[1] = positions[5];
-  positions[5] = positions[7];
-  positions[7] = positions[3];
-  positions[3] = temp;
-
-  float rot = to_radians(90);
-  Quat q = quat_angle_axis({-1,0,0},rot);
-  positions[1]->target_orientation = quat_mul(q,positions[1]->target_orientation);
-  positions[3]->target_orientation = quat_mul(q,positions[3]->target_orientation);
-  positions[5]->target_orientation = quat_mul(q,positions[5]->target_orientation);
-  positions[7]->target_orientation = quat_mul(q,positions[7]->target_orientation);
-}
+  if (sim->solving)
+  {
+    if (sim->solve_pending)
+    {
+      int n = solve_job_poll(&sim->solve_job, &sim->solve_serial, sim->solution);
+      if (n >= 0)
+        sim->solution_len = n;
+      // Plays the best solution once the moves queued before it have all
+      // started and the job has nothing better coming; the wait is at
+      // most SOLVE_BUDGET_MS and never holds up a frame.
+      if (sim->animator.queue_count == 0 && solve_job_settled(&sim->solve_job))
+      {
+        solve_job_finish(&sim->solve_job);
+        if ((n = solve_job_poll(&sim->solve_job, &sim->solve_serial, sim->solution)) >= 0)
+          sim->solution_len = n;
+        for (int i = 0; i < sim->solution_len; i++)
+          do_move(&sim->state, &sim->animator, sim->solution[i], SOLVE_MOVE_SECONDS, now);
+        if (sim->solution_len >= 0)
+          move_history_clear(&history);
+        sim->solve_pending = false;
+      }
+    }
+    // Keys stay locked until the solution or scramble has played out.
+    else if (animator_idle(&sim->animator))
+      sim->solving = false;
+  }
+  else if (sim->replaying)
+  {
+    // Moves that are due, as many as the animation queue takes; faster
+    // playback also plays each move faster.
+    int due[ANIMATION_QUEUE_SIZE];
+    int n = replay_player_poll(&sim->player, now, due, ANIMATION_QUEUE_SIZE - sim->animator.queue_count);
+    for (int i = 0; i < n; i++)
+      do_move(&sim->state, &sim->animator, due[i], MOVE_SECONDS / (float)fmax(sim->replay_speed, 1.0), now);
+    if (sim->player.done && animator_idle(&sim->animator))
+    {
+      replay_player_close(&sim->player);
+      sim->replaying = false;
+    }
+  }
 
-void rotate_ur(Cube_info **positions) {
-  Cube_info *temp = positions[2];
-  positions[2] = positions[6];
-  positions[6] = positions[7];
-  positions[7] = positions[3];
-  positions[3] = temp;
-
-  float rot = to_radians(90);
-  Quat q = quat_angle_axis({0,-1,0},rot);
-  positions[2]->target_orientation = quat_mul(q,positions[2]->target_orientation);
-  positions[3]->target_orientation = quat_mul(q,positions[3]->target_orientation);
-  positions[6]->target_orientation = quat_mul(q,positions[6]->target_orientation);
-  positions[7]->target_orientation = quat_mul(q,positions[7]->target_orientation);
+  animator_update(&sim->animator, now);
+  replay_writer_tick(&recorder, now);
 }
 
-void rotate_ul(Cube_info **positions) {
-  Cube_info *temp = positions[2];
-  positions[2] = positions[3];
-  positions[3] = positions[7];
-  positions[7] = positions[6];
-  positions[6] = temp;
-
-  float rot = to_radians(90);
-  Quat q = quat_angle_axis({0,1,0},rot);
-  positions[2]->target_orientation = quat_mul(q,positions[2]->target_orientation);
-  positions[3]->target_orientation = quat_mul(q,positions[3]->target_orientation);
-  positions[6]->target_orientation = quat_mul(q,positions[6]->target_orientation);
-  positions[7]->target_orientation = quat_mul(q,positions[7]->target_orientation);
+static void sim_publish(Simulation *sim)
+{
+  Sim_snapshot &s = sim->snapshot[sim->snapshots.back];
+  memcpy(s.orientation, sim->animator.orientation, sizeof(s.orientation));
+  s.locked = sim->solving || sim->replaying;
+  triple_buffer_publish(&sim->snapshots);
 }
 
-void rotate_dr(Cube_info **positions) {
-  Cube_info *temp = positions[0];
-  positions[0] = positions[1];
-  positions[1] = positions[5];
-  positions[5] = positions[4];
-  positions[4] = temp;
-
-  float rot = to_radians(90);
-  Quat q = quat_angle_axis({0,1,0},rot);
-  positions[0]->target_orientation = quat_mul(q,positions[0]->target_orientation);
-  positions[1]->target_orientation = quat_mul(q,positions[1]->target_orientation);
-  positions[4]->target_orientation = quat_mul(q,positions[4]->target_orientation);
-  positions[5]->target_orientation = quat_mul(q,positions[5]->target_orientation);
+// Fills every slot, so the window has a snapshot to draw from the start.
+static void sim_init(Simulation *sim)
+{
+  sim->solving = false;
+  sim->script_accepted = false;
+  sim->solve_pending = false;
+  sim->solution_len = -1;
+  sim->stop = false;
+  command_queue_init(&sim->commands);
+  triple_buffer_init(&sim->snapshots);
+  for (int i = 0; i < 3; i++)
+    sim_publish(sim);
 }
 
-void rotate_dl(Cube_info **positions) {
-  Cube_info *temp = positions[0];
-  positions[0] = positions[4];
-  positions[4] = positions[5];
-  positions[5] = positions[1];
-  positions[1] = temp;
-
-  float rot = to_radians(90);
-  Quat q = quat_angle_axis({0,-1,0},rot);
-  positions[0]->target_orientation = quat_mul(q,positions[0]->target_orientation);
-  positions[1]->target_orientation = quat_mul(q,positions[1]->target_orientation);
-  positions[4]->target_orientation = quat_mul(q,positions[4]->target_orientation);
-  positions[5]->target_orientation = quat_mul(q,positions[5]->target_orientation);
+static void sim_run(Simulation *sim)
+{
+  while (!sim->stop)
+  {
+    // Moves wait in the command queue while the animation queue is full,
+    // so the cube takes them at its own pace.
+    double now = seconds_now();
+    const Move_command *c;
+    while ((c = command_queue_front(&sim->commands)) &&
+           !(c->type == SIM_MOVE && sim->animator.queue_count == ANIMATION_QUEUE_SIZE))
+    {
+      sim_command(sim, *c, now);
+      command_queue_pop(&sim->commands);
+    }
+    sim_step(sim, now);
+    sim_publish(sim);
+    SDL_Delay(SIM_TICK_MS);
+  }
 }
 
-
-
 int main(int argc, char *argv[])
 {
 	SDL_Window *window;
-	SDL_Renderer *renderer;
 
 	int w = 600, h = 600;
 	
-	srand(time(0));
+	Rng rng;
+	rng_seed(&rng, (uint64_t)time(0));
+	static Simulation sim;
+
+	if (argc > 1 && strcmp(argv[1], "--distance-table") == 0)
+		return distance_table_main(argc, argv);
+	if (argc > 1 && strcmp(argv[1], "--write-tables") == 0)
+		return table_file_main(argc, argv);
+	if (argc > 1 && strcmp(argv[1], "--batch") == 0)
+		return batch_main(argc, argv);
+	if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+		return bench_main(argc, argv);
+	if (argc > 1 && strcmp(argv[1], "--replay-scan") == 0)
+		return replay_scan_main(argc, argv);
+	if (argc > 1 && strcmp(argv[1], "--scramble") == 0)
+		return scramble_main(argc, argv);
+	if (argc > 1 && strcmp(argv[1], "--render") == 0)
+		return render_main(argc, argv);
+	if (argc > 1 && strcmp(argv[1], "--solve3") == 0)
+		return two_phase_main(argc, argv);
+
+	// --replay file [speed] plays a recording instead of recording one.
+	const char *replay_path = NULL;
+	sim.replay_speed = 1;
+	if (argc > 2 && strcmp(argv[1], "--replay") == 0)
+	{
+		replay_path = argv[2];
+		if (argc > 3)
+			sim.replay_speed = atof(argv[3]);
+		if (sim.replay_speed <= 0)
+			sim.replay_speed = 1;
+	}
+
+	tables_init(TABLE_FILE_NAME);
 
 	SDL_Init(SDL_INIT_EVERYTHING);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
 	window = SDL_CreateWindow("An SDL2 window", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, w, h, SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
 
 	if (window == NULL)
@@ -490,121 +316,53 @@ int main(int argc, char *argv[])
 	Uint32 windowID = SDL_GetWindowID(window);
 	SDL_GLContext glcontext = SDL_GL_CreateContext(window);
 
+	Renderer renderer;
+	if (!renderer_init(&renderer))
+	{
+		SDL_GL_DeleteContext(glcontext);
+		SDL_Quit();
+		return 1;
+	}
+
 	//VISUAL SURFACE DETECTION / DEPTH BUFFER
 	glEnable(GL_DEPTH_TEST);
 
-	//ILLUMINATION AND SURFACE RENDERING
-	//GOURAUD SHADING
-	glShadeModel(GL_SMOOTH);
-
-	//LIGHTING
-	glEnable(GL_LIGHTING);
-	glEnable(GL_LIGHT0);
-	glEnable(GL_COLOR_MATERIAL);
-	float pos[] = {-2.0f,2.0f,0.7f,1};
-	glLightfv(GL_LIGHT0,GL_POSITION, pos);
-	float dif[] = {1.0f,1.0f,1.0f};
-	glLightfv(GL_LIGHT0,GL_DIFFUSE,dif);
-	float amb[] = {0.1f,0.0f,0.1f};
-	glLightfv(GL_LIGHT0,GL_AMBIENT,amb);
-
-	bool solving = false;
-
-	Camera camera;
-	camera.p = { 0,0,10 };
-
-	const Vector3 RED = { 0.8,0.1,0.1 };
-	const Vector3 BLUE = { 0.1,0.1,0.8 };
-	const Vector3 YELLOW = { 0.8,0.8,0.1 };
-	const Vector3 GREEN = { 0.1,0.8,0.1 };
-	const Vector3 WHITE = { 0.8,0.8,0.8 };
-	const Vector3 PURPLE = { 0.1,0.9,0.9 };
-	
-	Cube_info cubes[8];
-	cubes[0].p = { 0.5, -0.5,0.5 };
-	cubes[0].c[0] = RED;
-	cubes[0].c[1] = GREEN;
-	cubes[0].c[2] = BLUE;
-	cubes[0].orientation = quat_identity();
-	cubes[0].target_orientation = quat_identity();
-
-	cubes[1].p = { -0.5,-0.5,0.5 };
-	cubes[1].c[0] = RED;
-	cubes[1].c[1] = PURPLE;
-	cubes[1].c[2] = BLUE;
-	cubes[1].orientation = quat_identity();
-	cubes[1].target_orientation = quat_identity();
-
-	cubes[2].p = { 0.5,0.5,0.5 };
-	cubes[2].c[0] = RED;
-	cubes[2].c[1] = GREEN;
-	cubes[2].c[2] = YELLOW;
-	cubes[2].orientation = quat_identity();
-	cubes[2].target_orientation = quat_identity();
-
-	cubes[3].p = { -0.5,0.5,0.5 };
-	cubes[3].c[0] = RED;
-	cubes[3].c[1] = PURPLE;
-	cubes[3].c[2] = YELLOW;
-	cubes[3].orientation = quat_identity();
-	cubes[3].target_orientation = quat_identity();
-
-	cubes[4].p = { 0.5, -0.5,-0.5 };
-	cubes[4].c[0] = WHITE;
-	cubes[4].c[1] = GREEN;
-	cubes[4].c[2] = BLUE;
-	cubes[4].orientation = quat_identity();
-	cubes[4].target_orientation = quat_identity();
-
-	cubes[5].p = { -0.5,-0.5,-0.5 };
-	cubes[5].c[0] = WHITE;
-	cubes[5].c[1] = PURPLE;
-	cubes[5].c[2] = BLUE;
-	cubes[5].orientation = quat_identity();
-	cubes[5].target_orientation = quat_identity();
-
-	cubes[6].p = { 0.5,0.5,-0.5 };
-	cubes[6].c[0] = WHITE;
-	cubes[6].c[1] = GREEN;
-	cubes[6].c[2] = YELLOW;
-	cubes[6].orientation = quat_identity();
-	cubes[6].target_orientation = quat_identity();
-
-	cubes[7].p = { -0.5,0.5,-0.5 };
-	cubes[7].c[0] = WHITE;
-	cubes[7].c[1] = PURPLE;
-	cubes[7].c[2] = YELLOW;
-	cubes[7].orientation = quat_identity();
-	cubes[7].target_orientation = quat_identity();
-
-	Cube_info *positions[8];
-	positions[0] = cubes+0;
-	positions[1] = cubes+1;
-	positions[2] = cubes+2;
-	positions[3] = cubes+3;
-	positions[4] = cubes+4;
-	positions[5] = cubes+5;
-	positions[6] = cubes+6;
-	positions[7] = cubes+7;
-
-	int choice;
-	
-	bool making_a_move = false;
+	// Up and down move the camera along its axis.
+	float camera_distance = CAMERA_DISTANCE;
+
+	sim.state = cube_state_solved();
+	animator_init(&sim.animator, sim.state, seconds_now());
+
+	sim.replaying = false;
+	if (replay_path)
+	{
+		sim.replaying = replay_player_open(&sim.player, replay_path, sim.replay_speed, seconds_now());
+		if (!sim.replaying)
+			printf("%s is not a recording\n", replay_path);
+	}
+	else
+	{
+		char record_path[64];
+		replay_session_path(record_path, sizeof(record_path));
+		if (!replay_writer_open(&recorder, record_path, seconds_now()))
+			printf("Could not record to %s\n", record_path);
+	}
+
+	sim_init(&sim);
+	std::thread sim_thread(sim_run, &sim);
 
 	float angle_x,angle_y,angle_z;
 	angle_z = angle_y = angle_x = 0.0f;
 
-	int rotate_choice = 0;
-
-	Matrix rotate_x,rotate_y,rotate_z;
-	rotate_x = rotate_y = rotate_z = rotation_y(to_radians(0.0f));
+	Scene_view view;
+	scene_view_init(&view);
 	
 	bool running = true;
 	while (running)
 	{
 		float forward_key = 0, right_key=0;
 		
-		choice = 12;
+		const Sim_snapshot &shown = sim.snapshot[triple_buffer_read(&sim.snapshots)];
 
 		SDL_Event event;
 		while (SDL_PollEvent(&event))
@@ -637,27 +395,24 @@ int main(int argc, char *argv[])
 
 				case SDL_KEYUP:
 				{
-					if (!solving) 
+					// Escape quits even while a solution or a recording plays.
+					if (event.key.keysym.sym == SDLK_ESCAPE)
+						running = 0;
+					else if (!shown.locked) 
 					{
 						bool ctrl = (KMOD_CTRL & SDL_GetModState());
 						switch(event.key.keysym.sym) 
 						{
-						case SDLK_ESCAPE:
-							running = 0;
-							break;
-						
 						case SDLK_5:
 						case SDLK_KP_5:
 						{
 							if(ctrl==0)
 							{
-								rotate_fr((Cube_info **)&positions);
-								s.push(0);
+								sim_send(&sim, SIM_MOVE, MOVE_FR);
 							}
 							else
 							{
-								rotate_fl((Cube_info **)&positions);
-								s.push(1);
+								sim_send(&sim, SIM_MOVE, MOVE_FL);
 							}
 							break;
 						}
@@ -667,13 +422,11 @@ int main(int argc, char *argv[])
 						{
 							if(ctrl==0)
 							{
-								rotate_br((Cube_info **)&positions);
-								s.push(6);
+								sim_send(&sim, SIM_MOVE, MOVE_BR);
 							}
 							else
 							{
-								rotate_bl((Cube_info **)&positions);
-								s.push(7);
+								sim_send(&sim, SIM_MOVE, MOVE_BL);
 							}
 							break;
 						}
@@ -683,13 +436,11 @@ int main(int argc, char *argv[])
 						{
 							if(ctrl==0)
 							{
-								rotate_rr((Cube_info **)&positions);
-								s.push(4);
+								sim_send(&sim, SIM_MOVE, MOVE_RR);
 							}
 							else
 							{
-								rotate_rl((Cube_info **)&positions);
-								s.push(5);
+								sim_send(&sim, SIM_MOVE, MOVE_RL);
 							}
 							break;
 						}
@@ -699,13 +450,11 @@ int main(int argc, char *argv[])
 						{
 							if(ctrl==0)
 							{
-								rotate_lr((Cube_info **)&positions);
-								s.push(2);
+								sim_send(&sim, SIM_MOVE, MOVE_LR);
 							}
 							else
 							{
-								rotate_ll((Cube_info **)&positions);
-								s.push(3);
+								sim_send(&sim, SIM_MOVE, MOVE_LL);
 							}
 							break;
 						}
@@ -715,13 +464,11 @@ int main(int argc, char *argv[])
 						{
 							if(ctrl==0)
 							{
-								rotate_ur((Cube_info **)&positions);
-								s.push(8);
+								sim_send(&sim, SIM_MOVE, MOVE_UR);
 							}
 							else
 							{
-								rotate_ul((Cube_info **)&positions);
-								s.push(9);
+								sim_send(&sim, SIM_MOVE, MOVE_UL);
 							}
 							break;
 						}
@@ -731,20 +478,18 @@ int main(int argc, char *argv[])
 						{
 							if(ctrl==0)
 							{
-								rotate_dr((Cube_info **)&positions);
-								s.push(10);
+								sim_send(&sim, SIM_MOVE, MOVE_DR);
 							}
 							else
 							{
-								rotate_dl((Cube_info **)&positions);
-								s.push(11);
+								sim_send(&sim, SIM_MOVE, MOVE_DL);
 							}
 							break;
 						}
 
 						case SDLK_r:
 						{
-							solving = true;
+							sim_send(&sim, SIM_SOLVE, 0);
 							break;
 						}		
 					}			
@@ -765,217 +510,85 @@ int main(int argc, char *argv[])
 						case SDLK_LEFT:
 							right_key = -1;
 							angle_y -= 10.0f;
-							rotate_choice = 3;
 							break;
 						case SDLK_RIGHT:
 							right_key = 1;
 							angle_y += 10.0f;
-							rotate_choice = 3;
 							break;
 						case SDLK_w:
 							angle_x += 10.0f;
-							rotate_choice = 1;
 							break;
 						case SDLK_s:
 							angle_x -= 10.0f;
-							rotate_choice = 1;
 							break;
 						case SDLK_d:
 							angle_z += 10.0f;
-							rotate_choice = 2;
 							break;
 						case SDLK_a:
 							angle_z -= 10.0f;
-							rotate_choice = 2;
 							break;
 							
 						case SDLK_SPACE:
-							if (!making_a_move)
-								choice = get_rand_move();
-							s.push(choice);
+							if (!shown.locked)
+							{
+								// A shortest sequence to a uniformly random state,
+								// rather than one random move per press.
+								int moves[SOLVER_MAX_DEPTH];
+								int n = random_scramble(&rng, moves, NULL);
+								Move_command script[SOLVER_MAX_DEPTH];
+								double now = seconds_now();
+								for (int i = 0; i < n; i++)
+									script[i] = Move_command{ SIM_MOVE, moves[i], COMMAND_SCRIPTED | (i == 0 ? COMMAND_SCRIPT_START : 0) |
+									                          (i == n - 1 ? COMMAND_SCRIPT_END : 0), now };
+								if (n > 0)
+									command_queue_push_all(&sim.commands, script, n);
+							}
+							break;
+
+						// Scrub through a recording.
+						case SDLK_PAGEUP:
+						case SDLK_PAGEDOWN:
+						case SDLK_HOME:
+							sim_send(&sim, SIM_SEEK, event.key.keysym.sym);
 							break;
 					}
 				}
 			}
 		}
 
-    if (solving) 
-    {
-      int i=0;
-      int moves_doing = 0;
-
-      if (!s.empty()) 
-      {
-        if(!making_a_move)
-        {
-          switch(s.top())
-          {
-            case 1: rotate_fr(positions); break;
-            case 0: rotate_fl(positions); break;
-            case 3: rotate_lr(positions); break;
-            case 2: rotate_ll(positions); break;
-            case 5: rotate_rr(positions); break;
-            case 4: rotate_rl(positions); break;
-            case 7: rotate_br(positions); break;
-            case 6: rotate_bl(positions); break;
-            case 9: rotate_ur(positions); break;
-            case 8: rotate_ul(positions); break;
-            case 11: rotate_dr(positions); break;
-            case 10: rotate_dl(positions); break;
-          }
-          s.pop();
-        }
-
-          for (auto &c : cubes) {
-          c.orientation = lerp(c.orientation, c.target_orientation, 0.005);
-          if (fabsf(c.orientation.x - c.target_orientation.x) < 0.000001f &&
-            fabsf(c.orientation.y - c.target_orientation.y) < 0.000001f &&
-            fabsf(c.orientation.z - c.target_orientation.z) < 0.000001f &&
-            fabsf(c.orientation.w - c.target_orientation.w) < 0.000001f) {
-              
-            } else {
-              moves_doing |= (1 << i);
-            }
-          i += 1;
-        }
-        
-        #if 1
-        if (moves_doing == 0)
-          making_a_move = false;
-        else
-          making_a_move = true;
-        #endif
-    
-      } 
-      else 
-      {
-        solving = false;
-      }
-    } 
-    else 
-    {
-      switch(choice)
-      {
-        case 0: rotate_fr((Cube_info **)&positions); break;
-        case 1: rotate_fl((Cube_info **)&positions); break;
-        case 2: rotate_lr((Cube_info **)&positions); break;
-        case 3: rotate_ll((Cube_info **)&positions); break;
-        case 4: rotate_rr((Cube_info **)&positions); break;
-        case 5: rotate_rl((Cube_info **)&positions); break;
-        case 6: rotate_br((Cube_info **)&positions); break;
-        case 7: rotate_bl((Cube_info **)&positions); break;
-        case 8: rotate_ur((Cube_info **)&positions); break;
-        case 9: rotate_ul((Cube_info **)&positions); break;
-        case 10: rotate_dr((Cube_info **)&positions); break;
-        case 11: rotate_dl((Cube_info **)&positions); break;
-      }
-    }
-		
 		float aspect_ratio = (float)w / (float)h;
 
-		camera.p.z += forward_key*0.1;
-
-		int i = 0;
-		int moves_doing = 0;
-		for (auto &c : cubes) {
-			c.orientation = lerp(c.orientation, c.target_orientation, 0.01);
-			if (fabsf(c.orientation.x - c.target_orientation.x) < 0.1f &&
-				fabsf(c.orientation.y - c.target_orientation.y) < 0.1f &&
-				fabsf(c.orientation.z - c.target_orientation.z) < 0.1f &&
-				fabsf(c.orientation.w - c.target_orientation.w) < 0.1f) {
-					
-				} else {
-					moves_doing |= (1 << i);
-				}
-			i += 1;
-		}
-		
-		#if 1
-		if (moves_doing == 0)
-			making_a_move = false;
-		else
-			making_a_move = true;
-		#endif
-
-		glClearColor(0.2f, 0.2f, 0.2f, 1);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-		Matrix view = translation(Vector3 { -camera.p.x,-camera.p.y, -camera.p.z });
-		Matrix scale = scalar(Vector3{ 0.95f, 0.95f, 0.95f });
-		Matrix proj = perspective_projection(to_radians(30),aspect_ratio,0.1,100);
+		camera_distance += forward_key*0.1;
 
-    switch(rotate_choice)
-    {
-      case 1:
-      {
-        rotate_x = rotation_x(to_radians(angle_x));
-        break;
-      }
-      case 2:
-      {
-        rotate_z = rotation_z(to_radians(angle_z));
-        break;
-      }
-      case 3:
-      {
-        rotate_y = rotation_y(to_radians(angle_y));
-        break;
-      }
-    }
+		glClearColor(background_color[0], background_color[1], background_color[2], 1);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		glViewport(0, 0, w, h);
 
-		glPushMatrix();
-		glMultMatrixf(proj.e);
-		
-		glPushMatrix();
-		glMultMatrixf(view.e);
-
-		glPushMatrix();
-		glMultMatrixf(rotate_x.e);
-
-		glPushMatrix();
-		glMultMatrixf(rotate_y.e);
-
-		glPushMatrix();
-		glMultMatrixf(rotate_z.e);
-
-		Matrix t, q;
-		
-		for (auto &c : cubes) {
-			q = quat_get_matrix(c.orientation);
-
-			t = translation(c.p);
+		// The camera matrices are only rebuilt when the angles, the zoom
+		// or the window size change.
+		scene_view_update(&view, angle_x, angle_y, angle_z, camera_distance, aspect_ratio);
 
-			glPushMatrix();
-			glMultMatrixf(q.e);
-			glPushMatrix();
-			glMultMatrixf(t.e);
-			
-			glPushMatrix();
-			glMultMatrixf(scale.e);
-
-			glBegin(GL_TRIANGLES);
-			draw_cube(c.c[0],c.c[1],c.c[2]);
-			glEnd();
-
-
-			glPopMatrix();
-			glPopMatrix();
-			glPopMatrix();
-		}
-
-
-		glPopMatrix();
-		glPopMatrix();
-		glPopMatrix();
-
-		glPopMatrix();
-		glPopMatrix();
+		Cubie_instance instances[CORNER_COUNT];
+		Cubie_draw draws[CORNER_COUNT];
+		scene_instances(shown.orientation, instances);
+		scene_compose(&view, instances, draws, CORNER_COUNT);
+		renderer_draw(&renderer, draws, CORNER_COUNT);
 
 		SDL_GL_SwapWindow(window);
 	}
 
+	sim.stop = true;
+	sim_thread.join();
+	if (sim.solve_pending)
+		solve_job_finish(&sim.solve_job);
+	if (sim.replaying)
+		replay_player_close(&sim.player);
+	if (recorder.file && !replay_writer_close(&recorder))
+		printf("Could not write the recording\n");
+	printf("%llu commands, %llu dropped, at most %u waiting\n", (unsigned long long)sim.commands.pushed,
+	       (unsigned long long)sim.commands.dropped, (unsigned)sim.commands.max_depth);
+
 	SDL_GL_DeleteContext(glcontext);
 
 	SDL_Quit();
@@ -0,0 +1,86 @@
+#pragma once
+
+// Move history kept in canonical form as moves are made.
+//
+// Each entry is one face turned one, two or three quarter turns clockwise.
+// Pushing a move onto the same face merges into that entry, and drops it
+// when the turns add up to a whole turn. Moves on opposite faces commute,
+// so a move also merges through an entry on the opposite face, and two
+// such entries are kept with the lower face first. No two entries in the
+// history can then be merged or reordered, and sequences that differ only
+// by such steps end up with the same history.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+#include "cube_state.h"
+
+// Faces on the same axis: F B, L R, U D.
+static const uint8_t face_axis[6] = { 0, 1, 1, 0, 2, 2 };
+
+struct Move_history {
+  // face << 2 | clockwise quarter turns (1 to 3)
+  std::vector<uint8_t> turns;
+  // Quarter turns pushed since the last clear, before simplifying.
+  uint64_t pushed;
+};
+
+static void move_history_clear(Move_history *h)
+{
+  h->turns.clear();
+  h->pushed = 0;
+}
+
+static void move_history_push(Move_history *h, int move)
+{
+  int face = move >> 1, quarter = (move & 1) ? 3 : 1;
+  std::vector<uint8_t> &t = h->turns;
+  h->pushed++;
+
+  size_t n = t.size(), at = n;
+  if (n > 0 && (t[n - 1] >> 2) == face)
+    at = n - 1;
+  else if (n > 1 && face_axis[t[n - 1] >> 2] == face_axis[face] && (t[n - 2] >> 2) == face)
+    at = n - 2;
+  if (at < n) {
+    int q = ((t[at] & 3) + quarter) & 3;
+    if (q == 0)
+      t.erase(t.begin() + at);
+    else
+      t[at] = (uint8_t)(face << 2 | q);
+    return;
+  }
+
+  t.push_back((uint8_t)(face << 2 | quarter));
+  if (n > 0 && face_axis[t[n - 1] >> 2] == face_axis[face] && (t[n - 1] >> 2) > face)
+    std::swap(t[n - 1], t[n]);
+}
+
+// Writes the history as moves (a half turn as two clockwise ones) and
+// returns how many, or -1 if they do not fit in max_moves.
+static int move_history_moves(const Move_history *h, int *moves, int max_moves)
+{
+  int len = 0;
+  for (uint8_t e : h->turns) {
+    int face = e >> 2, q = e & 3;
+    int count = q == 2 ? 2 : 1;
+    if (len + count > max_moves)
+      return -1;
+    for (int i = 0; i < count; i++)
+      moves[len++] = face * 2 + (q == 3 ? 1 : 0);
+  }
+  return len;
+}
+
+// Writes the moves that undo the history, last turn first, and returns
+// how many, or -1 if they do not fit in max_moves.
+static int move_history_undo(const Move_history *h, int *moves, int max_moves)
+{
+  int len = move_history_moves(h, moves, max_moves);
+  for (int i = 0, j = len - 1; i < j; i++, j--)
+    std::swap(moves[i], moves[j]);
+  for (int i = 0; i < len; i++)
+    moves[i] ^= 1;
+  return len;
+}
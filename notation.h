@@ -0,0 +1,99 @@
+#pragma once
+
+// Text form of move sequences.
+//
+// A move is a face letter F, L, R, B, U or D, or the key that turns that
+// face in the window (5, 4, 6, 0, 8, 2). A trailing ' turns it
+// anti-clockwise like holding Ctrl, and a trailing 2 after a letter turns it
+// twice. Moves are separated by spaces or commas.
+
+#include <stdio.h>
+#include <string.h>
+#include "cube_state.h"
+
+static const char face_letters[] = "FLRBUD";
+static const char face_keys[] = "546082";
+
+enum {
+  TOKEN_END = 0,
+  TOKEN_MOVE,
+  TOKEN_ERROR
+};
+
+// Reads the token starting at *p and moves *p past it. For a move, sets
+// move and turns (1 or 2).
+static int next_move_token(const char **p, int *move, int *turns)
+{
+  const char *c = *p;
+  while (*c == ' ' || *c == '\t' || *c == ',' || *c == '\r' || *c == '\n')
+    c++;
+  if (*c == 0) {
+    *p = c;
+    return TOKEN_END;
+  }
+
+  const char *face = strchr(face_letters, *c);
+  bool letter = face != NULL;
+  if (!face)
+    face = strchr(face_keys, *c);
+  if (!face) {
+    *p = c + 1;
+    return TOKEN_ERROR;
+  }
+  int f = letter ? (int)(face - face_letters) : (int)(face - face_keys);
+  c++;
+
+  *turns = 1;
+  bool anti = false;
+  if (letter && *c == '2') {
+    *turns = 2;
+    c++;
+  }
+  if (*c == '\'') {
+    anti = true;
+    c++;
+  }
+  *p = c;
+  if (*c && *c != ' ' && *c != '\t' && *c != ',' && *c != '\r' && *c != '\n')
+    return TOKEN_ERROR;
+  *move = f * 2 + (anti ? 1 : 0);
+  return TOKEN_MOVE;
+}
+
+// Applies the moves in text to s. Returns false on a malformed token.
+static bool apply_move_text(Cube_state *s, const char *text)
+{
+  int move, turns, token;
+  while ((token = next_move_token(&text, &move, &turns)) == TOKEN_MOVE) {
+    for (int i = 0; i < turns; i++)
+      *s = apply_move(*s, move);
+  }
+  return token == TOKEN_END;
+}
+
+// Writes moves in letter notation, two equal quarter turns as one half turn.
+// Returns the length written, like snprintf.
+static int format_moves(const int *moves, int n, char *out, size_t size)
+{
+  size_t len = 0;
+  for (int i = 0; i < n; i++) {
+    char token[4];
+    int t = 0;
+    token[t++] = face_letters[moves[i] >> 1];
+    if (i + 1 < n && moves[i + 1] == moves[i]) {
+      token[t++] = '2';
+      i++;
+    } else if (moves[i] & 1) {
+      token[t++] = '\'';
+    }
+    if (len > 0 && len < size)
+      out[len] = ' ';
+    len += len > 0;
+    for (int j = 0; j < t; j++, len++)
+      if (len < size)
+        out[len] = token[j];
+  }
+  if (size > 0)
+    out[len < size ? len : size - 1] = 0;
+  return (int)len;
+}
@@ -0,0 +1,244 @@
+#pragma once
+
+// NxN cubes as facelets.
+//
+// Each face keeps its N*N stickers in a contiguous byte array, in the face
+// order F, L, R, B, U, D of the moves, and a sticker holds the face it
+// belongs to when solved. A face is read in rows from the top left as seen
+// from outside, with U seen with F below it and D with F above it.
+//
+// Turning a layer moves four strips of N stickers on the faces around it,
+// each a strided run inside one face array, and the strips come from index
+// maps built once per size. The face at the end of an outer layer turns as
+// a whole; rather than moving its N*N stickers, its frame (where row 0,
+// column 0 is and which way rows and columns run in the array) is turned,
+// so every move costs O(N).
+
+#include <stdint.h>
+#include <string.h>
+#include <mutex>
+#include "cube_state.h"
+
+#define NXN_MIN_SIZE 2
+#define NXN_MAX_SIZE 64
+#define NXN_FACES 6
+
+// A strip of a layer turn: n stickers from (row, col) of face, stepping by
+// (row_step, col_step) in that face's rows and columns.
+struct Nxn_strip {
+  int8_t face;
+  int8_t row_step, col_step;
+  int16_t row, col;
+};
+
+// Index maps for one size. A clockwise turn of a layer moves strip k onto
+// strip k + 1, sticker by sticker.
+struct Nxn_layout {
+  int n;
+  // [face * n + depth][k]
+  Nxn_strip *strips;
+};
+
+// Where sticker (row, col) of a face is in its array:
+// base + row * row_stride + col * col_stride.
+struct Nxn_frame {
+  int base, row_stride, col_stride;
+};
+
+struct Nxn_cube {
+  int n;
+  const Nxn_layout *layout;
+  // NXN_FACES arrays of n * n stickers.
+  uint8_t *facelets;
+  Nxn_frame frame[NXN_FACES];
+};
+
+static const int nxn_opposite[NXN_FACES] = { 3, 2, 1, 0, 5, 4 };
+
+// Per face: column and row direction as seen from outside.
+static const Ivec3 nxn_face_right[NXN_FACES] = {
+  { 1, 0, 0}, { 0, 0, 1}, { 0, 0,-1}, {-1, 0, 0}, { 1, 0, 0}, { 1, 0, 0},
+};
+static const Ivec3 nxn_face_down[NXN_FACES] = {
+  { 0,-1, 0}, { 0,-1, 0}, { 0,-1, 0}, { 0,-1, 0}, { 0, 0, 1}, { 0, 0,-1},
+};
+
+// Centre of a sticker in units of half a cubie, the cube spanning -n..n.
+static Ivec3 nxn_sticker_position(int n, int face, int row, int col)
+{
+  Ivec3 f = face_normal[face], r = nxn_face_right[face], d = nxn_face_down[face];
+  int x = 2 * col - (n - 1), y = 2 * row - (n - 1);
+  return Ivec3{ n * f.x + x * r.x + y * d.x, n * f.y + x * r.y + y * d.y, n * f.z + x * r.z + y * d.z };
+}
+
+static int nxn_face_of(Ivec3 normal)
+{
+  for (int f = 0; f < NXN_FACES; f++)
+    if (face_normal[f].x == normal.x && face_normal[f].y == normal.y && face_normal[f].z == normal.z)
+      return f;
+  return -1;
+}
+
+// Walks the stickers of a strip through a clockwise turn of face and
+// returns the strip they land on.
+static Nxn_strip nxn_turn_strip(int n, int face, Nxn_strip s)
+{
+  Ivec3 f = face_normal[face];
+  Rotation turn = quarter_turn(Ivec3{ -f.x, -f.y, -f.z });
+  int to = nxn_face_of(rotate_ivec3(turn, face_normal[s.face]));
+  int row[2], col[2];
+  for (int i = 0; i < 2; i++) {
+    Ivec3 p = rotate_ivec3(turn, nxn_sticker_position(n, s.face, s.row + i * s.row_step, s.col + i * s.col_step));
+    col[i] = (ivec3_dot(p, nxn_face_right[to]) + n - 1) / 2;
+    row[i] = (ivec3_dot(p, nxn_face_down[to]) + n - 1) / 2;
+  }
+  Nxn_strip o;
+  o.face = (int8_t)to;
+  o.row = (int16_t)row[0];
+  o.col = (int16_t)col[0];
+  o.row_step = (int8_t)(row[1] - row[0]);
+  o.col_step = (int8_t)(col[1] - col[0]);
+  return o;
+}
+
+static Nxn_layout *nxn_build_layout(int n)
+{
+  Nxn_layout *l = new Nxn_layout;
+  l->n = n;
+  l->strips = new Nxn_strip[NXN_FACES * n * 4];
+  for (int face = 0; face < NXN_FACES; face++) {
+    // A face the layer crosses: the first one next to face in face order.
+    int side = 0;
+    while (ivec3_dot(face_normal[side], face_normal[face]) != 0)
+      side++;
+    for (int depth = 0; depth < n; depth++) {
+      // The line of stickers on side at this depth, in the direction that
+      // runs across face's normal.
+      int along = n - 1 - 2 * depth;
+      Ivec3 f = face_normal[face];
+      Nxn_strip s;
+      s.face = (int8_t)side;
+      if (ivec3_dot(nxn_face_right[side], f) != 0) {
+        int col = (along * ivec3_dot(nxn_face_right[side], f) + n - 1) / 2;
+        s.row = 0;
+        s.col = (int16_t)col;
+        s.row_step = 1;
+        s.col_step = 0;
+      } else {
+        int row = (along * ivec3_dot(nxn_face_down[side], f) + n - 1) / 2;
+        s.row = (int16_t)row;
+        s.col = 0;
+        s.row_step = 0;
+        s.col_step = 1;
+      }
+      Nxn_strip *strips = l->strips + (face * n + depth) * 4;
+      for (int k = 0; k < 4; k++) {
+        strips[k] = s;
+        s = nxn_turn_strip(n, face, s);
+      }
+    }
+  }
+  return l;
+}
+
+static Nxn_layout *nxn_layouts[NXN_MAX_SIZE + 1];
+static std::mutex nxn_layout_lock;
+
+// Built on first use and kept; safe to call from several threads.
+static const Nxn_layout *nxn_layout(int n)
+{
+  std::lock_guard<std::mutex> lock(nxn_layout_lock);
+  if (!nxn_layouts[n])
+    nxn_layouts[n] = nxn_build_layout(n);
+  return nxn_layouts[n];
+}
+
+// A solved cube of size n. False if n is out of range.
+static bool nxn_cube_init(Nxn_cube *c, int n)
+{
+  if (n < NXN_MIN_SIZE || n > NXN_MAX_SIZE)
+    return false;
+  c->n = n;
+  c->layout = nxn_layout(n);
+  c->facelets = new uint8_t[NXN_FACES * n * n];
+  for (int f = 0; f < NXN_FACES; f++) {
+    memset(c->facelets + f * n * n, f, n * n);
+    c->frame[f] = Nxn_frame{ 0, n, 1 };
+  }
+  return true;
+}
+
+static void nxn_cube_free(Nxn_cube *c)
+{
+  delete[] c->facelets;
+  c->facelets = NULL;
+}
+
+static uint8_t nxn_facelet(const Nxn_cube *c, int face, int row, int col)
+{
+  const Nxn_frame &fr = c->frame[face];
+  return c->facelets[face * c->n * c->n + fr.base + row * fr.row_stride + col * fr.col_stride];
+}
+
+// Turns the stickers of a face clockwise by turning its frame.
+static void nxn_turn_frame(Nxn_frame *fr, int n, int turns)
+{
+  for (int i = 0; i < turns; i++) {
+    // What is now at (row, col) was at (n - 1 - col, row).
+    int row_stride = fr->row_stride;
+    fr->base += (n - 1) * row_stride;
+    fr->row_stride = fr->col_stride;
+    fr->col_stride = -row_stride;
+  }
+}
+
+// Turns the layer depth layers in from face clockwise as seen from face,
+// turns (1 to 3) times. Depth 0 is the face itself, n - 1 the opposite one.
+static void nxn_turn(Nxn_cube *c, int face, int depth, int turns)
+{
+  int n = c->n;
+  const Nxn_strip *strips = c->layout->strips + (face * n + depth) * 4;
+  uint8_t *p[4];
+  int stride[4];
+  for (int k = 0; k < 4; k++) {
+    const Nxn_strip &s = strips[k];
+    const Nxn_frame &fr = c->frame[s.face];
+    p[k] = c->facelets + s.face * n * n + fr.base + s.row * fr.row_stride + s.col * fr.col_stride;
+    stride[k] = s.row_step * fr.row_stride + s.col_step * fr.col_stride;
+  }
+
+  uint8_t tmp[NXN_MAX_SIZE];
+  if (turns == 2) {
+    for (int k = 0; k < 2; k++)
+      for (int i = 0; i < n; i++) {
+        uint8_t t = p[k][i * stride[k]];
+        p[k][i * stride[k]] = p[k + 2][i * stride[k + 2]];
+        p[k + 2][i * stride[k + 2]] = t;
+      }
+  } else {
+    // Strip k goes to k + step, all around the ring.
+    int step = turns == 1 ? 1 : 3;
+    int k = 0;
+    for (int i = 0; i < n; i++)
+      tmp[i] = p[k][i * stride[k]];
+    for (int j = 0; j < 3; j++) {
+      int from = (k + 4 - step) % 4;
+      for (int i = 0; i < n; i++)
+        p[k][i * stride[k]] = p[from][i * stride[from]];
+      k = from;
+    }
+    for (int i = 0; i < n; i++)
+      p[k][i * stride[k]] = tmp[i];
+  }
+
+  if (depth == 0)
+    nxn_turn_frame(&c->frame[face], n, turns);
+  if (depth == n - 1)
+    nxn_turn_frame(&c->frame[nxn_opposite[face]], n, 4 - turns);
+}
+
+// One of the twelve outer layer moves of the 2x2x2.
+static void nxn_apply_move(Nxn_cube *c, int move)
+{
+  nxn_turn(c, move >> 1, 0, move & 1 ? 3 : 1);
+}
@@ -0,0 +1,239 @@
+#pragma once
+
+// Instanced cubie renderer.
+//
+// The cubie mesh lives in a static vertex buffer. Every frame the composed
+// transforms and face colours of all cubies (scene_compose) go up in one
+// instance buffer and a single glDrawArraysInstanced call draws them, so
+// the cost per cubie is 136 bytes of upload and one matrix per vertex,
+// instead of 36 immediate mode vertices and a stack of glMultMatrixf.
+//
+// The shader lights each vertex as described in scene.h, so the cube looks
+// exactly as it did with the fixed function GL_LIGHT0 setup.
+
+#include <stddef.h>
+#include <stdio.h>
+#include <GL/gl.h>
+#include "SDL2/include/SDL.h"
+#include "scene.h"
+
+// GL/gl.h on Windows stops at OpenGL 1.1. The rest is looked up at run time.
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+#ifndef GL_ARRAY_BUFFER
+#define GL_ARRAY_BUFFER 0x8892
+#endif
+#ifndef GL_STATIC_DRAW
+#define GL_STATIC_DRAW 0x88E4
+#endif
+#ifndef GL_STREAM_DRAW
+#define GL_STREAM_DRAW 0x88E0
+#endif
+#ifndef GL_FRAGMENT_SHADER
+#define GL_FRAGMENT_SHADER 0x8B30
+#endif
+#ifndef GL_VERTEX_SHADER
+#define GL_VERTEX_SHADER 0x8B31
+#endif
+#ifndef GL_COMPILE_STATUS
+#define GL_COMPILE_STATUS 0x8B81
+#endif
+#ifndef GL_LINK_STATUS
+#define GL_LINK_STATUS 0x8B82
+#endif
+
+struct Gl_functions {
+  void (APIENTRY *GenVertexArrays)(GLsizei n, GLuint *arrays);
+  void (APIENTRY *BindVertexArray)(GLuint array);
+  void (APIENTRY *GenBuffers)(GLsizei n, GLuint *buffers);
+  void (APIENTRY *BindBuffer)(GLenum target, GLuint buffer);
+  void (APIENTRY *BufferData)(GLenum target, ptrdiff_t size, const void *data, GLenum usage);
+  void (APIENTRY *EnableVertexAttribArray)(GLuint index);
+  void (APIENTRY *VertexAttribPointer)(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void *pointer);
+  void (APIENTRY *VertexAttribDivisor)(GLuint index, GLuint divisor);
+  GLuint (APIENTRY *CreateShader)(GLenum type);
+  void (APIENTRY *ShaderSource)(GLuint shader, GLsizei count, const char *const *source, const GLint *length);
+  void (APIENTRY *CompileShader)(GLuint shader);
+  void (APIENTRY *GetShaderiv)(GLuint shader, GLenum name, GLint *value);
+  void (APIENTRY *GetShaderInfoLog)(GLuint shader, GLsizei size, GLsizei *length, char *log);
+  void (APIENTRY *DeleteShader)(GLuint shader);
+  GLuint (APIENTRY *CreateProgram)(void);
+  void (APIENTRY *AttachShader)(GLuint program, GLuint shader);
+  void (APIENTRY *LinkProgram)(GLuint program);
+  void (APIENTRY *GetProgramiv)(GLuint program, GLenum name, GLint *value);
+  void (APIENTRY *GetProgramInfoLog)(GLuint program, GLsizei size, GLsizei *length, char *log);
+  void (APIENTRY *UseProgram)(GLuint program);
+  GLint (APIENTRY *GetUniformLocation)(GLuint program, const char *name);
+  void (APIENTRY *Uniform3fv)(GLint location, GLsizei count, const GLfloat *value);
+  void (APIENTRY *Uniform4fv)(GLint location, GLsizei count, const GLfloat *value);
+  void (APIENTRY *DrawArraysInstanced)(GLenum mode, GLint first, GLsizei count, GLsizei instances);
+};
+
+static Gl_functions gl;
+
+static const char *cubie_vertex_shader =
+  "#version 330\n"
+  "layout(location = 0) in vec3 position;\n"
+  "layout(location = 1) in vec3 normal;\n"
+  "layout(location = 2) in vec3 face;\n"
+  "layout(location = 3) in mat4 transform;\n"
+  "layout(location = 7) in mat3 normal_transform;\n"
+  "layout(location = 10) in mat3 colors;\n"
+  "uniform vec4 light_position;\n"
+  "uniform vec3 light_diffuse;\n"
+  "uniform vec3 ambient;\n"
+  "out vec3 shade;\n"
+  "void main() {\n"
+  "  vec4 eye = transform * vec4(position, 1.0);\n"
+  "  vec3 n = normal_transform * normal;\n"
+  "  vec3 l = normalize(light_position.xyz / light_position.w - eye.xyz);\n"
+  "  shade = (colors * face) * (ambient + light_diffuse * max(dot(n, l), 0.0));\n"
+  "  gl_Position = eye;\n"
+  "}\n";
+
+static const char *cubie_fragment_shader =
+  "#version 330\n"
+  "in vec3 shade;\n"
+  "out vec4 color;\n"
+  "void main() {\n"
+  "  color = vec4(shade, 1.0);\n"
+  "}\n";
+
+struct Renderer {
+  GLuint program;
+  GLuint vertex_array;
+  GLuint mesh;
+  GLuint instances;
+};
+
+static bool gl_load_functions()
+{
+  bool ok = true;
+#define LOAD_GL_FUNCTION(name) ok = (*(void **)&gl.name = SDL_GL_GetProcAddress("gl" #name)) != NULL && ok
+  LOAD_GL_FUNCTION(GenVertexArrays);
+  LOAD_GL_FUNCTION(BindVertexArray);
+  LOAD_GL_FUNCTION(GenBuffers);
+  LOAD_GL_FUNCTION(BindBuffer);
+  LOAD_GL_FUNCTION(BufferData);
+  LOAD_GL_FUNCTION(EnableVertexAttribArray);
+  LOAD_GL_FUNCTION(VertexAttribPointer);
+  LOAD_GL_FUNCTION(VertexAttribDivisor);
+  LOAD_GL_FUNCTION(CreateShader);
+  LOAD_GL_FUNCTION(ShaderSource);
+  LOAD_GL_FUNCTION(CompileShader);
+  LOAD_GL_FUNCTION(GetShaderiv);
+  LOAD_GL_FUNCTION(GetShaderInfoLog);
+  LOAD_GL_FUNCTION(DeleteShader);
+  LOAD_GL_FUNCTION(CreateProgram);
+  LOAD_GL_FUNCTION(AttachShader);
+  LOAD_GL_FUNCTION(LinkProgram);
+  LOAD_GL_FUNCTION(GetProgramiv);
+  LOAD_GL_FUNCTION(GetProgramInfoLog);
+  LOAD_GL_FUNCTION(UseProgram);
+  LOAD_GL_FUNCTION(GetUniformLocation);
+  LOAD_GL_FUNCTION(Uniform3fv);
+  LOAD_GL_FUNCTION(Uniform4fv);
+  LOAD_GL_FUNCTION(DrawArraysInstanced);
+#undef LOAD_GL_FUNCTION
+  return ok;
+}
+
+static GLuint compile_shader(GLenum type, const char *source)
+{
+  GLuint shader = gl.CreateShader(type);
+  gl.ShaderSource(shader, 1, &source, NULL);
+  gl.CompileShader(shader);
+  GLint ok;
+  gl.GetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+  if (!ok) {
+    char log[1024];
+    gl.GetShaderInfoLog(shader, sizeof(log), NULL, log);
+    fprintf(stderr, "shader does not compile:\n%s\n", log);
+    gl.DeleteShader(shader);
+    return 0;
+  }
+  return shader;
+}
+
+// Needs a current OpenGL 3.3 context. False, with a message on stderr, if
+// the driver lacks something.
+static bool renderer_init(Renderer *r)
+{
+  if (!gl_load_functions()) {
+    fprintf(stderr, "OpenGL 3.3 is not available\n");
+    return false;
+  }
+  GLuint vs = compile_shader(GL_VERTEX_SHADER, cubie_vertex_shader);
+  GLuint fs = compile_shader(GL_FRAGMENT_SHADER, cubie_fragment_shader);
+  if (!vs || !fs)
+    return false;
+  r->program = gl.CreateProgram();
+  gl.AttachShader(r->program, vs);
+  gl.AttachShader(r->program, fs);
+  gl.LinkProgram(r->program);
+  gl.DeleteShader(vs);
+  gl.DeleteShader(fs);
+  GLint ok;
+  gl.GetProgramiv(r->program, GL_LINK_STATUS, &ok);
+  if (!ok) {
+    char log[1024];
+    gl.GetProgramInfoLog(r->program, sizeof(log), NULL, log);
+    fprintf(stderr, "shader does not link:\n%s\n", log);
+    return false;
+  }
+  gl.UseProgram(r->program);
+  float ambient[3];
+  for (int i = 0; i < 3; i++)
+    ambient[i] = scene_ambient[i] + light_ambient[i];
+  gl.Uniform4fv(gl.GetUniformLocation(r->program, "light_position"), 1, light_position);
+  gl.Uniform3fv(gl.GetUniformLocation(r->program, "light_diffuse"), 1, light_diffuse);
+  gl.Uniform3fv(gl.GetUniformLocation(r->program, "ambient"), 1, ambient);
+
+  gl.GenVertexArrays(1, &r->vertex_array);
+  gl.BindVertexArray(r->vertex_array);
+
+  gl.GenBuffers(1, &r->mesh);
+  gl.BindBuffer(GL_ARRAY_BUFFER, r->mesh);
+  gl.BufferData(GL_ARRAY_BUFFER, sizeof(cubie_mesh), cubie_mesh, GL_STATIC_DRAW);
+  for (int i = 0; i < 3; i++) {
+    gl.EnableVertexAttribArray(i);
+    gl.VertexAttribPointer(i, 3, GL_FLOAT, GL_FALSE, sizeof(Cubie_vertex), (const void *)(i * 3 * sizeof(float)));
+  }
+
+  // The mat4 takes attributes 3 to 6 and the mat3s 7 to 9 and 10 to 12,
+  // one per column.
+  gl.GenBuffers(1, &r->instances);
+  gl.BindBuffer(GL_ARRAY_BUFFER, r->instances);
+  for (int i = 0; i < 4; i++) {
+    gl.EnableVertexAttribArray(3 + i);
+    gl.VertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(Cubie_draw),
+                           (const void *)(offsetof(Cubie_draw, transform) + i * 4 * sizeof(float)));
+    gl.VertexAttribDivisor(3 + i, 1);
+  }
+  for (int i = 0; i < 3; i++) {
+    gl.EnableVertexAttribArray(7 + i);
+    gl.VertexAttribPointer(7 + i, 3, GL_FLOAT, GL_FALSE, sizeof(Cubie_draw),
+                           (const void *)(offsetof(Cubie_draw, normal) + i * 3 * sizeof(float)));
+    gl.VertexAttribDivisor(7 + i, 1);
+  }
+  for (int i = 0; i < 3; i++) {
+    gl.EnableVertexAttribArray(10 + i);
+    gl.VertexAttribPointer(10 + i, 3, GL_FLOAT, GL_FALSE, sizeof(Cubie_draw),
+                           (const void *)(offsetof(Cubie_draw, color) + i * sizeof(Vector3)));
+    gl.VertexAttribDivisor(10 + i, 1);
+  }
+  return true;
+}
+
+// Draws n composed cubies.
+static void renderer_draw(Renderer *r, const Cubie_draw *instances, int n)
+{
+  gl.UseProgram(r->program);
+  gl.BindVertexArray(r->vertex_array);
+  gl.BindBuffer(GL_ARRAY_BUFFER, r->instances);
+  // A fresh store each frame, so the driver need not wait for the last
+  // frame's draw to finish reading the old one.
+  gl.BufferData(GL_ARRAY_BUFFER, n * sizeof(Cubie_draw), instances, GL_STREAM_DRAW);
+  gl.DrawArraysInstanced(GL_TRIANGLES, 0, 36, n);
+}
@@ -0,0 +1,608 @@
+#pragma once
+
+// Session recordings.
+//
+// Every move made on the cube is recorded with the time it was made. A
+// recording is a Replay_file_header followed by blocks of up to
+// REPLAY_BLOCK_MOVES moves, each a Replay_block_header and a payload: the
+// moves at four bits each, two to a byte, then the time of every move as a
+// varint of milliseconds since the move before it (the first one since the
+// block start). A block decodes on its own, and its checksum covers the
+// rest of its header and its payload.
+//
+// The window records through a Replay_writer: a move is a few byte writes
+// into the open block, and closed blocks are written out by a thread of
+// their own, so the render loop never waits on the disk. A Replay_reader
+// walks a mapped recording block by block, and a Replay_player hands out
+// the moves that are due at any playback speed.
+//
+// Every block header also holds the number of moves before the block and
+// the state they leave, and a closed recording ends in an index of its
+// blocks. Seeking to any move is then a search of the index, one block
+// decoded and fewer than REPLAY_BLOCK_MOVES moves applied to the block's
+// state. A recording that was never closed is indexed by walking its
+// blocks when it is opened.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "cube_state.h"
+#include "table_file.h"
+
+#define REPLAY_MAGIC "CUBEREC"
+#define REPLAY_INDEX_MAGIC "CUBEIDX"
+#define REPLAY_VERSION 2
+#define REPLAY_BYTE_ORDER 0x01020304u
+// Also the most moves a seek applies.
+#define REPLAY_BLOCK_MOVES 4096
+// A block is also closed once its first move is this old, by the next
+// move or by replay_writer_tick(), so a session that ends without closing
+// the writer loses at most this much if the writer is ticked.
+#define REPLAY_BLOCK_SECONDS 10.0
+#define REPLAY_TICKS_PER_SECOND 1000
+
+struct Replay_file_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  // Seconds since 1970 when the recording started.
+  uint64_t start_time;
+};
+
+struct Replay_block_header {
+  uint64_t checksum;
+  uint32_t move_count;
+  uint32_t payload_size;
+  // Ticks from the start of the recording to the block's first move.
+  uint64_t start_ticks;
+  // Moves in the recording before this block, and the state they leave.
+  uint64_t first_move;
+  Cube_state state;
+  uint32_t reserved;
+};
+
+struct Replay_index_entry {
+  uint64_t offset;
+  uint64_t first_move;
+  uint64_t start_ticks;
+  uint32_t move_count;
+  uint32_t reserved;
+};
+
+// Last in a closed recording, right after the index entries.
+struct Replay_index_trailer {
+  uint64_t offset;
+  uint64_t block_count;
+  uint64_t checksum;
+  char magic[8];
+};
+
+static void replay_put_varint(std::vector<uint8_t> &out, uint64_t v)
+{
+  while (v >= 0x80) {
+    out.push_back((uint8_t)(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back((uint8_t)v);
+}
+
+// False if the varint runs past end or is longer than 64 bits.
+static bool replay_get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v)
+{
+  const uint8_t *q = *p;
+  uint64_t r = 0;
+  for (int shift = 0; shift < 64 && q < end; shift += 7) {
+    uint8_t b = *q++;
+    r |= (uint64_t)(b & 0x7f) << shift;
+    if (b < 0x80) {
+      *p = q;
+      *v = r;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Over everything after the checksum field: the rest of the header, then
+// the payload right behind it.
+static uint64_t replay_block_checksum(const uint8_t *block)
+{
+  Replay_block_header h;
+  memcpy(&h, block, sizeof(h));
+  return table_checksum(block + sizeof(h.checksum), sizeof(h) - sizeof(h.checksum) + h.payload_size);
+}
+
+struct Replay_writer {
+  FILE *file;
+  double start_seconds;
+  // The open block. Moves and deltas are kept apart until it is closed.
+  Replay_block_header block;
+  double block_seconds;
+  uint64_t last_ticks;
+  uint8_t nibbles[REPLAY_BLOCK_MOVES / 2];
+  std::vector<uint8_t> deltas;
+  // State after every move recorded so far, and how many there were.
+  Cube_state state;
+  uint64_t moves;
+
+  // Closed blocks waiting for the writer thread.
+  std::mutex lock;
+  std::condition_variable ready;
+  std::deque<std::vector<uint8_t>> queue;
+  bool stopping;
+  bool failed;
+  std::thread thread;
+  // Kept by the writer thread: where the next block goes, and the blocks
+  // written so far.
+  uint64_t offset;
+  std::vector<Replay_index_entry> index;
+};
+
+static void replay_writer_thread(Replay_writer *w)
+{
+  for (;;) {
+    std::vector<uint8_t> bytes;
+    {
+      std::unique_lock<std::mutex> lock(w->lock);
+      w->ready.wait(lock, [w] { return w->stopping || !w->queue.empty(); });
+      if (w->queue.empty())
+        return;
+      bytes.swap(w->queue.front());
+      w->queue.pop_front();
+    }
+    bool ok = fwrite(bytes.data(), 1, bytes.size(), w->file) == bytes.size() && fflush(w->file) == 0;
+    Replay_block_header h;
+    memcpy(&h, bytes.data(), sizeof(h));
+    w->index.push_back(Replay_index_entry{ w->offset, h.first_move, h.start_ticks, h.move_count, 0 });
+    w->offset += bytes.size();
+    if (!ok) {
+      std::lock_guard<std::mutex> lock(w->lock);
+      w->failed = true;
+    }
+  }
+}
+
+// Starts a recording at path; now is the caller's clock in seconds, the
+// same clock later moves are stamped with.
+static bool replay_writer_open(Replay_writer *w, const char *path, double now)
+{
+  w->file = fopen(path, "wb");
+  if (!w->file)
+    return false;
+  Replay_file_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, REPLAY_MAGIC, sizeof(REPLAY_MAGIC));
+  header.version = REPLAY_VERSION;
+  header.byte_order = REPLAY_BYTE_ORDER;
+  header.start_time = (uint64_t)time(NULL);
+  if (fwrite(&header, sizeof(header), 1, w->file) != 1 || fflush(w->file) != 0) {
+    fclose(w->file);
+    w->file = NULL;
+    return false;
+  }
+  w->start_seconds = now;
+  w->block.move_count = 0;
+  w->deltas.clear();
+  w->last_ticks = 0;
+  w->state = cube_state_solved();
+  w->moves = 0;
+  w->offset = sizeof(header);
+  w->index.clear();
+  w->stopping = false;
+  w->failed = false;
+  w->thread = std::thread(replay_writer_thread, w);
+  return true;
+}
+
+// Hands the open block to the writer thread.
+static void replay_close_block(Replay_writer *w)
+{
+  Replay_block_header &h = w->block;
+  if (h.move_count == 0)
+    return;
+  uint32_t nibble_bytes = (h.move_count + 1) / 2;
+  h.payload_size = nibble_bytes + (uint32_t)w->deltas.size();
+  std::vector<uint8_t> bytes(sizeof(h) + h.payload_size);
+  memcpy(bytes.data() + sizeof(h), w->nibbles, nibble_bytes);
+  memcpy(bytes.data() + sizeof(h) + nibble_bytes, w->deltas.data(), w->deltas.size());
+  memcpy(bytes.data(), &h, sizeof(h));
+  h.checksum = replay_block_checksum(bytes.data());
+  memcpy(bytes.data(), &h, sizeof(h));
+  {
+    std::lock_guard<std::mutex> lock(w->lock);
+    w->queue.push_back(std::move(bytes));
+  }
+  w->ready.notify_one();
+  h.move_count = 0;
+  w->deltas.clear();
+}
+
+// Records a move made at now. Does nothing if no recording is open. The
+// recording starts from the solved cube.
+static void replay_write_move(Replay_writer *w, int move, double now)
+{
+  if (!w->file)
+    return;
+  double t = (now - w->start_seconds) * REPLAY_TICKS_PER_SECOND + 0.5;
+  uint64_t ticks = t > 0 ? (uint64_t)t : 0;
+  if (ticks < w->last_ticks)
+    ticks = w->last_ticks;
+
+  Replay_block_header &h = w->block;
+  if (h.move_count == 0) {
+    h.start_ticks = ticks;
+    h.first_move = w->moves;
+    h.state = w->state;
+    h.reserved = 0;
+    w->block_seconds = now;
+    w->last_ticks = ticks;
+  }
+  if (h.move_count % 2 == 0)
+    w->nibbles[h.move_count / 2] = (uint8_t)move;
+  else
+    w->nibbles[h.move_count / 2] |= (uint8_t)(move << 4);
+  replay_put_varint(w->deltas, ticks - w->last_ticks);
+  w->last_ticks = ticks;
+  h.move_count++;
+  w->state = apply_move(w->state, move);
+  w->moves++;
+
+  if (h.move_count == REPLAY_BLOCK_MOVES || now - w->block_seconds >= REPLAY_BLOCK_SECONDS)
+    replay_close_block(w);
+}
+
+// Closes the open block if its first move is REPLAY_BLOCK_SECONDS old by
+// now, so moves made before a long pause reach the file. Call it often.
+static void replay_writer_tick(Replay_writer *w, double now)
+{
+  if (w->file && w->block.move_count && now - w->block_seconds >= REPLAY_BLOCK_SECONDS)
+    replay_close_block(w);
+}
+
+// Writes out the open block, waits for the writer thread, appends the
+// index and closes the file. False if anything could not be written.
+static bool replay_writer_close(Replay_writer *w)
+{
+  if (!w->file)
+    return false;
+  replay_close_block(w);
+  {
+    std::lock_guard<std::mutex> lock(w->lock);
+    w->stopping = true;
+  }
+  w->ready.notify_one();
+  w->thread.join();
+  Replay_index_trailer trailer;
+  memset(&trailer, 0, sizeof(trailer));
+  trailer.offset = w->offset;
+  trailer.block_count = w->index.size();
+  trailer.checksum = table_checksum(w->index.data(), w->index.size() * sizeof(Replay_index_entry));
+  memcpy(trailer.magic, REPLAY_INDEX_MAGIC, sizeof(REPLAY_INDEX_MAGIC));
+  bool written = fwrite(w->index.data(), sizeof(Replay_index_entry), w->index.size(), w->file) == w->index.size() &&
+                 fwrite(&trailer, sizeof(trailer), 1, w->file) == 1;
+  bool ok = fclose(w->file) == 0 && written && !w->failed;
+  w->file = NULL;
+  return ok;
+}
+
+// A name for this session's recording, from the local time.
+static void replay_session_path(char *path, size_t size)
+{
+  time_t now = time(NULL);
+  strftime(path, size, "session-%Y%m%d-%H%M%S.cuberec", localtime(&now));
+}
+
+struct Replay_reader {
+  Mapped_file file;
+  uint64_t start_time;
+  // Where the blocks end: at the index, or at the end of the file.
+  size_t end;
+  // Offset of the next block.
+  size_t offset;
+  // Blocks that failed their checksum or did not decode, and were skipped.
+  uint64_t bad_blocks;
+  // Every good block, and the moves they hold.
+  std::vector<Replay_index_entry> index;
+  uint64_t move_total;
+  // The block read last: the moves before it, the state they leave, its
+  // moves and the tick of each.
+  int count;
+  uint64_t first_move;
+  Cube_state state;
+  uint8_t moves[REPLAY_BLOCK_MOVES + 1];
+  uint64_t ticks[REPLAY_BLOCK_MOVES];
+};
+
+// Takes the index of a closed recording. False if there is none that
+// checks out.
+static bool replay_read_index(Replay_reader *r)
+{
+  const uint8_t *data = r->file.data;
+  size_t size = r->file.size;
+  Replay_index_trailer trailer;
+  if (size < sizeof(Replay_file_header) + sizeof(trailer))
+    return false;
+  memcpy(&trailer, data + size - sizeof(trailer), sizeof(trailer));
+  size_t index_end = size - sizeof(trailer);
+  if (memcmp(trailer.magic, REPLAY_INDEX_MAGIC, sizeof(REPLAY_INDEX_MAGIC)) != 0 ||
+      trailer.offset < sizeof(Replay_file_header) || trailer.offset > index_end ||
+      trailer.block_count != (index_end - trailer.offset) / sizeof(Replay_index_entry) ||
+      trailer.offset + trailer.block_count * sizeof(Replay_index_entry) != index_end ||
+      trailer.checksum != table_checksum(data + trailer.offset, index_end - trailer.offset))
+    return false;
+  r->index.resize(trailer.block_count);
+  memcpy(r->index.data(), data + trailer.offset, index_end - trailer.offset);
+  r->end = trailer.offset;
+  return true;
+}
+
+// Indexes a recording that was never closed by checking every block.
+static void replay_build_index(Replay_reader *r)
+{
+  const uint8_t *data = r->file.data;
+  size_t size = r->file.size, at = sizeof(Replay_file_header);
+  r->index.clear();
+  while (size - at >= sizeof(Replay_block_header)) {
+    Replay_block_header h;
+    memcpy(&h, data + at, sizeof(h));
+    if (h.payload_size > size - at - sizeof(h))
+      break;
+    if (h.checksum == replay_block_checksum(data + at) && h.move_count <= REPLAY_BLOCK_MOVES)
+      r->index.push_back(Replay_index_entry{ at, h.first_move, h.start_ticks, h.move_count, 0 });
+    at += sizeof(h) + h.payload_size;
+  }
+  r->end = size;
+}
+
+static bool replay_reader_open(Replay_reader *r, const char *path)
+{
+  if (!map_file(path, &r->file))
+    return false;
+  Replay_file_header header;
+  bool ok = r->file.size >= sizeof(header);
+  if (ok) {
+    memcpy(&header, r->file.data, sizeof(header));
+    ok = memcmp(header.magic, REPLAY_MAGIC, sizeof(REPLAY_MAGIC)) == 0 &&
+         header.version == REPLAY_VERSION && header.byte_order == REPLAY_BYTE_ORDER;
+  }
+  if (!ok) {
+    unmap_file(&r->file);
+    return false;
+  }
+#ifndef _WIN32
+  madvise((void *)r->file.data, r->file.size, MADV_SEQUENTIAL);
+#endif
+  r->start_time = header.start_time;
+  r->offset = sizeof(header);
+  r->bad_blocks = 0;
+  r->count = 0;
+  r->first_move = 0;
+  r->state = cube_state_solved();
+  if (!replay_read_index(r))
+    replay_build_index(r);
+  r->move_total = 0;
+  if (!r->index.empty())
+    r->move_total = r->index.back().first_move + r->index.back().move_count;
+  return true;
+}
+
+static void replay_reader_close(Replay_reader *r)
+{
+  unmap_file(&r->file);
+}
+
+// Decodes one block whose checksum has been checked. Scanning archives is
+// bound by this loop, so it works on locals only, collects bad moves
+// rather than branching on them, and reads deltas of one or two bytes,
+// nearly all of them, without a branch on their length.
+static bool replay_decode_block(Replay_reader *r, const Replay_block_header &h, const uint8_t *payload)
+{
+  uint32_t count = h.move_count, nibble_bytes = (count + 1) / 2;
+  if (count > REPLAY_BLOCK_MOVES || nibble_bytes > h.payload_size)
+    return false;
+  uint8_t *moves = r->moves;
+  int bad = 0;
+  for (uint32_t i = 0; i < nibble_bytes; i++) {
+    uint8_t lo = payload[i] & 15, hi = payload[i] >> 4;
+    moves[i * 2] = lo;
+    moves[i * 2 + 1] = hi;
+    bad |= (lo >= MOVE_COUNT) | (hi >= MOVE_COUNT);
+  }
+  // The unused half of an odd block's last byte is zero.
+  if (bad)
+    return false;
+
+  const uint8_t *p = payload + nibble_bytes, *end = payload + h.payload_size;
+  uint64_t *out = r->ticks;
+  uint64_t ticks = h.start_ticks;
+  uint32_t i = 0;
+  while (i < count) {
+    for (; i < count && end - p >= 2; i++) {
+      uint32_t b0 = p[0], b1 = p[1], more = b0 >> 7;
+      if (more & (b1 >> 7))
+        break;
+      ticks += (b0 & 0x7f) | (b1 << 7 & (0 - more));
+      p += 1 + more;
+      out[i] = ticks;
+    }
+    if (i == count)
+      break;
+    uint64_t delta;
+    if (!replay_get_varint(&p, end, &delta))
+      return false;
+    ticks += delta;
+    out[i++] = ticks;
+  }
+  r->count = (int)count;
+  return true;
+}
+
+// Reads the next good block into moves and ticks. False at the end of the
+// recording, or where a block runs past the end of a cut off file.
+static bool replay_read_block(Replay_reader *r)
+{
+  const uint8_t *data = r->file.data;
+  size_t size = r->end;
+  while (r->offset < size && size - r->offset >= sizeof(Replay_block_header)) {
+    Replay_block_header h;
+    memcpy(&h, data + r->offset, sizeof(h));
+    if (h.payload_size > size - r->offset - sizeof(h)) {
+      r->bad_blocks++;
+      r->offset = size;
+      break;
+    }
+    const uint8_t *block = data + r->offset;
+    r->offset += sizeof(h) + h.payload_size;
+    if (h.checksum == replay_block_checksum(block) && replay_decode_block(r, h, block + sizeof(h))) {
+      r->first_move = h.first_move;
+      r->state = h.state;
+      return true;
+    }
+    r->bad_blocks++;
+  }
+  r->count = 0;
+  return false;
+}
+
+// Loads the block holding move number move (counted from 0) and writes
+// the state before that move. Returns where the move is in the block, or
+// -1 if the recording has no such move. Reading goes on after the block.
+static int replay_reader_seek(Replay_reader *r, uint64_t move, Cube_state *state)
+{
+  // The last block starting at or before move.
+  size_t lo = 0, hi = r->index.size();
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (r->index[mid].first_move <= move)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == 0)
+    return -1;
+  const Replay_index_entry &e = r->index[lo - 1];
+  if (move >= e.first_move + e.move_count)
+    return -1;
+  r->offset = e.offset;
+  if (!replay_read_block(r) || r->first_move != e.first_move)
+    return -1;
+  int at = (int)(move - e.first_move);
+  Cube_state s = r->state;
+  for (int i = 0; i < at; i++)
+    s = apply_move(s, r->moves[i]);
+  *state = s;
+  return at;
+}
+
+struct Replay_player {
+  Replay_reader reader;
+  // Next move in the reader's block.
+  int next;
+  // Recording seconds per second of playback.
+  double speed;
+  // Playback position, in ticks of the recording.
+  double position;
+  double last_seconds;
+  bool done;
+};
+
+// Opens a recording for playback from its first move; now is the caller's
+// clock in seconds.
+static bool replay_player_open(Replay_player *p, const char *path, double speed, double now)
+{
+  if (!replay_reader_open(&p->reader, path))
+    return false;
+  p->next = 0;
+  p->speed = speed;
+  p->last_seconds = now;
+  p->done = !replay_read_block(&p->reader);
+  p->position = p->done ? 0 : (double)p->reader.ticks[0];
+  return true;
+}
+
+static void replay_player_close(Replay_player *p)
+{
+  replay_reader_close(&p->reader);
+}
+
+// Moves played so far.
+static uint64_t replay_player_move(const Replay_player *p)
+{
+  return p->done ? p->reader.move_total : p->reader.first_move + p->next;
+}
+
+// Goes to move number move and writes the state before it; playback goes
+// on from there. False if the recording has no such move.
+static bool replay_player_seek(Replay_player *p, uint64_t move, Cube_state *state)
+{
+  int at = replay_reader_seek(&p->reader, move, state);
+  if (at < 0)
+    return false;
+  p->next = at;
+  p->position = (double)p->reader.ticks[at];
+  p->done = false;
+  return true;
+}
+
+// Advances playback to now and writes up to max_moves moves that are due.
+// Moves beyond max_moves stay due for the next call.
+static int replay_player_poll(Replay_player *p, double now, int *moves, int max_moves)
+{
+  p->position += (now - p->last_seconds) * p->speed * REPLAY_TICKS_PER_SECOND;
+  p->last_seconds = now;
+  int n = 0;
+  while (!p->done && n < max_moves) {
+    if (p->next == p->reader.count) {
+      p->next = 0;
+      p->done = !replay_read_block(&p->reader);
+      continue;
+    }
+    if ((double)p->reader.ticks[p->next] > p->position)
+      break;
+    moves[n++] = p->reader.moves[p->next++];
+  }
+  return n;
+}
+
+// --replay-scan file...: checks and decodes every block of the recordings
+// and prints what they hold and how fast they were read.
+static int replay_scan_main(int argc, char *argv[])
+{
+  uint64_t files = 0, blocks = 0, bad_blocks = 0, moves = 0, bytes = 0, ticks = 0;
+  int errors = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 2; i < argc; i++) {
+    Replay_reader r;
+    if (!replay_reader_open(&r, argv[i])) {
+      fprintf(stderr, "%s is not a recording\n", argv[i]);
+      errors++;
+      continue;
+    }
+    uint64_t first = 0, last = 0;
+    for (bool any = false; replay_read_block(&r); any = true) {
+      if (!any)
+        first = r.ticks[0];
+      last = r.ticks[r.count - 1];
+      blocks++;
+      moves += r.count;
+    }
+    files++;
+    bad_blocks += r.bad_blocks;
+    bytes += r.file.size;
+    ticks += last - first;
+    replay_reader_close(&r);
+  }
+  double ms = elapsed_ms(start);
+  printf("%llu recordings, %llu blocks, %llu bad, %llu moves over %.1f s of play\n",
+         (unsigned long long)files, (unsigned long long)blocks, (unsigned long long)bad_blocks,
+         (unsigned long long)moves, (double)ticks / REPLAY_TICKS_PER_SECOND);
+  printf("%.1f MB in %.1f ms, %.0f MB per second\n", bytes / 1e6, ms, ms > 0 ? bytes / 1e3 / ms : 0.0);
+  return errors || bad_blocks ? 2 : 0;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+// Seeded xoshiro256** generator. It is small and keeps no global state, so
+// every thread can own one and runs are reproducible from the seed.
+
+#include <stdint.h>
+
+struct Rng {
+  uint64_t s[4];
+};
+
+static uint64_t splitmix64(uint64_t *x)
+{
+  uint64_t z = (*x += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+static void rng_seed(Rng *r, uint64_t seed)
+{
+  for (int i = 0; i < 4; i++)
+    r->s[i] = splitmix64(&seed);
+}
+
+static inline uint64_t rotl64(uint64_t x, int k)
+{
+  return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t rng_next(Rng *r)
+{
+  uint64_t *s = r->s;
+  uint64_t result = rotl64(s[1] * 5, 7) * 9;
+  uint64_t t = s[1] << 17;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rotl64(s[3], 45);
+  return result;
+}
+
+// Uniform in [0, n), by multiply and shift with rejection of the few
+// values that would bias it.
+static inline uint32_t rng_below(Rng *r, uint32_t n)
+{
+  uint64_t m = (rng_next(r) >> 32) * n;
+  uint32_t low = (uint32_t)m;
+  if (low < n) {
+    uint32_t threshold = (0u - n) % n;
+    while (low < threshold) {
+      m = (rng_next(r) >> 32) * n;
+      low = (uint32_t)m;
+    }
+  }
+  return (uint32_t)(m >> 32);
+}
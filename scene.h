@@ -0,0 +1,220 @@
+#pragma once
+
+// What a frame shows, independent of what draws it: the cubie mesh, the
+// light, the face colours, where every cubie sits and the camera. The GL
+// renderer and the software renderer both draw Cubie_draw lists composed
+// here, so they show the same picture.
+//
+// The lighting is the fixed function GL_LIGHT0 setup main() used to have:
+// colour material for ambient and diffuse, no specular, no GL_NORMALIZE,
+// evaluated per vertex. That setup multiplied the projection into the
+// modelview matrix, so the lighting happens after projection.
+
+#include <stdint.h>
+#include "cube_math.h"
+#include "cube_state.h"
+#include "nxn_cube.h"
+
+// The light main() used to set up with glLightfv, plus the default
+// GL_LIGHT_MODEL_AMBIENT.
+static const float light_position[4] = { -2.0f, 2.0f, 0.7f, 1.0f };
+static const float light_diffuse[3] = { 1.0f, 1.0f, 1.0f };
+static const float light_ambient[3] = { 0.1f, 0.0f, 0.1f };
+static const float scene_ambient[3] = { 0.2f, 0.2f, 0.2f };
+
+// Face order F, L, R, B, U, D, as in the moves.
+static const Vector3 face_colors[NXN_FACES] = {
+  { 0.8f, 0.1f, 0.1f }, { 0.1f, 0.9f, 0.9f }, { 0.1f, 0.8f, 0.1f },
+  { 0.8f, 0.8f, 0.8f }, { 0.8f, 0.8f, 0.1f }, { 0.1f, 0.1f, 0.8f },
+};
+
+static const float background_color[3] = { 0.2f, 0.2f, 0.2f };
+
+// Cubies are drawn a little smaller than their slot, leaving dark seams.
+#define CUBIE_SCALE 0.95f
+#define CAMERA_DISTANCE 10.0f
+#define CAMERA_FOV 30.0f
+#define CAMERA_NEAR 0.1f
+#define CAMERA_FAR 100.0f
+
+struct Cubie_vertex {
+  float position[3];
+  float normal[3];
+  // Picks the instance colour: faces facing z, x or y.
+  float face[3];
+};
+
+// The unit cubie, with the triangles and winding of the old draw_cube().
+static const Cubie_vertex cubie_mesh[36] = {
+  // front
+  { { -0.5f, -0.5f, 0.5f }, { 0, 0, 1 }, { 1, 0, 0 } },
+  { { -0.5f, 0.5f, 0.5f }, { 0, 0, 1 }, { 1, 0, 0 } },
+  { { 0.5f, 0.5f, 0.5f }, { 0, 0, 1 }, { 1, 0, 0 } },
+  { { -0.5f, -0.5f, 0.5f }, { 0, 0, 1 }, { 1, 0, 0 } },
+  { { 0.5f, 0.5f, 0.5f }, { 0, 0, 1 }, { 1, 0, 0 } },
+  { { 0.5f, -0.5f, 0.5f }, { 0, 0, 1 }, { 1, 0, 0 } },
+  // right
+  { { 0.5f, -0.5f, 0.5f }, { 1, 0, 0 }, { 0, 1, 0 } },
+  { { 0.5f, 0.5f, 0.5f }, { 1, 0, 0 }, { 0, 1, 0 } },
+  { { 0.5f, 0.5f, -0.5f }, { 1, 0, 0 }, { 0, 1, 0 } },
+  { { 0.5f, -0.5f, 0.5f }, { 1, 0, 0 }, { 0, 1, 0 } },
+  { { 0.5f, 0.5f, -0.5f }, { 1, 0, 0 }, { 0, 1, 0 } },
+  { { 0.5f, -0.5f, -0.5f }, { 1, 0, 0 }, { 0, 1, 0 } },
+  // back
+  { { 0.5f, -0.5f, -0.5f }, { 0, 0, -1 }, { 1, 0, 0 } },
+  { { 0.5f, 0.5f, -0.5f }, { 0, 0, -1 }, { 1, 0, 0 } },
+  { { -0.5f, 0.5f, -0.5f }, { 0, 0, -1 }, { 1, 0, 0 } },
+  { { 0.5f, -0.5f, -0.5f }, { 0, 0, -1 }, { 1, 0, 0 } },
+  { { -0.5f, 0.5f, -0.5f }, { 0, 0, -1 }, { 1, 0, 0 } },
+  { { -0.5f, -0.5f, -0.5f }, { 0, 0, -1 }, { 1, 0, 0 } },
+  // left
+  { { -0.5f, -0.5f, -0.5f }, { -1, 0, 0 }, { 0, 1, 0 } },
+  { { -0.5f, 0.5f, -0.5f }, { -1, 0, 0 }, { 0, 1, 0 } },
+  { { -0.5f, 0.5f, 0.5f }, { -1, 0, 0 }, { 0, 1, 0 } },
+  { { -0.5f, -0.5f, -0.5f }, { -1, 0, 0 }, { 0, 1, 0 } },
+  { { -0.5f, 0.5f, 0.5f }, { -1, 0, 0 }, { 0, 1, 0 } },
+  { { -0.5f, -0.5f, 0.5f }, { -1, 0, 0 }, { 0, 1, 0 } },
+  // top
+  { { -0.5f, 0.5f, 0.5f }, { 0, 1, 0 }, { 0, 0, 1 } },
+  { { -0.5f, 0.5f, -0.5f }, { 0, 1, 0 }, { 0, 0, 1 } },
+  { { 0.5f, 0.5f, -0.5f }, { 0, 1, 0 }, { 0, 0, 1 } },
+  { { -0.5f, 0.5f, 0.5f }, { 0, 1, 0 }, { 0, 0, 1 } },
+  { { 0.5f, 0.5f, -0.5f }, { 0, 1, 0 }, { 0, 0, 1 } },
+  { { 0.5f, 0.5f, 0.5f }, { 0, 1, 0 }, { 0, 0, 1 } },
+  // bottom
+  { { -0.5f, -0.5f, -0.5f }, { 0, -1, 0 }, { 0, 0, 1 } },
+  { { -0.5f, -0.5f, 0.5f }, { 0, -1, 0 }, { 0, 0, 1 } },
+  { { 0.5f, -0.5f, 0.5f }, { 0, -1, 0 }, { 0, 0, 1 } },
+  { { -0.5f, -0.5f, -0.5f }, { 0, -1, 0 }, { 0, 0, 1 } },
+  { { 0.5f, -0.5f, 0.5f }, { 0, -1, 0 }, { 0, 0, 1 } },
+  { { 0.5f, -0.5f, -0.5f }, { 0, -1, 0 }, { 0, 0, 1 } },
+};
+
+// One per cubie: where it is and how it is coloured.
+struct Cubie_instance {
+  Matrix model;
+  // Colours of the faces facing z, x and y before the model transform.
+  Vector3 color[3];
+};
+
+// What the renderers draw per cubie, composed on the CPU and laid out as
+// the instanced vertex attributes: one matrix taking the mesh to clip
+// space and one taking its normals to where the light sees them.
+struct Cubie_draw {
+  Matrix transform;
+  float normal[9];
+  Vector3 color[3];
+};
+
+// Normals go through the transposed inverse of the whole modelview matrix,
+// of which only the upper three rows matter. For camera * model, with model
+// affine, that is normal_camera * n' - normal_offset * dot(n', t), where n'
+// is the normal through model and t the translation of model.
+static void normal_matrix(const Matrix &camera, float normal_camera[9], float normal_offset[3])
+{
+  Matrix inv;
+  if (!matrix_inverse(camera, &inv))
+    inv = scalar(Vector3{ 1, 1, 1 });
+  for (int c = 0; c < 3; c++) {
+    for (int r = 0; r < 3; r++)
+      normal_camera[c * 3 + r] = inv.e[r * 4 + c];
+    normal_offset[c] = inv.e[c * 4 + 3];
+  }
+}
+
+// Cubie i starts in slot i, with its colours facing z, x and y.
+static void cubie_home(int i, Vector3 *position, Vector3 color[3])
+{
+  Ivec3 p = slot_position(i);
+  *position = Vector3{ 0.5f * p.x, 0.5f * p.y, 0.5f * p.z };
+  color[0] = face_colors[nxn_face_of(Ivec3{ 0, 0, p.z })];
+  color[1] = face_colors[nxn_face_of(Ivec3{ p.x, 0, 0 })];
+  color[2] = face_colors[nxn_face_of(Ivec3{ 0, p.y, 0 })];
+}
+
+// The cubies turned by their orientations about the centre of the cube.
+static void scene_instances(const Quat orientation[CORNER_COUNT], Cubie_instance out[CORNER_COUNT])
+{
+  Matrix scale = scalar(Vector3{ CUBIE_SCALE, CUBIE_SCALE, CUBIE_SCALE });
+  for (int i = 0; i < CORNER_COUNT; i++) {
+    Vector3 p;
+    cubie_home(i, &p, out[i].color);
+    out[i].model = matrix_mul(matrix_mul(quat_get_matrix(orientation[i]), translation(p)), scale);
+  }
+}
+
+// The cubie orientations that show s at rest.
+static void state_orientations(Cube_state s, Quat out[CORNER_COUNT])
+{
+  uint8_t r[CORNER_COUNT];
+  cube_state_rotations(s, r);
+  for (int i = 0; i < CORNER_COUNT; i++)
+    out[i] = quat_from_rotation(rotations[r[i]].m);
+}
+
+// Projection times view: the camera distance in front of the cube, which
+// is turned by angle_x, then angle_y, then angle_z degrees.
+static Matrix scene_camera(float angle_x, float angle_y, float angle_z, float distance, float aspect_ratio)
+{
+  Matrix proj = perspective_projection(to_radians(CAMERA_FOV), aspect_ratio, CAMERA_NEAR, CAMERA_FAR);
+  Matrix view = translation(Vector3{ 0, 0, -distance });
+  Matrix m = matrix_mul(proj, view);
+  m = matrix_mul(m, rotation_x(to_radians(angle_x)));
+  m = matrix_mul(m, rotation_y(to_radians(angle_y)));
+  return matrix_mul(m, rotation_z(to_radians(angle_z)));
+}
+
+// The camera of a frame and its normal matrix. They only change when the
+// angles, the distance or the aspect ratio do, so scene_view_update keeps
+// them until then.
+struct Scene_view {
+  bool valid;
+  float angle_x, angle_y, angle_z, distance, aspect_ratio;
+  Matrix camera;
+  float normal_camera[9];
+  float normal_offset[3];
+};
+
+static void scene_view_init(Scene_view *v)
+{
+  v->valid = false;
+}
+
+// True if the matrices had to be rebuilt.
+static bool scene_view_update(Scene_view *v, float angle_x, float angle_y, float angle_z, float distance, float aspect_ratio)
+{
+  if (v->valid && v->angle_x == angle_x && v->angle_y == angle_y && v->angle_z == angle_z &&
+      v->distance == distance && v->aspect_ratio == aspect_ratio)
+    return false;
+  v->valid = true;
+  v->angle_x = angle_x;
+  v->angle_y = angle_y;
+  v->angle_z = angle_z;
+  v->distance = distance;
+  v->aspect_ratio = aspect_ratio;
+  v->camera = scene_camera(angle_x, angle_y, angle_z, distance, aspect_ratio);
+  normal_matrix(v->camera, v->normal_camera, v->normal_offset);
+  return true;
+}
+
+// The cubies as seen from view. The model is a rotation times a uniform
+// scale, so its inverse transpose is itself over the squared scale, and
+// with t its translation the normal matrix of camera * model is
+// (normal_camera - normal_offset t^T) * model / scale^2.
+static void scene_compose(const Scene_view *v, const Cubie_instance *in, Cubie_draw *out, int n)
+{
+  for (int i = 0; i < n; i++) {
+    const float *m = in[i].model.e;
+    out[i].transform = matrix_mul(v->camera, in[i].model);
+    float scale2 = m[0] * m[0] + m[1] * m[1] + m[2] * m[2];
+    float a[9];
+    for (int c = 0; c < 3; c++)
+      for (int r = 0; r < 3; r++)
+        a[c * 3 + r] = v->normal_camera[c * 3 + r] - v->normal_offset[r] * m[12 + c];
+    for (int c = 0; c < 3; c++)
+      for (int r = 0; r < 3; r++)
+        out[i].normal[c * 3 + r] = (a[r] * m[c * 4] + a[3 + r] * m[c * 4 + 1] + a[6 + r] * m[c * 4 + 2]) / scale2;
+    for (int k = 0; k < 3; k++)
+      out[i].color[k] = in[i].color[k];
+  }
+}
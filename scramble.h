@@ -0,0 +1,147 @@
+#pragma once
+
+// Random state scrambles.
+//
+// A scramble is the inverse of a shortest solution of a state drawn
+// uniformly from all of them: a random corner permutation and a random
+// twist, every twist coordinate being a valid orientation. Random moves
+// would need far more turns to get as far from solved, and a short random
+// walk stays near it. Turning the solved cube by a scramble gives the
+// drawn state up to turning the whole cube, which is one position.
+//
+// Every thread owns an Rng. The --scramble tool seeds one per block of
+// scrambles from the seed and the block number, so its output depends on
+// the seed alone and not on the thread count.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "notation.h"
+#include "rng.h"
+#include "table_file.h"
+
+// Scrambles per block of the --scramble tool.
+#define SCRAMBLE_BLOCK 4096
+#define SCRAMBLE_DEFAULT_SEED 1ull
+// Longest scramble line: SOLVER_MAX_DEPTH tokens of up to three bytes.
+#define SCRAMBLE_LINE_MAX (SOLVER_MAX_DEPTH * 3 + 2)
+
+static Cube_state random_state(Rng *rng)
+{
+  Cube_state s;
+  s.perm = rng_below(rng, CORNER_PERM_COUNT);
+  s.twist = rng_below(rng, CORNER_TWIST_COUNT);
+  return s;
+}
+
+// Writes a scramble for a uniformly random state to moves, which must
+// hold SOLVER_MAX_DEPTH, and returns its length, or -1 if table_solve()
+// finds no solution. The state goes to state unless that is NULL.
+static int random_scramble(Rng *rng, int *moves, Cube_state *state)
+{
+  Cube_state s = random_state(rng);
+  int solution[SOLVER_MAX_DEPTH];
+  int n = table_solve(s, solution, SOLVER_MAX_DEPTH);
+  for (int i = 0; i < n; i++)
+    moves[i] = solution[n - 1 - i] ^ 1;
+  if (state)
+    *state = s;
+  return n;
+}
+
+static void scramble_block_seed(Rng *rng, uint64_t seed, uint64_t block)
+{
+  uint64_t x = seed ^ splitmix64(&block);
+  rng_seed(rng, x);
+}
+
+struct Scramble_round {
+  uint64_t seed;
+  uint64_t first_block;
+  uint64_t count;
+  std::atomic<int> next;
+  // Scrambles table_solve() found no solution for.
+  std::atomic<uint64_t> failures;
+  // One text per block of the round, in block order.
+  std::vector<std::vector<char>> text;
+};
+
+static void scramble_worker(Scramble_round *r)
+{
+  int blocks = (int)r->text.size();
+  for (int b; (b = r->next++) < blocks;) {
+    uint64_t block = r->first_block + b;
+    uint64_t first = block * SCRAMBLE_BLOCK;
+    uint64_t n = r->count - first < SCRAMBLE_BLOCK ? r->count - first : SCRAMBLE_BLOCK;
+    Rng rng;
+    scramble_block_seed(&rng, r->seed, block);
+    std::vector<char> &text = r->text[b];
+    text.resize(n * SCRAMBLE_LINE_MAX);
+    size_t len = 0;
+    for (uint64_t i = 0; i < n; i++) {
+      int moves[SOLVER_MAX_DEPTH];
+      int k = random_scramble(&rng, moves, NULL);
+      if (k < 0) {
+        // Only a damaged table gets here; an empty line would pass for
+        // a scramble of the solved cube.
+        static const char error[] = "error: no solution";
+        memcpy(&text[len], error, sizeof(error) - 1);
+        len += sizeof(error) - 1;
+        r->failures++;
+      } else {
+        len += format_moves(moves, k, &text[len], SCRAMBLE_LINE_MAX);
+      }
+      text[len++] = '\n';
+    }
+    text.resize(len);
+  }
+}
+
+// --scramble [count] [seed] [threads]: writes count (default one million)
+// scrambles of uniformly random states to stdout, one per line in the
+// notation --batch reads. The same seed always gives the same lines. A
+// scramble that cannot be made gets an error line in its place and the
+// exit status is 2, as with --batch.
+static int scramble_main(int argc, char *argv[])
+{
+  uint64_t count = argc > 2 ? strtoull(argv[2], NULL, 10) : 1000000;
+  uint64_t seed = argc > 3 ? strtoull(argv[3], NULL, 10) : SCRAMBLE_DEFAULT_SEED;
+  int threads = argc > 4 ? atoi(argv[4]) : (int)std::thread::hardware_concurrency();
+  if (threads < 1)
+    threads = 1;
+
+  tables_init(TABLE_FILE_NAME);
+
+  auto start = std::chrono::steady_clock::now();
+  uint64_t blocks = (count + SCRAMBLE_BLOCK - 1) / SCRAMBLE_BLOCK;
+  // A few blocks per thread at a time, written out in order after each round.
+  uint64_t round_blocks = (uint64_t)threads * 4;
+  uint64_t failures = 0;
+  for (uint64_t first = 0; first < blocks; first += round_blocks) {
+    Scramble_round r;
+    r.seed = seed;
+    r.first_block = first;
+    r.count = count;
+    r.next = 0;
+    r.failures = 0;
+    r.text.resize(blocks - first < round_blocks ? blocks - first : round_blocks);
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads; t++)
+      workers.push_back(std::thread(scramble_worker, &r));
+    scramble_worker(&r);
+    for (auto &w : workers)
+      w.join();
+    for (auto &text : r.text)
+      fwrite(text.data(), 1, text.size(), stdout);
+    failures += r.failures;
+  }
+  fflush(stdout);
+  double ms = elapsed_ms(start);
+  fprintf(stderr, "%llu scrambles on %d threads, %llu errors, %.1f ms, %.0f per second\n",
+          (unsigned long long)count, threads, (unsigned long long)failures, ms, ms > 0 ? count * 1000.0 / ms : 0.0);
+  return failures ? 2 : 0;
+}
@@ -0,0 +1,715 @@
+#pragma once
+
+// Headless software rendering of cube states.
+//
+// soft_render() draws Cubie_draw lists into an RGBA image in memory,
+// with no window, GL context or GPU. It runs the lighting of the GL
+// shader per vertex (scene.h) and clips against the near plane. It then
+// bins the triangles into screen tiles and fills the tiles, in parallel
+// if asked, with perspective correct Gouraud shading and a GL_LESS depth
+// test, sampling at pixel centres with the top-left fill rule. The edge
+// functions run eight pixels at a time with AVX2 where the CPU has it.
+// Images go to PNG or raw RGBA files. An Image and a Soft_renderer belong
+// to one thread at a time, so any number of frames render at once.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cpu_features.h"
+#include "notation.h"
+#include "scene.h"
+#include "thread_pool.h"
+
+// Camera of the --render tool: the cube turned to show F, R and U.
+#define RENDER_ANGLE_X 30.0f
+#define RENDER_ANGLE_Y -45.0f
+#define RENDER_DEFAULT_SIZE 600
+#define RENDER_MAX_SIZE 8192
+#define RENDER_DEFAULT_PATTERN "frame_%06d.png"
+// Side of a screen tile in pixels.
+#define SOFT_TILE 64
+
+// The fills must round like each other, so the compiler may not fuse a
+// multiply and an add into an FMA, which rounds once instead of twice, in
+// either of them. GCC takes a function attribute; Clang takes the standard
+// pragma at the top of the function body, and MSVC does not fuse by default.
+#if defined(__GNUC__) && !defined(__clang__)
+#define SOFT_NO_CONTRACT __attribute__((optimize("fp-contract=off")))
+#else
+#define SOFT_NO_CONTRACT
+#endif
+
+struct Image {
+  int width, height;
+  // Rows from the top, four bytes a pixel.
+  uint8_t *rgba;
+  float *depth;
+};
+
+static void image_alloc(Image *im, int width, int height)
+{
+  im->width = width;
+  im->height = height;
+  im->rgba = new uint8_t[(size_t)width * height * 4];
+  im->depth = new float[(size_t)width * height];
+}
+
+static void image_free(Image *im)
+{
+  delete[] im->rgba;
+  delete[] im->depth;
+  im->rgba = NULL;
+  im->depth = NULL;
+}
+
+// Float colour to a byte, as GL does for an 8 bit colour buffer.
+static inline uint8_t unorm8(float c)
+{
+  c = c < 0 ? 0 : c > 1 ? 1 : c;
+  return (uint8_t)(c * 255.0f + 0.5f);
+}
+
+// A vertex after the vertex shader: clip position and lit colour.
+struct Soft_vertex {
+  float clip[4];
+  float shade[3];
+};
+
+// The vertex shader of renderer.h, on the CPU.
+static Soft_vertex soft_shade_vertex(const Cubie_draw &inst, const Cubie_vertex &v)
+{
+  const float *t = inst.transform.e, *nm = inst.normal;
+  Soft_vertex out;
+  for (int r = 0; r < 4; r++)
+    out.clip[r] = t[r] * v.position[0] + t[4 + r] * v.position[1] + t[8 + r] * v.position[2] + t[12 + r];
+  float n[3], l[3];
+  for (int r = 0; r < 3; r++) {
+    n[r] = nm[r] * v.normal[0] + nm[3 + r] * v.normal[1] + nm[6 + r] * v.normal[2];
+    l[r] = light_position[r] / light_position[3] - out.clip[r];
+  }
+  float len = sqrtf(l[0] * l[0] + l[1] * l[1] + l[2] * l[2]);
+  float diffuse = len > 0 ? (n[0] * l[0] + n[1] * l[1] + n[2] * l[2]) / len : 0;
+  if (diffuse < 0)
+    diffuse = 0;
+  const Vector3 *c3 = inst.color;
+  float base[3] = {
+    v.face[0] * c3[0].x + v.face[1] * c3[1].x + v.face[2] * c3[2].x,
+    v.face[0] * c3[0].y + v.face[1] * c3[1].y + v.face[2] * c3[2].y,
+    v.face[0] * c3[0].z + v.face[1] * c3[1].z + v.face[2] * c3[2].z,
+  };
+  for (int r = 0; r < 3; r++)
+    out.shade[r] = base[r] * (scene_ambient[r] + light_ambient[r] + light_diffuse[r] * diffuse);
+  return out;
+}
+
+// A vertex in window coordinates: pixels from the top left, depth in
+// 0..1, and 1/w with the colour over w for perspective correct shading.
+struct Soft_screen_vertex {
+  float x, y, z;
+  float inv_w;
+  float shade_w[3];
+};
+
+static Soft_screen_vertex soft_to_screen(const Soft_vertex &v, int width, int height)
+{
+  Soft_screen_vertex s;
+  s.inv_w = 1.0f / v.clip[3];
+  s.x = (v.clip[0] * s.inv_w * 0.5f + 0.5f) * width;
+  s.y = (0.5f - v.clip[1] * s.inv_w * 0.5f) * height;
+  s.z = v.clip[2] * s.inv_w * 0.5f + 0.5f;
+  for (int i = 0; i < 3; i++)
+    s.shade_w[i] = v.shade[i] * s.inv_w;
+  return s;
+}
+
+// Edge a -> b owns the pixels exactly on it if it is a top or a left edge
+// of a triangle wound counter clockwise on screen (y down).
+static inline bool soft_top_left(const Soft_screen_vertex &a, const Soft_screen_vertex &b)
+{
+  return (a.y == b.y && b.x < a.x) || b.y > a.y;
+}
+
+// A screen triangle set up for filling: wound counter clockwise, with the
+// pixels it may cover.
+struct Soft_triangle {
+  Soft_screen_vertex v[3];
+  // Whether the edge opposite each vertex owns the pixels exactly on it.
+  bool owns[3];
+  float inv_area;
+  int x0, y0, x1, y1;
+};
+
+// False if the triangle covers no pixel centre of a width by height image.
+static bool soft_setup_triangle(Soft_triangle *t, Soft_screen_vertex a, Soft_screen_vertex b, Soft_screen_vertex c,
+                                int width, int height)
+{
+  float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+  if (area == 0)
+    return false;
+  // Both windings are drawn, as GL_CULL_FACE was never on; turn clockwise
+  // ones around so the fill rule sees one winding.
+  if (area < 0) {
+    Soft_screen_vertex s = b;
+    b = c;
+    c = s;
+    area = -area;
+  }
+  t->x0 = (int)floorf(fminf(a.x, fminf(b.x, c.x)));
+  t->x1 = (int)ceilf(fmaxf(a.x, fmaxf(b.x, c.x)));
+  t->y0 = (int)floorf(fminf(a.y, fminf(b.y, c.y)));
+  t->y1 = (int)ceilf(fmaxf(a.y, fmaxf(b.y, c.y)));
+  t->x0 = t->x0 < 0 ? 0 : t->x0;
+  t->y0 = t->y0 < 0 ? 0 : t->y0;
+  t->x1 = t->x1 > width ? width : t->x1;
+  t->y1 = t->y1 > height ? height : t->y1;
+  if (t->x0 >= t->x1 || t->y0 >= t->y1)
+    return false;
+  t->v[0] = a;
+  t->v[1] = b;
+  t->v[2] = c;
+  for (int e = 0; e < 3; e++)
+    t->owns[e] = soft_top_left(t->v[(e + 1) % 3], t->v[(e + 2) % 3]);
+  t->inv_area = 1.0f / area;
+  return true;
+}
+
+// Fills the part of t inside the rectangle x0..x1, y0..y1 (exclusive).
+SOFT_NO_CONTRACT
+static void soft_fill_scalar(Image *im, const Soft_triangle &t, int x0, int y0, int x1, int y1)
+{
+#ifdef __clang__
+#pragma STDC FP_CONTRACT OFF
+#endif
+  x0 = x0 > t.x0 ? x0 : t.x0;
+  y0 = y0 > t.y0 ? y0 : t.y0;
+  x1 = x1 < t.x1 ? x1 : t.x1;
+  y1 = y1 < t.y1 ? y1 : t.y1;
+  const Soft_screen_vertex &a = t.v[0], &b = t.v[1], &c = t.v[2];
+  for (int y = y0; y < y1; y++) {
+    float py = y + 0.5f;
+    for (int x = x0; x < x1; x++) {
+      float px = x + 0.5f;
+      // w[e] is the edge function of the edge opposite vertex e.
+      float w[3];
+      bool inside = true;
+      for (int e = 0; e < 3 && inside; e++) {
+        const Soft_screen_vertex &p = t.v[(e + 1) % 3], &q = t.v[(e + 2) % 3];
+        w[e] = (q.x - p.x) * (py - p.y) - (q.y - p.y) * (px - p.x);
+        inside = w[e] > 0 || (w[e] == 0 && t.owns[e]);
+      }
+      if (!inside)
+        continue;
+      float l0 = w[0] * t.inv_area, l1 = w[1] * t.inv_area, l2 = w[2] * t.inv_area;
+      float z = l0 * a.z + l1 * b.z + l2 * c.z;
+      float *depth = im->depth + (size_t)y * im->width + x;
+      if (!(z < *depth))
+        continue;
+      *depth = z;
+      float inv_w = l0 * a.inv_w + l1 * b.inv_w + l2 * c.inv_w;
+      uint8_t *px_out = im->rgba + ((size_t)y * im->width + x) * 4;
+      for (int i = 0; i < 3; i++)
+        px_out[i] = unorm8((l0 * a.shade_w[i] + l1 * b.shade_w[i] + l2 * c.shade_w[i]) / inv_w);
+      px_out[3] = 255;
+    }
+  }
+}
+
+#ifdef CPU_X86
+// soft_fill_scalar eight pixels of a row at a time, doing the same float
+// operations in the same order so the pictures are identical. Masked loads
+// and stores keep the lanes past the right edge out of the next row.
+CPU_TARGET("avx2") SOFT_NO_CONTRACT
+static void soft_fill_avx2(Image *im, const Soft_triangle &t, int x0, int y0, int x1, int y1)
+{
+#ifdef __clang__
+#pragma STDC FP_CONTRACT OFF
+#endif
+  x0 = x0 > t.x0 ? x0 : t.x0;
+  y0 = y0 > t.y0 ? y0 : t.y0;
+  x1 = x1 < t.x1 ? x1 : t.x1;
+  y1 = y1 < t.y1 ? y1 : t.y1;
+  const Soft_screen_vertex *v = t.v;
+  const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+  const __m256 lane_centre = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+  const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  __m256 edge_dy[3], edge_x[3], owns[3];
+  float edge_dx[3], edge_y[3];
+  for (int e = 0; e < 3; e++) {
+    const Soft_screen_vertex &p = v[(e + 1) % 3], &q = v[(e + 2) % 3];
+    edge_dx[e] = q.x - p.x;
+    edge_y[e] = p.y;
+    edge_dy[e] = _mm256_set1_ps(q.y - p.y);
+    edge_x[e] = _mm256_set1_ps(p.x);
+    owns[e] = _mm256_castsi256_ps(_mm256_set1_epi32(t.owns[e] ? -1 : 0));
+  }
+  const __m256 inv_area = _mm256_set1_ps(t.inv_area);
+  __m256 z[3], inv_w[3], shade[3][3];
+  for (int k = 0; k < 3; k++) {
+    z[k] = _mm256_set1_ps(v[k].z);
+    inv_w[k] = _mm256_set1_ps(v[k].inv_w);
+    for (int i = 0; i < 3; i++)
+      shade[k][i] = _mm256_set1_ps(v[k].shade_w[i]);
+  }
+  const __m256i end = _mm256_set1_epi32(x1);
+  for (int y = y0; y < y1; y++) {
+    float py = y + 0.5f;
+    __m256 row[3];
+    for (int e = 0; e < 3; e++)
+      row[e] = _mm256_set1_ps(edge_dx[e] * (py - edge_y[e]));
+    float *depth_row = im->depth + (size_t)y * im->width;
+    int *rgba_row = (int *)(im->rgba + (size_t)y * im->width * 4);
+    for (int x = x0; x < x1; x += 8) {
+      __m256 px = _mm256_add_ps(_mm256_set1_ps((float)x), lane_centre);
+      __m256 mask = _mm256_castsi256_ps(_mm256_cmpgt_epi32(end, _mm256_add_epi32(_mm256_set1_epi32(x), lane)));
+      __m256 w[3];
+      for (int e = 0; e < 3; e++) {
+        w[e] = _mm256_sub_ps(row[e], _mm256_mul_ps(edge_dy[e], _mm256_sub_ps(px, edge_x[e])));
+        __m256 in = _mm256_or_ps(_mm256_cmp_ps(w[e], zero, _CMP_GT_OQ),
+                                 _mm256_and_ps(_mm256_cmp_ps(w[e], zero, _CMP_EQ_OQ), owns[e]));
+        mask = _mm256_and_ps(mask, in);
+      }
+      if (!_mm256_movemask_ps(mask))
+        continue;
+      __m256 l0 = _mm256_mul_ps(w[0], inv_area), l1 = _mm256_mul_ps(w[1], inv_area), l2 = _mm256_mul_ps(w[2], inv_area);
+      __m256 depth = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(l0, z[0]), _mm256_mul_ps(l1, z[1])), _mm256_mul_ps(l2, z[2]));
+      __m256i keep = _mm256_castps_si256(_mm256_and_ps(mask, _mm256_cmp_ps(depth, _mm256_maskload_ps(depth_row + x, _mm256_castps_si256(mask)), _CMP_LT_OQ)));
+      if (_mm256_testz_si256(keep, keep))
+        continue;
+      _mm256_maskstore_ps(depth_row + x, keep, depth);
+      __m256 iw = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(l0, inv_w[0]), _mm256_mul_ps(l1, inv_w[1])), _mm256_mul_ps(l2, inv_w[2]));
+      __m256i pixel = _mm256_set1_epi32((int)0xff000000);
+      for (int i = 0; i < 3; i++) {
+        __m256 c = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(l0, shade[0][i]), _mm256_mul_ps(l1, shade[1][i])), _mm256_mul_ps(l2, shade[2][i]));
+        c = _mm256_min_ps(_mm256_max_ps(_mm256_div_ps(c, iw), zero), one);
+        __m256i u = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(c, _mm256_set1_ps(255.0f)), _mm256_set1_ps(0.5f)));
+        pixel = _mm256_or_si256(pixel, _mm256_slli_epi32(u, 8 * i));
+      }
+      _mm256_maskstore_epi32(rgba_row + x, keep, pixel);
+    }
+  }
+}
+#endif
+
+// Draws frames as screen tiles. The triangles of a frame are set up and
+// binned into the tiles they may touch, in drawing order, and the tiles
+// are then cleared and filled on their own, in parallel when there are
+// threads. Order within a tile is kept, so depth ties resolve as in GL.
+struct Soft_renderer {
+  int threads;
+  bool avx2;
+  // Started when threads > 1; the caller waits while the tiles draw.
+  Thread_pool pool;
+  // The frame being drawn.
+  Image *image;
+  int tiles_x, tiles_y;
+  std::vector<Soft_triangle> triangles;
+  std::vector<std::vector<uint32_t>> bins;
+  std::vector<int> tile_ids;
+  std::atomic<int> tiles_left;
+  std::mutex done_lock;
+  std::condition_variable done;
+};
+
+static void soft_draw_tile(Soft_renderer *r, int tile)
+{
+  Image *im = r->image;
+  int x0 = tile % r->tiles_x * SOFT_TILE, y0 = tile / r->tiles_x * SOFT_TILE;
+  int x1 = x0 + SOFT_TILE < im->width ? x0 + SOFT_TILE : im->width;
+  int y1 = y0 + SOFT_TILE < im->height ? y0 + SOFT_TILE : im->height;
+  uint8_t px[4] = { unorm8(background_color[0]), unorm8(background_color[1]), unorm8(background_color[2]), 255 };
+  uint32_t clear;
+  memcpy(&clear, px, 4);
+  for (int y = y0; y < y1; y++) {
+    size_t row = (size_t)y * im->width;
+    std::fill((uint32_t *)im->rgba + row + x0, (uint32_t *)im->rgba + row + x1, clear);
+    std::fill(im->depth + row + x0, im->depth + row + x1, 1.0f);
+  }
+  for (uint32_t t : r->bins[tile]) {
+#ifdef CPU_X86
+    if (r->avx2) {
+      soft_fill_avx2(im, r->triangles[t], x0, y0, x1, y1);
+      continue;
+    }
+#endif
+    soft_fill_scalar(im, r->triangles[t], x0, y0, x1, y1);
+  }
+}
+
+static void soft_tile_task(void *task, int worker, void *context)
+{
+  (void)worker;
+  Soft_renderer *r = (Soft_renderer *)context;
+  soft_draw_tile(r, *(int *)task);
+  if (--r->tiles_left == 0) {
+    std::lock_guard<std::mutex> lock(r->done_lock);
+    r->done.notify_one();
+  }
+}
+
+static bool soft_render_has_avx2()
+{
+#ifdef CPU_X86
+  return cpu_has_avx2();
+#else
+  return false;
+#endif
+}
+
+// threads below 2 draw on the calling thread.
+static void soft_renderer_init(Soft_renderer *r, int threads)
+{
+  r->threads = threads < 1 ? 1 : threads;
+  r->avx2 = soft_render_has_avx2();
+  if (r->threads > 1)
+    thread_pool_start(&r->pool, r->threads, soft_tile_task, r);
+}
+
+static void soft_renderer_free(Soft_renderer *r)
+{
+  if (r->threads > 1)
+    thread_pool_stop(&r->pool);
+}
+
+// Clips a triangle against the near plane (z > -w in clip space) into at
+// most two, and sets up the ones that cover pixels.
+static void soft_add_triangle(Soft_renderer *r, const Soft_vertex tri[3])
+{
+  Soft_vertex poly[4];
+  int n = 0;
+  for (int i = 0; i < 3; i++) {
+    const Soft_vertex &p = tri[i], &q = tri[(i + 1) % 3];
+    float dp = p.clip[2] + p.clip[3], dq = q.clip[2] + q.clip[3];
+    if (dp >= 0)
+      poly[n++] = p;
+    if ((dp >= 0) != (dq >= 0)) {
+      float t = dp / (dp - dq);
+      Soft_vertex &o = poly[n++];
+      for (int k = 0; k < 4; k++)
+        o.clip[k] = p.clip[k] + t * (q.clip[k] - p.clip[k]);
+      for (int k = 0; k < 3; k++)
+        o.shade[k] = p.shade[k] + t * (q.shade[k] - p.shade[k]);
+    }
+  }
+  if (n < 3)
+    return;
+  Image *im = r->image;
+  Soft_screen_vertex s[4];
+  for (int i = 0; i < n; i++)
+    s[i] = soft_to_screen(poly[i], im->width, im->height);
+  for (int i = 1; i + 1 < n; i++) {
+    Soft_triangle t;
+    if (soft_setup_triangle(&t, s[0], s[i], s[i + 1], im->width, im->height))
+      r->triangles.push_back(t);
+  }
+}
+
+// Clears the image to the background and draws n composed cubies.
+static void soft_render(Soft_renderer *r, Image *im, const Cubie_draw *instances, int n)
+{
+  r->image = im;
+  r->triangles.clear();
+  for (int i = 0; i < n; i++) {
+    Soft_vertex v[36];
+    for (int k = 0; k < 36; k++)
+      v[k] = soft_shade_vertex(instances[i], cubie_mesh[k]);
+    for (int k = 0; k < 36; k += 3)
+      soft_add_triangle(r, v + k);
+  }
+
+  r->tiles_x = (im->width + SOFT_TILE - 1) / SOFT_TILE;
+  r->tiles_y = (im->height + SOFT_TILE - 1) / SOFT_TILE;
+  int tiles = r->tiles_x * r->tiles_y;
+  r->bins.resize(tiles);
+  for (auto &bin : r->bins)
+    bin.clear();
+  for (uint32_t i = 0; i < r->triangles.size(); i++) {
+    const Soft_triangle &t = r->triangles[i];
+    for (int ty = t.y0 / SOFT_TILE; ty <= (t.y1 - 1) / SOFT_TILE; ty++)
+      for (int tx = t.x0 / SOFT_TILE; tx <= (t.x1 - 1) / SOFT_TILE; tx++)
+        r->bins[ty * r->tiles_x + tx].push_back(i);
+  }
+
+  if (r->threads == 1) {
+    for (int tile = 0; tile < tiles; tile++)
+      soft_draw_tile(r, tile);
+    return;
+  }
+  r->tile_ids.resize(tiles);
+  r->tiles_left = tiles;
+  for (int tile = 0; tile < tiles; tile++) {
+    r->tile_ids[tile] = tile;
+    thread_pool_submit(&r->pool, &r->tile_ids[tile]);
+  }
+  std::unique_lock<std::mutex> lock(r->done_lock);
+  r->done.wait(lock, [r] { return r->tiles_left == 0; });
+}
+
+// Draws s at rest seen from view.
+static void soft_render_state(Soft_renderer *r, Image *im, Cube_state s, const Scene_view *view)
+{
+  Quat orientation[CORNER_COUNT];
+  Cubie_instance instances[CORNER_COUNT];
+  Cubie_draw draws[CORNER_COUNT];
+  state_orientations(s, orientation);
+  scene_instances(orientation, instances);
+  scene_compose(view, instances, draws, CORNER_COUNT);
+  soft_render(r, im, draws, CORNER_COUNT);
+}
+
+// Built on first use; safe to call from several threads.
+static const uint32_t *crc32_table()
+{
+  static uint32_t table[256];
+  static bool built = [] {
+    for (uint32_t n = 0; n < 256; n++) {
+      uint32_t c = n;
+      for (int k = 0; k < 8; k++)
+        c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      table[n] = c;
+    }
+    return true;
+  }();
+  (void)built;
+  return table;
+}
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *p, size_t n)
+{
+  const uint32_t *table = crc32_table();
+  for (size_t i = 0; i < n; i++)
+    crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  return crc;
+}
+
+static void put_be32(std::vector<uint8_t> &out, uint32_t v)
+{
+  for (int i = 3; i >= 0; i--)
+    out.push_back((uint8_t)(v >> (i * 8)));
+}
+
+static void png_chunk(std::vector<uint8_t> &out, const char *type, const uint8_t *data, size_t n)
+{
+  put_be32(out, (uint32_t)n);
+  size_t start = out.size();
+  out.insert(out.end(), type, type + 4);
+  out.insert(out.end(), data, data + n);
+  put_be32(out, ~crc32_update(0xffffffffu, out.data() + start, n + 4));
+}
+
+// An RGBA PNG. The image data is zlib with stored blocks, no compression:
+// a frame writes as fast as the disk takes it and any PNG reader opens it.
+static bool image_write_png(const Image *im, const char *path)
+{
+  size_t row = (size_t)im->width * 4 + 1;
+  std::vector<uint8_t> raw(row * im->height);
+  for (int y = 0; y < im->height; y++) {
+    raw[y * row] = 0;
+    memcpy(&raw[y * row + 1], im->rgba + (size_t)y * im->width * 4, row - 1);
+  }
+
+  std::vector<uint8_t> z;
+  z.push_back(0x78);
+  z.push_back(0x01);
+  for (size_t at = 0; at < raw.size() || at == 0;) {
+    size_t n = raw.size() - at < 65535 ? raw.size() - at : 65535;
+    z.push_back(at + n == raw.size() ? 1 : 0);
+    z.push_back((uint8_t)n);
+    z.push_back((uint8_t)(n >> 8));
+    z.push_back((uint8_t)~n);
+    z.push_back((uint8_t)(~n >> 8));
+    z.insert(z.end(), raw.begin() + at, raw.begin() + at + n);
+    at += n;
+    if (n == 0)
+      break;
+  }
+  uint32_t s1 = 1, s2 = 0;
+  for (uint8_t b : raw) {
+    s1 = (s1 + b) % 65521;
+    s2 = (s2 + s1) % 65521;
+  }
+  put_be32(z, s2 << 16 | s1);
+
+  static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+  std::vector<uint8_t> out(signature, signature + 8);
+  std::vector<uint8_t> header;
+  put_be32(header, im->width);
+  put_be32(header, im->height);
+  // 8 bits per channel, RGBA, deflate, adaptive filters, not interlaced.
+  static const uint8_t format[5] = { 8, 6, 0, 0, 0 };
+  header.insert(header.end(), format, format + 5);
+  png_chunk(out, "IHDR", header.data(), header.size());
+  png_chunk(out, "IDAT", z.data(), z.size());
+  png_chunk(out, "IEND", NULL, 0);
+
+  FILE *f = fopen(path, "wb");
+  if (!f)
+    return false;
+  bool ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+  return fclose(f) == 0 && ok;
+}
+
+// The pixels alone, rows from the top.
+static bool image_write_raw(const Image *im, const char *path)
+{
+  FILE *f = fopen(path, "wb");
+  if (!f)
+    return false;
+  size_t n = (size_t)im->width * im->height * 4;
+  bool ok = fwrite(im->rgba, 1, n, f) == n;
+  return fclose(f) == 0 && ok;
+}
+
+// PNG unless path ends in .raw or .rgba.
+static bool image_write(const Image *im, const char *path)
+{
+  size_t len = strlen(path);
+  if ((len > 4 && strcmp(path + len - 4, ".raw") == 0) || (len > 5 && strcmp(path + len - 5, ".rgba") == 0))
+    return image_write_raw(im, path);
+  return image_write_png(im, path);
+}
+
+// True if pattern is safe to give snprintf the frame number with: exactly
+// one %d or %i conversion, with flags, width and precision at most, and no
+// other conversion than %%.
+static bool frame_pattern_ok(const char *pattern)
+{
+  int conversions = 0;
+  for (const char *p = pattern; *p; p++) {
+    if (*p != '%')
+      continue;
+    if (*++p == '%')
+      continue;
+    p += strspn(p, "-+ #0");
+    p += strspn(p, "0123456789");
+    if (*p == '.')
+      p += 1 + strspn(p + 1, "0123456789");
+    if (*p != 'd' && *p != 'i')
+      return false;
+    conversions++;
+  }
+  return conversions == 1;
+}
+
+// Workers take lines from in one at a time, each with its frame number;
+// frames are files of their own, so they may finish in any order.
+struct Render_job {
+  FILE *in;
+  std::mutex read_lock;
+  // Lines read so far, guarded by read_lock.
+  uint64_t frames;
+  const char *pattern;
+  int size;
+  std::atomic<uint64_t> errors;
+};
+
+static void render_worker(Render_job *job)
+{
+  Image im;
+  image_alloc(&im, job->size, job->size);
+  // Whole frames in parallel, one per thread, beat the tiles of one frame
+  // in parallel when the frames are many and small.
+  Soft_renderer renderer;
+  soft_renderer_init(&renderer, 1);
+  // Kept from frame to frame, so runs of lines with one camera share it.
+  Scene_view view;
+  scene_view_init(&view);
+  char line[4096];
+  for (;;) {
+    uint64_t frame;
+    {
+      std::lock_guard<std::mutex> lock(job->read_lock);
+      if (!fgets(line, sizeof(line), job->in))
+        break;
+      frame = job->frames++;
+    }
+    Cube_state s = cube_state_solved();
+    char path[1024];
+    snprintf(path, sizeof(path), job->pattern, (int)frame);
+    // Moves, then optionally '@' and the camera angles of this frame.
+    std::string moves = line;
+    float a[3] = { RENDER_ANGLE_X, RENDER_ANGLE_Y, 0 };
+    size_t at = moves.find('@');
+    if (at != std::string::npos) {
+      if (sscanf(moves.c_str() + at + 1, "%f %f %f", &a[0], &a[1], &a[2]) < 1) {
+        fprintf(stderr, "line %llu: bad camera\n", (unsigned long long)(frame + 1));
+        job->errors++;
+        continue;
+      }
+      moves.resize(at);
+    }
+    if (!apply_move_text(&s, moves.c_str())) {
+      fprintf(stderr, "line %llu: bad move\n", (unsigned long long)(frame + 1));
+      job->errors++;
+      continue;
+    }
+    scene_view_update(&view, a[0], a[1], a[2], CAMERA_DISTANCE, 1.0f);
+    soft_render_state(&renderer, &im, s, &view);
+    if (!image_write(&im, path)) {
+      fprintf(stderr, "could not write %s\n", path);
+      job->errors++;
+    }
+  }
+  soft_renderer_free(&renderer);
+  image_free(&im);
+}
+
+// --render [input] [pattern] [size] [threads]: renders the state after
+// every line of moves in input (default or "-" is stdin) to a size by size
+// image, the file name made from pattern and the line number counted from
+// 0 (default frame_%06d.png; .raw or .rgba for raw pixels). A line may
+// end in "@ x y z", the camera angles in degrees for that frame; the
+// default camera is RENDER_ANGLE_X, RENDER_ANGLE_Y, 0. Frames render in
+// parallel on every core unless threads says otherwise.
+static int render_main(int argc, char *argv[])
+{
+  FILE *in = stdin;
+  if (argc > 2 && strcmp(argv[2], "-") != 0 && !(in = fopen(argv[2], "rb"))) {
+    fprintf(stderr, "could not open %s\n", argv[2]);
+    return 1;
+  }
+  const char *pattern = argc > 3 ? argv[3] : RENDER_DEFAULT_PATTERN;
+  int size = argc > 4 ? atoi(argv[4]) : RENDER_DEFAULT_SIZE;
+  int threads = argc > 5 ? atoi(argv[5]) : (int)std::thread::hardware_concurrency();
+  if (!frame_pattern_ok(pattern)) {
+    fprintf(stderr, "pattern must hold one %%d for the frame number and no other %% but %%%%\n");
+    return 1;
+  }
+  if (size < 1 || size > RENDER_MAX_SIZE) {
+    fprintf(stderr, "size must be 1 to %d\n", RENDER_MAX_SIZE);
+    return 1;
+  }
+  if (threads < 1)
+    threads = 1;
+  cube_state_init();
+
+  Render_job job;
+  job.in = in;
+  job.frames = 0;
+  job.pattern = pattern;
+  job.size = size;
+  job.errors = 0;
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (int t = 1; t < threads; t++)
+    workers.push_back(std::thread(render_worker, &job));
+  render_worker(&job);
+  for (auto &w : workers)
+    w.join();
+  uint64_t frames = job.frames;
+  if (in != stdin)
+    fclose(in);
+  double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  fprintf(stderr, "%llu frames of %dx%d on %d threads, %llu errors, %.1f ms, %.0f per second\n",
+          (unsigned long long)frames, size, size, threads, (unsigned long long)job.errors.load(),
+          ms, ms > 0 ? frames * 1000.0 / ms : 0.0);
+  return job.errors ? 2 : 0;
+}
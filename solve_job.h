@@ -0,0 +1,114 @@
+#pragma once
+
+// Solving without blocking the caller.
+//
+// solve_job_start() publishes a first solution at once if the caller has
+// one that works (the window passes its move history undone), then a
+// worker thread looks for shorter ones and publishes each as it is found,
+// until it has a shortest one, the deadline passes or the job is
+// cancelled. The caller polls from its own loop and only ever waits in
+// solve_job_finish(), for a worker that has been told to stop.
+
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include "distance_table.h"
+#include "solver.h"
+
+// Long enough for the move history of a long session.
+#define SOLVE_JOB_MAX_MOVES 1024
+
+struct Solve_job {
+  Cube_state start;
+  std::chrono::steady_clock::time_point deadline;
+  std::thread worker;
+  std::atomic<bool> cancel;
+  std::atomic<bool> done;
+
+  // Best solution so far, or length -1. serial counts the solutions
+  // published, so a poll can tell a new one from the one it has.
+  std::mutex lock;
+  int moves[SOLVE_JOB_MAX_MOVES];
+  int length;
+  int serial;
+};
+
+// True if moves take s to solved, up to turning the whole cube as the
+// solvers count it.
+static bool moves_solve(Cube_state s, const int *moves, int n)
+{
+  for (int i = 0; i < n; i++)
+    s = apply_move(s, moves[i]);
+  int view;
+  Reduced_state r = reduce_state(s, &view), solved = reduced_solved();
+  return r.perm == solved.perm && r.twist == solved.twist;
+}
+
+// Keeps moves if they are shorter than the best so far.
+static void solve_job_publish(Solve_job *job, const int *moves, int n)
+{
+  std::lock_guard<std::mutex> lock(job->lock);
+  if (job->length >= 0 && n >= job->length)
+    return;
+  memcpy(job->moves, moves, n * sizeof(int));
+  job->length = n;
+  job->serial++;
+}
+
+static void solve_job_run(Solve_job *job)
+{
+  // A shortest solution, from the distance table in microseconds or by
+  // IDA* in milliseconds without one, so nothing comes after it.
+  int moves[SOLVER_MAX_DEPTH];
+  if (!job->cancel && std::chrono::steady_clock::now() < job->deadline) {
+    int n = table_solve(job->start, moves, SOLVER_MAX_DEPTH);
+    if (n >= 0)
+      solve_job_publish(job, moves, n);
+  }
+  job->done = true;
+}
+
+// Starts solving s. first (n moves, may be NULL) is published right away
+// if it solves s. The job must be finished before it is started again.
+static void solve_job_start(Solve_job *job, Cube_state s, const int *first, int n, double budget_ms)
+{
+  job->start = s;
+  job->deadline = std::chrono::steady_clock::now() + std::chrono::microseconds((int64_t)(budget_ms * 1000));
+  job->cancel = false;
+  job->done = false;
+  job->length = -1;
+  job->serial = 0;
+  if (first && n >= 0 && n <= SOLVE_JOB_MAX_MOVES && moves_solve(s, first, n))
+    solve_job_publish(job, first, n);
+  job->worker = std::thread(solve_job_run, job);
+}
+
+// Copies the best solution into moves and returns its length if it is
+// newer than the one numbered *serial, which is updated; -1 otherwise.
+static int solve_job_poll(Solve_job *job, int *serial, int *moves)
+{
+  std::lock_guard<std::mutex> lock(job->lock);
+  if (job->serial == *serial || job->length < 0)
+    return -1;
+  *serial = job->serial;
+  memcpy(moves, job->moves, job->length * sizeof(int));
+  return job->length;
+}
+
+// True once nothing better will come: the worker is done or the deadline
+// has passed.
+static bool solve_job_settled(const Solve_job *job)
+{
+  return job->done || std::chrono::steady_clock::now() >= job->deadline;
+}
+
+// Stops the worker and waits for it. The best solution can still be
+// polled afterwards.
+static void solve_job_finish(Solve_job *job)
+{
+  job->cancel = true;
+  if (job->worker.joinable())
+    job->worker.join();
+}
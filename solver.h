@@ -0,0 +1,263 @@
+#pragma once
+
+// Optimal 2x2x2 solver.
+//
+// Whole cube rotations do not change what a 2x2x2 looks like, so states are
+// first turned until the D-L-B cubie sits home untwisted. The remaining
+// 7! * 3^6 = 3674160 positions are searched with F, R and U quarter turns
+// only (the three faces that never touch that corner), using IDA* with
+// separate permutation and twist pruning tables. Every quarter turn changes
+// the permutation parity, so the estimate is also raised to the parity of
+// the distance, and a bit set of the positions within SOLVER_NEAR_DEPTH
+// moves of solved lifts it past that depth for all the others; most of the
+// search tree lies there. The answer is mapped back to the faces the
+// player actually sees.
+
+#include <string.h>
+#include "cube_state.h"
+
+#define FIXED_CORNER 5
+#define REDUCED_PERM_COUNT 5040
+#define REDUCED_TWIST_COUNT 729
+#define REDUCED_STATE_COUNT (REDUCED_PERM_COUNT * REDUCED_TWIST_COUNT)
+#define REDUCED_MOVE_COUNT 6
+// God's number for the 2x2x2 in the quarter turn metric.
+#define SOLVER_MAX_DEPTH 14
+// Positions at most this far from solved are marked in near_solved, about
+// 4% of them; deeper marks cost more build time than they save.
+#define SOLVER_NEAR_DEPTH 8
+#define SOLVER_NEAR_WORDS ((REDUCED_STATE_COUNT + 63) / 64)
+
+// Reduced move i turns the same layer as reduced_moves[i].
+static const int reduced_moves[REDUCED_MOVE_COUNT] = {
+  MOVE_FR, MOVE_FL, MOVE_RR, MOVE_RL, MOVE_UR, MOVE_UL,
+};
+
+// Like the move tables in cube_state.h these point either at the storage
+// filled by solver_init() or into a mapped table file.
+static uint16_t reduced_perm_storage[REDUCED_PERM_COUNT][REDUCED_MOVE_COUNT];
+static uint16_t reduced_twist_storage[REDUCED_TWIST_COUNT][REDUCED_MOVE_COUNT];
+static uint8_t perm_prune_storage[REDUCED_PERM_COUNT];
+static uint8_t twist_prune_storage[REDUCED_TWIST_COUNT];
+static uint64_t near_solved_storage[SOLVER_NEAR_WORDS];
+static const uint16_t (*reduced_perm_move)[REDUCED_MOVE_COUNT] = reduced_perm_storage;
+static const uint16_t (*reduced_twist_move)[REDUCED_MOVE_COUNT] = reduced_twist_storage;
+static const uint8_t *perm_prune = perm_prune_storage;
+static const uint8_t *twist_prune = twist_prune_storage;
+static const uint64_t *near_solved = near_solved_storage;
+static bool solver_initialized = false;
+
+// A reduced position split into its two coordinates.
+struct Reduced_state {
+  uint16_t perm;
+  uint16_t twist;
+};
+
+// Slots other than the fixed one, in coordinate order.
+static const uint8_t reduced_slots[CORNER_COUNT - 1] = { 0, 1, 2, 3, 4, 6, 7 };
+
+static int reduced_index(Reduced_state r)
+{
+  return r.perm * REDUCED_TWIST_COUNT + r.twist;
+}
+
+// Only valid for cubies whose fixed corner is already home and untwisted.
+static Reduced_state reduced_from_cubies(const Corner_cubies &c)
+{
+  uint8_t p[CORNER_COUNT - 1];
+  int twist = 0;
+  for (int i = 0; i < CORNER_COUNT - 1; i++) {
+    int cubie = c.cp[reduced_slots[i]];
+    p[i] = cubie > FIXED_CORNER ? cubie - 1 : cubie;
+    if (i < CORNER_COUNT - 2)
+      twist = twist * 3 + c.co[reduced_slots[i]];
+  }
+  Reduced_state r;
+  r.perm = perm_rank(p, CORNER_COUNT - 1);
+  r.twist = twist;
+  return r;
+}
+
+static Corner_cubies reduced_to_cubies(Reduced_state r)
+{
+  Corner_cubies c;
+  uint8_t p[CORNER_COUNT - 1];
+  perm_unrank(r.perm, p, CORNER_COUNT - 1);
+  int twist = r.twist, sum = 0;
+  for (int i = CORNER_COUNT - 2; i >= 0; i--) {
+    int s = reduced_slots[i];
+    c.cp[s] = p[i] >= FIXED_CORNER ? p[i] + 1 : p[i];
+    if (i == CORNER_COUNT - 2) {
+      c.co[s] = 0;
+      continue;
+    }
+    c.co[s] = twist % 3;
+    sum += c.co[s];
+    twist /= 3;
+  }
+  c.co[reduced_slots[CORNER_COUNT - 2]] = (3 - sum % 3) % 3;
+  c.cp[FIXED_CORNER] = FIXED_CORNER;
+  c.co[FIXED_CORNER] = 0;
+  return c;
+}
+
+static Reduced_state reduced_solved()
+{
+  return reduced_from_cubies(corner_cubies_solved());
+}
+
+static inline Reduced_state apply_reduced_move(Reduced_state r, int move)
+{
+  Reduced_state o;
+  o.perm = reduced_perm_move[r.perm][move];
+  o.twist = reduced_twist_move[r.twist][move];
+  return o;
+}
+
+// Turns the whole cube so the fixed corner is home. view is set to the
+// rotation that undoes this, which maps reduced faces back onto the faces
+// of s.
+static Reduced_state reduce_state(Cube_state s, int *view)
+{
+  Corner_cubies c = cube_state_to_cubies(s);
+  int slot = 0;
+  while (c.cp[slot] != FIXED_CORNER)
+    slot++;
+  int r = rotation_of[FIXED_CORNER][slot][c.co[slot]];
+  Ivec3 whole = { 0, 0, 0 };
+  c = corner_cubies_turn(c, rotation_inverse[r], whole);
+  if (view)
+    *view = r;
+  return reduced_from_cubies(c);
+}
+
+// Move on s that does what reduced move m does on the reduced state.
+static int unreduce_move(int m, int view)
+{
+  int move = reduced_moves[m];
+  Ivec3 n = rotate_ivec3(rotations[view], face_normal[move >> 1]);
+  int face = 0;
+  while (ivec3_dot(face_normal[face], n) <= 0)
+    face++;
+  return face * 2 + (move & 1);
+}
+
+// Skips sequences that always have a shorter or equal twin: a move followed
+// by its inverse, three equal quarter turns, and a double anti-clockwise turn
+// (the same as the double clockwise one).
+static inline bool redundant_move(int m, int prev, int prev2)
+{
+  if (prev < 0 || (m >> 1) != (prev >> 1))
+    return false;
+  return m != prev || (m & 1) || m == prev2;
+}
+
+static void build_prune_table(uint8_t *table, int count, const uint16_t (*moves)[REDUCED_MOVE_COUNT], int solved)
+{
+  memset(table, 0xff, count);
+  table[solved] = 0;
+  int done = 1;
+  for (int depth = 0; done < count; depth++) {
+    for (int i = 0; i < count; i++) {
+      if (table[i] != depth)
+        continue;
+      for (int m = 0; m < REDUCED_MOVE_COUNT; m++) {
+        int j = moves[i][m];
+        if (table[j] == 0xff) {
+          table[j] = depth + 1;
+          done++;
+        }
+      }
+    }
+  }
+}
+
+// Marks every position within togo moves of r in near_solved_storage.
+static void mark_near_solved(Reduced_state r, int togo, int prev, int prev2)
+{
+  int i = reduced_index(r);
+  near_solved_storage[i >> 6] |= 1ull << (i & 63);
+  if (togo == 0)
+    return;
+  for (int m = 0; m < REDUCED_MOVE_COUNT; m++)
+    if (!redundant_move(m, prev, prev2))
+      mark_near_solved(apply_reduced_move(r, m), togo - 1, m, prev);
+}
+
+static void solver_init()
+{
+  if (solver_initialized)
+    return;
+  solver_initialized = true;
+
+  cube_state_init();
+
+  Reduced_state r = { 0, 0 };
+  for (int p = 0; p < REDUCED_PERM_COUNT; p++) {
+    r.perm = p;
+    Corner_cubies c = reduced_to_cubies(r);
+    for (int m = 0; m < REDUCED_MOVE_COUNT; m++)
+      reduced_perm_storage[p][m] = reduced_from_cubies(corner_cubies_move(c, reduced_moves[m])).perm;
+  }
+  r.perm = 0;
+  for (int t = 0; t < REDUCED_TWIST_COUNT; t++) {
+    r.twist = t;
+    Corner_cubies c = reduced_to_cubies(r);
+    for (int m = 0; m < REDUCED_MOVE_COUNT; m++)
+      reduced_twist_storage[t][m] = reduced_from_cubies(corner_cubies_move(c, reduced_moves[m])).twist;
+  }
+
+  Reduced_state solved = reduced_solved();
+  build_prune_table(perm_prune_storage, REDUCED_PERM_COUNT, reduced_perm_move, solved.perm);
+  build_prune_table(twist_prune_storage, REDUCED_TWIST_COUNT, reduced_twist_move, solved.twist);
+  memset(near_solved_storage, 0, sizeof(near_solved_storage));
+  mark_near_solved(solved, SOLVER_NEAR_DEPTH, -1, -1);
+}
+
+static inline int solver_estimate(Reduced_state r)
+{
+  int p = perm_prune[r.perm], t = twist_prune[r.twist];
+  int h = p > t ? p : t;
+  // The distance has the parity of p.
+  h += (h ^ p) & 1;
+  if (h <= SOLVER_NEAR_DEPTH) {
+    int i = reduced_index(r);
+    if (!(near_solved[i >> 6] >> (i & 63) & 1))
+      h = SOLVER_NEAR_DEPTH + 1 + (((SOLVER_NEAR_DEPTH + 1) ^ p) & 1);
+  }
+  return h;
+}
+
+static bool solver_search(Reduced_state r, int depth, int bound, int prev, int prev2, int *path)
+{
+  int h = solver_estimate(r);
+  if (h == 0)
+    return depth == bound;
+  if (depth + h > bound)
+    return false;
+  for (int m = 0; m < REDUCED_MOVE_COUNT; m++) {
+    if (redundant_move(m, prev, prev2))
+      continue;
+    path[depth] = m;
+    if (solver_search(apply_reduced_move(r, m), depth + 1, bound, m, prev, path))
+      return true;
+  }
+  return false;
+}
+
+// Writes a shortest quarter turn solution for s to moves and returns its
+// length, or -1 if it would not fit in max_moves.
+static int solve(Cube_state s, int *moves, int max_moves)
+{
+  int view;
+  Reduced_state r = reduce_state(s, &view);
+  int path[SOLVER_MAX_DEPTH];
+  for (int bound = solver_estimate(r); bound <= SOLVER_MAX_DEPTH && bound <= max_moves; bound++) {
+    if (!solver_search(r, 0, bound, -1, -1, path))
+      continue;
+    for (int i = 0; i < bound; i++)
+      moves[i] = unreduce_move(path[i], view);
+    return bound;
+  }
+  return -1;
+}
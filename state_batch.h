@@ -0,0 +1,253 @@
+#pragma once
+
+// Many cube states at once, as structure of arrays.
+//
+// A State_batch keeps the perm and twist coordinates of its states in two
+// arrays. Turning every state is then two table lookups per state in a
+// tight loop with no dependency from one state to the next. The move
+// tables here are stored move first, so one move over the whole batch
+// reads one 80 KB row that stays in cache. With AVX2 eight states go
+// through each step at a time, the lookups done with gathers.
+//
+// The batched heuristic is a lower bound on the quarter turns to solved up
+// to turning the whole cube, from each coordinate on its own, and solved
+// also means up to turning the whole cube: that is what a search or a
+// playout wants to know.
+
+#include <stdint.h>
+#include <string.h>
+#include "cpu_features.h"
+#include "cube_state.h"
+
+struct State_batch {
+  int count;
+  uint16_t *perm;
+  uint16_t *twist;
+};
+
+// [move * CORNER_PERM_COUNT + perm] and [move * CORNER_TWIST_COUNT + twist].
+// Every table has a spare entry or three at the end, so a 32 bit gather of
+// the last one stays inside.
+static uint16_t *batch_perm_move;
+static uint16_t *batch_twist_move;
+static uint8_t *batch_perm_prune;
+static uint8_t *batch_twist_prune;
+// For the perm of a rotation of the solved cube, the twist that goes with
+// it; 0xffff for all other perms.
+static uint16_t *batch_solved_twist;
+static bool state_batch_avx2 = false;
+static bool state_batch_initialized = false;
+
+static void state_batch_alloc(State_batch *b, int count)
+{
+  b->count = count;
+  b->perm = new uint16_t[count];
+  b->twist = new uint16_t[count];
+}
+
+static void state_batch_free(State_batch *b)
+{
+  delete[] b->perm;
+  delete[] b->twist;
+  b->perm = b->twist = NULL;
+  b->count = 0;
+}
+
+static void state_batch_set(State_batch *b, int i, Cube_state s)
+{
+  b->perm[i] = s.perm;
+  b->twist[i] = s.twist;
+}
+
+// Breadth first distances from any of the starts, one coordinate alone.
+static void build_batch_prune(uint8_t *table, int count, const uint16_t *moves, const uint16_t *starts, int start_count)
+{
+  memset(table, 0xff, count);
+  int done = 0;
+  for (int i = 0; i < start_count; i++) {
+    done += table[starts[i]] == 0xff;
+    table[starts[i]] = 0;
+  }
+  for (int depth = 0; done < count; depth++) {
+    for (int i = 0; i < count; i++) {
+      if (table[i] != depth)
+        continue;
+      for (int m = 0; m < MOVE_COUNT; m++) {
+        int j = moves[m * count + i];
+        if (table[j] == 0xff) {
+          table[j] = depth + 1;
+          done++;
+        }
+      }
+    }
+  }
+}
+
+static void state_batch_init()
+{
+  if (state_batch_initialized)
+    return;
+  state_batch_initialized = true;
+  cube_state_init();
+
+  batch_perm_move = new uint16_t[MOVE_COUNT * CORNER_PERM_COUNT + 1]();
+  batch_twist_move = new uint16_t[MOVE_COUNT * CORNER_TWIST_COUNT + 1]();
+  for (int m = 0; m < MOVE_COUNT; m++) {
+    for (int p = 0; p < CORNER_PERM_COUNT; p++)
+      batch_perm_move[m * CORNER_PERM_COUNT + p] = perm_move_table[p][m];
+    for (int t = 0; t < CORNER_TWIST_COUNT; t++)
+      batch_twist_move[m * CORNER_TWIST_COUNT + t] = twist_move_table[t][m];
+  }
+
+  uint16_t perms[ROTATION_COUNT], twists[ROTATION_COUNT];
+  batch_solved_twist = new uint16_t[CORNER_PERM_COUNT + 1];
+  memset(batch_solved_twist, 0xff, (CORNER_PERM_COUNT + 1) * sizeof(uint16_t));
+  Ivec3 whole = { 0, 0, 0 };
+  for (int r = 0; r < ROTATION_COUNT; r++) {
+    Cube_state s = cube_state_from_cubies(corner_cubies_turn(corner_cubies_solved(), r, whole));
+    perms[r] = s.perm;
+    twists[r] = s.twist;
+    batch_solved_twist[s.perm] = s.twist;
+  }
+  batch_perm_prune = new uint8_t[CORNER_PERM_COUNT + 3]();
+  batch_twist_prune = new uint8_t[CORNER_TWIST_COUNT + 3]();
+  build_batch_prune(batch_perm_prune, CORNER_PERM_COUNT, batch_perm_move, perms, ROTATION_COUNT);
+  build_batch_prune(batch_twist_prune, CORNER_TWIST_COUNT, batch_twist_move, twists, ROTATION_COUNT);
+
+#ifdef CPU_X86
+  state_batch_avx2 = cpu_has_avx2();
+#endif
+}
+
+#ifdef CPU_X86
+// Eight 16 bit entries of table at the eight 32 bit indices.
+CPU_TARGET("avx2")
+static inline __m256i gather_u16(const uint16_t *table, __m256i index)
+{
+  __m256i v = _mm256_i32gather_epi32((const int *)table, index, 2);
+  return _mm256_and_si256(v, _mm256_set1_epi32(0xffff));
+}
+
+CPU_TARGET("avx2")
+static inline __m256i gather_u8(const uint8_t *table, __m256i index)
+{
+  __m256i v = _mm256_i32gather_epi32((const int *)table, index, 1);
+  return _mm256_and_si256(v, _mm256_set1_epi32(0xff));
+}
+
+// Eight 32 bit lanes holding 16 bit values back to eight 16 bit values.
+CPU_TARGET("avx2")
+static inline __m128i pack_u16(__m256i v)
+{
+  return _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+}
+
+CPU_TARGET("avx2")
+static inline __m256i load_u16(const uint16_t *p)
+{
+  return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)p));
+}
+
+// Moves from per state move ids, or all the same move when moves is NULL.
+CPU_TARGET("avx2")
+static int apply_moves_avx2(State_batch *b, int move, const uint8_t *moves)
+{
+  int n = b->count & ~7;
+  __m256i perm_offset = _mm256_set1_epi32(move * CORNER_PERM_COUNT);
+  __m256i twist_offset = _mm256_set1_epi32(move * CORNER_TWIST_COUNT);
+  for (int i = 0; i < n; i += 8) {
+    if (moves) {
+      __m256i m = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(moves + i)));
+      perm_offset = _mm256_mullo_epi32(m, _mm256_set1_epi32(CORNER_PERM_COUNT));
+      twist_offset = _mm256_mullo_epi32(m, _mm256_set1_epi32(CORNER_TWIST_COUNT));
+    }
+    __m256i p = gather_u16(batch_perm_move, _mm256_add_epi32(load_u16(b->perm + i), perm_offset));
+    __m256i t = gather_u16(batch_twist_move, _mm256_add_epi32(load_u16(b->twist + i), twist_offset));
+    _mm_storeu_si128((__m128i *)(b->perm + i), pack_u16(p));
+    _mm_storeu_si128((__m128i *)(b->twist + i), pack_u16(t));
+  }
+  return n;
+}
+
+CPU_TARGET("avx2")
+static int estimate_avx2(const State_batch *b, uint8_t *out)
+{
+  int n = b->count & ~7;
+  for (int i = 0; i < n; i += 8) {
+    __m256i p = gather_u8(batch_perm_prune, load_u16(b->perm + i));
+    __m256i t = gather_u8(batch_twist_prune, load_u16(b->twist + i));
+    __m128i e = pack_u16(_mm256_max_epi32(p, t));
+    _mm_storel_epi64((__m128i *)(out + i), _mm_packus_epi16(e, e));
+  }
+  return n;
+}
+
+CPU_TARGET("avx2")
+static int solved_avx2(const State_batch *b, uint8_t *out)
+{
+  int n = b->count & ~7;
+  for (int i = 0; i < n; i += 8) {
+    __m256i want = gather_u16(batch_solved_twist, load_u16(b->perm + i));
+    __m256i eq = _mm256_cmpeq_epi32(want, load_u16(b->twist + i));
+    __m128i e = pack_u16(_mm256_srli_epi32(eq, 31));
+    _mm_storel_epi64((__m128i *)(out + i), _mm_packus_epi16(e, e));
+  }
+  return n;
+}
+#endif
+
+// Turns every state of the batch by move.
+static void apply_move_batch(State_batch *b, int move)
+{
+  int i = 0;
+#ifdef CPU_X86
+  if (state_batch_avx2)
+    i = apply_moves_avx2(b, move, NULL);
+#endif
+  const uint16_t *pm = batch_perm_move + move * CORNER_PERM_COUNT;
+  const uint16_t *tm = batch_twist_move + move * CORNER_TWIST_COUNT;
+  for (; i < b->count; i++) {
+    b->perm[i] = pm[b->perm[i]];
+    b->twist[i] = tm[b->twist[i]];
+  }
+}
+
+// Turns state i by moves[i], as in random playouts.
+static void apply_moves_batch(State_batch *b, const uint8_t *moves)
+{
+  int i = 0;
+#ifdef CPU_X86
+  if (state_batch_avx2)
+    i = apply_moves_avx2(b, 0, moves);
+#endif
+  for (; i < b->count; i++) {
+    b->perm[i] = batch_perm_move[moves[i] * CORNER_PERM_COUNT + b->perm[i]];
+    b->twist[i] = batch_twist_move[moves[i] * CORNER_TWIST_COUNT + b->twist[i]];
+  }
+}
+
+// out[i] is a lower bound on the quarter turns state i is from solved.
+static void state_batch_estimate(const State_batch *b, uint8_t *out)
+{
+  int i = 0;
+#ifdef CPU_X86
+  if (state_batch_avx2)
+    i = estimate_avx2(b, out);
+#endif
+  for (; i < b->count; i++) {
+    int p = batch_perm_prune[b->perm[i]], t = batch_twist_prune[b->twist[i]];
+    out[i] = (uint8_t)(p > t ? p : t);
+  }
+}
+
+// out[i] is 1 if state i is solved, in any orientation.
+static void state_batch_solved(const State_batch *b, uint8_t *out)
+{
+  int i = 0;
+#ifdef CPU_X86
+  if (state_batch_avx2)
+    i = solved_avx2(b, out);
+#endif
+  for (; i < b->count; i++)
+    out[i] = batch_solved_twist[b->perm[i]] == b->twist[i];
+}
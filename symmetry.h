@@ -0,0 +1,175 @@
+#pragma once
+
+// Symmetry reduction of reduced positions.
+//
+// Conjugating a position by a symmetry of the cube, or inverting it, keeps
+// its distance to solved. Of the 48 symmetries only the six that keep the
+// fixed corner in its slot (the permutations of the x, y and z axes: two
+// turns about the corner's diagonal, three mirrors and the identity) take
+// reduced positions to reduced positions; the others move that corner, and
+// the position would have to be turned back by a rotation that depends on
+// where it went. Those six, each with and without inversion, make the
+// SYM_COUNT symmetries used here.
+//
+// They act on the permutation coordinate alone, so the permutations fall
+// into SYM_PERM_CLASS_COUNT classes. The symmetry coordinate of a position
+// is its permutation class and its twist after sym_perm_sym[perm], the
+// symmetry taking its permutation to the class representative. That twist
+// is a sum of one precomputed part per slot, so finding the coordinate
+// costs eight small table lookups.
+//
+// A representative that some symmetries leave unchanged (its stabilizer)
+// has several twists standing for the same position; tables built over the
+// coordinate fill all of them, so lookups need not pick one.
+
+#include <string.h>
+#include "solver.h"
+
+#define SYM_COUNT 12
+#define SYM_PERM_CLASS_COUNT 513
+#define SYM_STATE_COUNT (SYM_PERM_CLASS_COUNT * REDUCED_TWIST_COUNT)
+
+// The cubie in every slot for each permutation coordinate and the twist of
+// every slot for each twist coordinate, the fixed slot included.
+static uint8_t reduced_perm_cubies[REDUCED_PERM_COUNT][CORNER_COUNT];
+static uint8_t reduced_twist_slots[REDUCED_TWIST_COUNT][CORNER_COUNT];
+// Permutation coordinate after each symmetry.
+static uint16_t sym_perm_image[SYM_COUNT][REDUCED_PERM_COUNT];
+static uint16_t sym_perm_class[REDUCED_PERM_COUNT];
+// 0, the identity, for the representatives themselves.
+static uint8_t sym_perm_sym[REDUCED_PERM_COUNT];
+static uint16_t sym_class_perm[SYM_PERM_CLASS_COUNT];
+// Bit sym is set if sym leaves the representative unchanged.
+static uint16_t sym_class_stabilizer[SYM_PERM_CLASS_COUNT];
+// sym_twist_part[sym][slot][cubie][twist] is what that cubie in that slot
+// with that twist adds to the twist coordinate of the position after sym.
+static uint16_t sym_twist_part[SYM_COUNT][CORNER_COUNT][CORNER_COUNT][3];
+static bool symmetry_initialized = false;
+
+// Where symmetry sym takes the cubie in slot with twist: symmetry sym / 2
+// permutes the axes, and odd ones invert the position first. A cubie moved
+// by rotation g is moved by m g m^T in the mirrored or turned cube, which
+// is a rotation again.
+static void sym_move_cubie(int sym, int slot, int cubie, int twist, int *out_slot, int *out_cubie, int *out_twist)
+{
+  static const int axes[SYM_COUNT / 2][3] = {
+    { 0, 1, 2 }, { 1, 2, 0 }, { 2, 0, 1 }, { 1, 0, 2 }, { 0, 2, 1 }, { 2, 1, 0 },
+  };
+  if (sym & 1) {
+    int t = slot;
+    slot = cubie;
+    cubie = t;
+    twist = (3 - twist) % 3;
+  }
+  Rotation m = {{{0,0,0},{0,0,0},{0,0,0}}}, mt;
+  for (int i = 0; i < 3; i++)
+    m.m[axes[sym / 2][i]][i] = 1;
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+      mt.m[i][j] = m.m[j][i];
+  int g = find_rotation(rotation_mul(rotation_mul(m, rotations[rotation_of[cubie][slot][twist]]), mt));
+  *out_cubie = slot_at(rotate_ivec3(m, slot_position(cubie)));
+  *out_slot = rotation_slot[g][*out_cubie];
+  *out_twist = rotation_twist[g][*out_cubie];
+}
+
+static Corner_cubies sym_apply(const Corner_cubies &c, int sym)
+{
+  Corner_cubies o;
+  for (int s = 0; s < CORNER_COUNT; s++) {
+    int slot, cubie, twist;
+    sym_move_cubie(sym, s, c.cp[s], c.co[s], &slot, &cubie, &twist);
+    o.cp[slot] = cubie;
+    o.co[slot] = twist;
+  }
+  return o;
+}
+
+static void symmetry_init()
+{
+  if (symmetry_initialized)
+    return;
+  symmetry_initialized = true;
+  solver_init();
+
+  Reduced_state r = { 0, 0 };
+  for (int p = 0; p < REDUCED_PERM_COUNT; p++) {
+    r.perm = p;
+    memcpy(reduced_perm_cubies[p], reduced_to_cubies(r).cp, CORNER_COUNT);
+  }
+  r.perm = 0;
+  for (int t = 0; t < REDUCED_TWIST_COUNT; t++) {
+    r.twist = t;
+    memcpy(reduced_twist_slots[t], reduced_to_cubies(r).co, CORNER_COUNT);
+  }
+
+  // Weight of each slot's twist in the twist coordinate. The last reduced
+  // slot and the fixed one are implied.
+  int weight[CORNER_COUNT] = {};
+  for (int i = CORNER_COUNT - 3, w = 1; i >= 0; i--, w *= 3)
+    weight[reduced_slots[i]] = w;
+  for (int sym = 0; sym < SYM_COUNT; sym++)
+    for (int s = 0; s < CORNER_COUNT; s++)
+      for (int cubie = 0; cubie < CORNER_COUNT; cubie++)
+        for (int t = 0; t < 3; t++) {
+          int slot, moved, twist;
+          sym_move_cubie(sym, s, cubie, t, &slot, &moved, &twist);
+          sym_twist_part[sym][s][cubie][t] = (uint16_t)(weight[slot] * twist);
+        }
+
+  Corner_cubies c = corner_cubies_solved();
+  for (int p = 0; p < REDUCED_PERM_COUNT; p++) {
+    memcpy(c.cp, reduced_perm_cubies[p], CORNER_COUNT);
+    for (int sym = 0; sym < SYM_COUNT; sym++)
+      sym_perm_image[sym][p] = reduced_from_cubies(sym_apply(c, sym)).perm;
+  }
+
+  // The smallest permutation a symmetry reaches represents the class.
+  int classes = 0;
+  for (int p = 0; p < REDUCED_PERM_COUNT; p++) {
+    int best = p, best_sym = 0;
+    for (int sym = 1; sym < SYM_COUNT; sym++)
+      if (sym_perm_image[sym][p] < best) {
+        best = sym_perm_image[sym][p];
+        best_sym = sym;
+      }
+    if (best == p) {
+      sym_class_stabilizer[classes] = 0;
+      for (int sym = 0; sym < SYM_COUNT; sym++)
+        if (sym_perm_image[sym][p] == p)
+          sym_class_stabilizer[classes] |= 1 << sym;
+      sym_class_perm[classes++] = p;
+    }
+    sym_perm_sym[p] = best_sym;
+  }
+  for (int p = 0; p < REDUCED_PERM_COUNT; p++) {
+    int rep = sym_perm_image[sym_perm_sym[p]][p];
+    int lo = 0, hi = classes - 1;
+    while (sym_class_perm[(lo + hi) / 2] != rep) {
+      if (sym_class_perm[(lo + hi) / 2] < rep)
+        lo = (lo + hi) / 2 + 1;
+      else
+        hi = (lo + hi) / 2 - 1;
+    }
+    sym_perm_class[p] = (lo + hi) / 2;
+  }
+}
+
+static inline Reduced_state sym_reduced(Reduced_state r, int sym)
+{
+  const uint8_t *cp = reduced_perm_cubies[r.perm], *co = reduced_twist_slots[r.twist];
+  const uint16_t (*part)[CORNER_COUNT][3] = sym_twist_part[sym];
+  int twist = 0;
+  for (int s = 0; s < CORNER_COUNT; s++)
+    twist += part[s][cp[s]][co[s]];
+  Reduced_state o;
+  o.perm = sym_perm_image[sym][r.perm];
+  o.twist = twist;
+  return o;
+}
+
+// Index of r's symmetry class member in the symmetry reduced tables.
+static inline int sym_index(Reduced_state r)
+{
+  return sym_perm_class[r.perm] * REDUCED_TWIST_COUNT + sym_reduced(r, sym_perm_sym[r.perm]).twist;
+}
@@ -0,0 +1,379 @@
+#pragma once
+
+// On-disk solver tables.
+//
+// All tables are written once into a versioned, checksummed file which
+// later runs map read-only and point the table globals into, instead of
+// computing them again. Startup only costs the page faults of the pages
+// actually touched, and every process mapping the same file shares them
+// through the page cache.
+//
+// Layout: a Table_file_header, section_count Table_section entries, then
+// the section payloads, each starting on a TABLE_FILE_ALIGN boundary. Other
+// solvers keep their tables in files of the same layout under their own
+// magic (see two_phase.h).
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "distance_table.h"
+
+#define TABLE_FILE_NAME "cube_tables.bin"
+#define TABLE_FILE_MAGIC "CUBETBL"
+// Bump whenever a coordinate encoding or table layout changes.
+#define TABLE_FILE_VERSION 4
+#define TABLE_FILE_BYTE_ORDER 0x01020304u
+#define TABLE_FILE_ALIGN 64
+
+enum {
+  SECTION_PERM_MOVE = 1,
+  SECTION_TWIST_MOVE,
+  SECTION_REDUCED_PERM_MOVE,
+  SECTION_REDUCED_TWIST_MOVE,
+  SECTION_PERM_PRUNE,
+  SECTION_TWIST_PRUNE,
+  SECTION_DISTANCE,
+  SECTION_DISTANCE_HISTOGRAM,
+  SECTION_SYM_DISTANCE,
+  SECTION_NEAR_SOLVED,
+  SECTION_COUNT = SECTION_NEAR_SOLVED
+};
+
+struct Table_file_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t section_count;
+  uint32_t reserved;
+  // Covers the section directory, which holds the payload checksums.
+  uint64_t directory_checksum;
+};
+
+struct Table_section {
+  uint32_t id;
+  uint32_t reserved;
+  uint64_t offset;
+  uint64_t size;
+  uint64_t checksum;
+};
+
+struct Mapped_file {
+  const uint8_t *data;
+  size_t size;
+#ifdef _WIN32
+  HANDLE file;
+  HANDLE mapping;
+#else
+  int fd;
+#endif
+};
+
+// Word at a time multiply-rotate hash, tail bytes folded in one by one.
+static uint64_t table_checksum(const void *data, size_t size)
+{
+  const uint8_t *p = (const uint8_t *)data;
+  uint64_t h = 0x9e3779b97f4a7c15ull ^ size;
+  size_t words = size / 8;
+  for (size_t i = 0; i < words; i++) {
+    uint64_t w;
+    memcpy(&w, p + i * 8, 8);
+    h = (h ^ w) * 0xff51afd7ed558ccdull;
+    h = (h << 31) | (h >> 33);
+  }
+  for (size_t i = words * 8; i < size; i++)
+    h = (h ^ p[i]) * 0xc4ceb9fe1a85ec53ull;
+  return h ^ (h >> 29);
+}
+
+static bool map_file(const char *path, Mapped_file *f)
+{
+#ifdef _WIN32
+  f->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (f->file == INVALID_HANDLE_VALUE)
+    return false;
+  LARGE_INTEGER size;
+  GetFileSizeEx(f->file, &size);
+  f->size = (size_t)size.QuadPart;
+  f->mapping = CreateFileMappingA(f->file, NULL, PAGE_READONLY, 0, 0, NULL);
+  f->data = f->mapping ? (const uint8_t *)MapViewOfFile(f->mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+  if (!f->data) {
+    if (f->mapping)
+      CloseHandle(f->mapping);
+    CloseHandle(f->file);
+    return false;
+  }
+#else
+  f->fd = open(path, O_RDONLY);
+  if (f->fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(f->fd, &st) != 0 || st.st_size == 0) {
+    close(f->fd);
+    return false;
+  }
+  f->size = (size_t)st.st_size;
+  void *p = mmap(NULL, f->size, PROT_READ, MAP_SHARED, f->fd, 0);
+  if (p == MAP_FAILED) {
+    close(f->fd);
+    return false;
+  }
+  f->data = (const uint8_t *)p;
+#endif
+  return true;
+}
+
+static void unmap_file(Mapped_file *f)
+{
+#ifdef _WIN32
+  UnmapViewOfFile(f->data);
+  CloseHandle(f->mapping);
+  CloseHandle(f->file);
+#else
+  munmap((void *)f->data, f->size);
+  close(f->fd);
+#endif
+  f->data = NULL;
+}
+
+static size_t align_up(size_t n, size_t a)
+{
+  return (n + a - 1) / a * a;
+}
+
+// Tables in the order of the section ids, with their expected sizes.
+static void table_file_sections(const void *data[SECTION_COUNT], size_t size[SECTION_COUNT])
+{
+  data[0] = perm_move_table;
+  size[0] = sizeof(perm_move_storage);
+  data[1] = twist_move_table;
+  size[1] = sizeof(twist_move_storage);
+  data[2] = reduced_perm_move;
+  size[2] = sizeof(reduced_perm_storage);
+  data[3] = reduced_twist_move;
+  size[3] = sizeof(reduced_twist_storage);
+  data[4] = perm_prune;
+  size[4] = sizeof(perm_prune_storage);
+  data[5] = twist_prune;
+  size[5] = sizeof(twist_prune_storage);
+  data[6] = distance_table;
+  size[6] = DISTANCE_TABLE_BYTES;
+  data[7] = distance_histogram;
+  size[7] = sizeof(distance_histogram);
+  data[8] = sym_distance_table;
+  size[8] = SYM_DISTANCE_TABLE_BYTES;
+  data[9] = near_solved;
+  size[9] = sizeof(near_solved_storage);
+}
+
+// Writes count sections, section i holding size[i] bytes from data[i], to
+// path. The file is written next to path and renamed into place, so a
+// process mapping the old file never sees a half written one.
+static bool table_file_write_sections(const char *path, const char *magic, uint32_t version, int count,
+                                      const void *const *data, const size_t *size)
+{
+  Table_file_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, magic, sizeof(header.magic));
+  header.version = version;
+  header.byte_order = TABLE_FILE_BYTE_ORDER;
+  header.section_count = count;
+
+  std::vector<Table_section> sections(count);
+  size_t directory_size = count * sizeof(Table_section);
+  size_t offset = align_up(sizeof(header) + directory_size, TABLE_FILE_ALIGN);
+  for (int i = 0; i < count; i++) {
+    sections[i].id = i + 1;
+    sections[i].reserved = 0;
+    sections[i].offset = offset;
+    sections[i].size = size[i];
+    sections[i].checksum = table_checksum(data[i], size[i]);
+    offset = align_up(offset + size[i], TABLE_FILE_ALIGN);
+  }
+  header.directory_checksum = table_checksum(sections.data(), directory_size);
+
+  char tmp[1024];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  FILE *f = fopen(tmp, "wb");
+  if (!f)
+    return false;
+  static const uint8_t zeros[TABLE_FILE_ALIGN] = {};
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+            fwrite(sections.data(), directory_size, 1, f) == 1;
+  size_t at = sizeof(header) + directory_size;
+  for (int i = 0; i < count && ok; i++) {
+    ok = fwrite(zeros, 1, sections[i].offset - at, f) == sections[i].offset - at &&
+         fwrite(data[i], 1, size[i], f) == size[i];
+    at = sections[i].offset + size[i];
+  }
+  ok = fclose(f) == 0 && ok;
+  if (ok) {
+#ifdef _WIN32
+    ok = MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    ok = rename(tmp, path) == 0;
+#endif
+  }
+  if (!ok)
+    remove(tmp);
+  return ok;
+}
+
+// A file next to a table file holding the directory checksum of the file
+// once its payloads have been checked, so that only the first load of a
+// file pays for reading all of it.
+static void verified_marker_path(const char *path, char *marker, size_t size)
+{
+  snprintf(marker, size, "%s.verified", path);
+}
+
+static bool table_file_was_verified(const char *path, uint64_t directory_checksum)
+{
+  char marker[1024];
+  verified_marker_path(path, marker, sizeof(marker));
+  FILE *f = fopen(marker, "rb");
+  if (!f)
+    return false;
+  uint64_t checksum;
+  bool ok = fread(&checksum, sizeof(checksum), 1, f) == 1 && checksum == directory_checksum;
+  fclose(f);
+  return ok;
+}
+
+static void table_file_mark_verified(const char *path, uint64_t directory_checksum)
+{
+  char marker[1024];
+  verified_marker_path(path, marker, sizeof(marker));
+  FILE *f = fopen(marker, "wb");
+  if (!f)
+    return;
+  fwrite(&directory_checksum, sizeof(directory_checksum), 1, f);
+  fclose(f);
+}
+
+// Maps path and sets payload[i] to section i if the file has this magic,
+// version and count sections of exactly size[i] bytes. The header and
+// section directory are always checked. Every payload is checksummed too,
+// which touches all of its pages, if verify is set or this file has not
+// been verified before.
+static bool table_file_map_sections(const char *path, const char *magic, uint32_t version, int count,
+                                    const size_t *size, bool verify, Mapped_file *f, const uint8_t **payload)
+{
+  if (!map_file(path, f))
+    return false;
+  const Table_file_header *header = (const Table_file_header *)f->data;
+  const Table_section *sections = (const Table_section *)(header + 1);
+  bool ok = f->size >= sizeof(*header) + count * sizeof(Table_section) &&
+            memcmp(header->magic, magic, sizeof(header->magic)) == 0 &&
+            header->version == version &&
+            header->byte_order == TABLE_FILE_BYTE_ORDER &&
+            header->section_count == (uint32_t)count &&
+            header->directory_checksum == table_checksum(sections, count * sizeof(Table_section));
+  if (ok && !verify)
+    verify = !table_file_was_verified(path, header->directory_checksum);
+  for (int i = 0; i < count && ok; i++) {
+    const Table_section &s = sections[i];
+    ok = s.id == (uint32_t)i + 1 && s.size == size[i] && s.offset % TABLE_FILE_ALIGN == 0 &&
+         s.offset + s.size <= f->size;
+    if (ok && verify)
+      ok = table_checksum(f->data + s.offset, s.size) == s.checksum;
+    if (ok)
+      payload[i] = f->data + s.offset;
+  }
+  if (!ok)
+    unmap_file(f);
+  else if (verify)
+    table_file_mark_verified(path, header->directory_checksum);
+  return ok;
+}
+
+// Builds every table that is not there yet and writes them all to path.
+static bool table_file_write(const char *path)
+{
+  solver_init();
+  if (!distance_table)
+    distance_table_build(std::thread::hardware_concurrency());
+  if (!sym_distance_table)
+    sym_distance_table_build();
+
+  const void *data[SECTION_COUNT];
+  size_t size[SECTION_COUNT];
+  table_file_sections(data, size);
+  return table_file_write_sections(path, TABLE_FILE_MAGIC, TABLE_FILE_VERSION, SECTION_COUNT, data, size);
+}
+
+static Mapped_file table_file_mapping;
+
+// Maps path and points the table globals into it. verify checksums every
+// payload even if the file was verified before (see
+// table_file_map_sections). Nothing is changed if the file is unusable.
+static bool table_file_load(const char *path, bool verify)
+{
+  const void *expected[SECTION_COUNT];
+  size_t size[SECTION_COUNT];
+  table_file_sections(expected, size);
+  Mapped_file f;
+  const uint8_t *section[SECTION_COUNT];
+  if (!table_file_map_sections(path, TABLE_FILE_MAGIC, TABLE_FILE_VERSION, SECTION_COUNT, size, verify, &f, section))
+    return false;
+
+  init_rotations();
+  perm_move_table = (const uint16_t (*)[MOVE_COUNT])section[0];
+  twist_move_table = (const uint16_t (*)[MOVE_COUNT])section[1];
+  cube_state_initialized = true;
+  reduced_perm_move = (const uint16_t (*)[REDUCED_MOVE_COUNT])section[2];
+  reduced_twist_move = (const uint16_t (*)[REDUCED_MOVE_COUNT])section[3];
+  perm_prune = section[4];
+  twist_prune = section[5];
+  near_solved = (const uint64_t *)section[9];
+  solver_initialized = true;
+  distance_table = (const uint32_t *)section[6];
+  memcpy(distance_histogram, section[7], sizeof(distance_histogram));
+  distance_max_depth = 0;
+  for (int d = 0; d <= SOLVER_MAX_DEPTH; d++)
+    if (distance_histogram[d])
+      distance_max_depth = d;
+  sym_distance_table = (const uint32_t *)section[8];
+
+  if (table_file_mapping.data)
+    unmap_file(&table_file_mapping);
+  table_file_mapping = f;
+  return true;
+}
+
+// Maps the tables from path, or builds them and writes path for next time.
+static void tables_init(const char *path)
+{
+  if (table_file_load(path, false))
+    return;
+  solver_init();
+  distance_table_build(std::thread::hardware_concurrency());
+  sym_distance_table_build();
+  if (!table_file_write(path))
+    fprintf(stderr, "could not write %s\n", path);
+}
+
+// --write-tables [path]: builds all tables and writes them to a table file.
+static int table_file_main(int argc, char *argv[])
+{
+  const char *path = argc > 2 ? argv[2] : TABLE_FILE_NAME;
+  if (!table_file_write(path)) {
+    fprintf(stderr, "could not write %s\n", path);
+    return 1;
+  }
+  if (!table_file_load(path, true)) {
+    fprintf(stderr, "%s does not verify\n", path);
+    return 1;
+  }
+  printf("wrote %s\n", path);
+  print_distance_histogram(stdout);
+  return 0;
+}
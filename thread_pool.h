@@ -0,0 +1,121 @@
+#pragma once
+
+// Work stealing thread pool.
+//
+// Every worker owns a deque. Submitted tasks are dealt round robin onto the
+// deques; a worker takes from the back of its own and, when that is empty,
+// steals from the front of the others before going to sleep.
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef void (*Task_fn)(void *task, int worker, void *context);
+
+struct Work_queue {
+  std::mutex lock;
+  std::deque<void *> tasks;
+};
+
+struct Thread_pool {
+  int thread_count;
+  Task_fn run;
+  void *context;
+  std::vector<std::thread> threads;
+  Work_queue *queues;
+  std::mutex sleep_lock;
+  std::condition_variable wake;
+  // Tasks submitted but not yet taken. Raised under sleep_lock so a worker
+  // checking it before sleeping cannot miss a wake up.
+  std::atomic<int> pending;
+  std::atomic<unsigned> next_queue;
+  std::atomic<uint64_t> steals;
+  bool stopping;
+};
+
+static void *take_task(Thread_pool *pool, int worker)
+{
+  Work_queue &own = pool->queues[worker];
+  {
+    std::lock_guard<std::mutex> lock(own.lock);
+    if (!own.tasks.empty()) {
+      void *task = own.tasks.back();
+      own.tasks.pop_back();
+      pool->pending--;
+      return task;
+    }
+  }
+  for (int i = 1; i < pool->thread_count; i++) {
+    Work_queue &victim = pool->queues[(worker + i) % pool->thread_count];
+    std::lock_guard<std::mutex> lock(victim.lock);
+    if (!victim.tasks.empty()) {
+      void *task = victim.tasks.front();
+      victim.tasks.pop_front();
+      pool->pending--;
+      pool->steals++;
+      return task;
+    }
+  }
+  return NULL;
+}
+
+static void pool_worker(Thread_pool *pool, int worker)
+{
+  for (;;) {
+    void *task = take_task(pool, worker);
+    if (task) {
+      pool->run(task, worker, pool->context);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(pool->sleep_lock);
+    pool->wake.wait(lock, [pool] { return pool->stopping || pool->pending > 0; });
+    if (pool->stopping && pool->pending == 0)
+      return;
+  }
+}
+
+static void thread_pool_start(Thread_pool *pool, int threads, Task_fn run, void *context)
+{
+  pool->thread_count = threads < 1 ? 1 : threads;
+  pool->run = run;
+  pool->context = context;
+  pool->queues = new Work_queue[pool->thread_count];
+  pool->pending = 0;
+  pool->next_queue = 0;
+  pool->steals = 0;
+  pool->stopping = false;
+  for (int i = 0; i < pool->thread_count; i++)
+    pool->threads.push_back(std::thread(pool_worker, pool, i));
+}
+
+static void thread_pool_submit(Thread_pool *pool, void *task)
+{
+  Work_queue &q = pool->queues[pool->next_queue++ % pool->thread_count];
+  {
+    std::lock_guard<std::mutex> lock(q.lock);
+    q.tasks.push_back(task);
+  }
+  {
+    std::lock_guard<std::mutex> lock(pool->sleep_lock);
+    pool->pending++;
+  }
+  pool->wake.notify_one();
+}
+
+// Runs every task already submitted, then joins the workers.
+static void thread_pool_stop(Thread_pool *pool)
+{
+  {
+    std::lock_guard<std::mutex> lock(pool->sleep_lock);
+    pool->stopping = true;
+  }
+  pool->wake.notify_all();
+  for (auto &t : pool->threads)
+    t.join();
+  pool->threads.clear();
+  delete[] pool->queues;
+  pool->queues = NULL;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+// Lock-free triple buffer for one writer thread and one reader thread.
+//
+// The caller keeps three slots of whatever it hands over; this only deals
+// out their indices. The writer fills slot back and publishes it, getting
+// in return the slot nobody is using, and the reader takes the newest
+// published slot as front. Neither side ever waits for the other, the
+// writer never touches the slot being read, and a slow reader skips the
+// slots it missed rather than falling behind.
+
+#include <atomic>
+
+// Set in middle while it holds a slot the reader has not taken yet.
+#define TRIPLE_BUFFER_FRESH 4u
+
+struct Triple_buffer {
+  // Only the writer uses back and only the reader front; the slot in
+  // between changes hands through middle.
+  unsigned back;
+  std::atomic<unsigned> middle;
+  unsigned front;
+};
+
+static void triple_buffer_init(Triple_buffer *b)
+{
+  b->back = 0;
+  b->middle = 1;
+  b->front = 2;
+}
+
+// Writer: publishes slot back and returns the slot to fill next.
+static unsigned triple_buffer_publish(Triple_buffer *b)
+{
+  b->back = b->middle.exchange(b->back | TRIPLE_BUFFER_FRESH, std::memory_order_acq_rel) & 3;
+  return b->back;
+}
+
+// Reader: the newest published slot, or the one it had if nothing new has
+// been published since.
+static unsigned triple_buffer_read(Triple_buffer *b)
+{
+  if (b->middle.load(std::memory_order_relaxed) & TRIPLE_BUFFER_FRESH)
+    b->front = b->middle.exchange(b->front, std::memory_order_acq_rel) & 3;
+  return b->front;
+}
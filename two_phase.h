@@ -0,0 +1,845 @@
+#pragma once
+
+// 3x3x3 two-phase solver.
+//
+// Phase 1 turns the cube into the subgroup H = <U, D, R2, L2, F2, B2>,
+// where every corner twist and edge flip is 0 and the slice edges are in
+// the slice. Phase 2 solves inside H with those ten moves only. Both are
+// IDA* on small coordinates whose move and pruning tables are built once
+// and kept in a table file like the 2x2x2 ones (table_file.h).
+//
+// Phase 1 prunes with the exact distance to H over flip, slice edge places
+// and twist together. The sixteen symmetries that keep the U-D axis keep
+// H, so that table only covers one flip and slice position per symmetry
+// class, and like distance_table.h it stores distances mod 3: the search
+// carries the exact distance and a turn changes it by at most one.
+//
+// Every phase 1 solution, shortest first, is finished by the shortest
+// phase 2 that beats the best total so far. Worker threads share that
+// work: for every phase 1 length they take first moves from a counter,
+// and they all stop once a solution of the target length is found or the
+// time budget is spent with some solution in hand. Past the budget with
+// none, phase 2 is searched as deep as it goes so the next phase 1
+// solution ends the search.
+//
+// Moves here are face turns, face * 3 + k with k = 0 clockwise, 1 half
+// and 2 anti-clockwise, and lengths count face turns.
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "cube3_state.h"
+#include "table_file.h"
+
+#define TURN_COUNT 18
+#define PHASE2_TURN_COUNT 10
+#define FLIP_COUNT 2048
+// Where the four slice edges are (12 choose 4), and also in which order.
+#define SLICE_COUNT 495
+#define SLICE_SORTED_COUNT 11880
+#define SLICE_PERM_COUNT 24
+#define UD_EDGE_PERM_COUNT 40320
+#define FLIPSLICE_COUNT (FLIP_COUNT * SLICE_COUNT)
+#define UD_SYM_COUNT 16
+#define FLIPSLICE_CLASS_COUNT 64430
+#define PHASE1_PRUNE_COUNT (FLIPSLICE_CLASS_COUNT * CORNER_TWIST_COUNT)
+// Sixteen 2 bit entries per 32 bit word, as in distance_table.h.
+#define PHASE1_PRUNE_WORDS ((PHASE1_PRUNE_COUNT + 15) / 16)
+#define PHASE1_MAX_DEPTH 12
+#define PHASE2_MAX_DEPTH 18
+// Longest phase 2 searched within the budget. Long phase 2s are slow to
+// find and rarely give the best total; more phase 1 solutions are the
+// better use of the budget.
+#define PHASE2_SEARCH_DEPTH 11
+#define TWO_PHASE_MAX_LENGTH (PHASE1_MAX_DEPTH + PHASE2_MAX_DEPTH)
+#define TWO_PHASE_TARGET_LENGTH 20
+#define TWO_PHASE_BUDGET_MS 10.0
+// Nodes a worker searches between looks at the clock.
+#define TWO_PHASE_CLOCK_NODES 1024
+#define TWO_PHASE_LINE_MAX 1024
+
+#define TWO_PHASE_FILE_NAME "cube3_tables.bin"
+#define TWO_PHASE_FILE_MAGIC "CUBE3TB"
+#define TWO_PHASE_FILE_VERSION 2
+
+enum {
+  TWO_PHASE_TWIST_MOVE,
+  TWO_PHASE_FLIP_MOVE,
+  TWO_PHASE_SLICE_MOVE,
+  TWO_PHASE_SLICE_COMB_MOVE,
+  TWO_PHASE_CORNER_MOVE,
+  TWO_PHASE_EDGE_MOVE,
+  TWO_PHASE_SLICE_PERM_MOVE,
+  TWO_PHASE_FLIPSLICE_CLASS,
+  TWO_PHASE_FLIPSLICE_SYM,
+  TWO_PHASE_FLIPSLICE_REP,
+  TWO_PHASE_TWIST_CONJ,
+  TWO_PHASE_PHASE1_PRUNE,
+  TWO_PHASE_CORNER_PRUNE,
+  TWO_PHASE_EDGE_PRUNE,
+  TWO_PHASE_SECTION_COUNT
+};
+
+// Phase 2 turn i is face turn phase2_turns[i].
+static const int phase2_turns[PHASE2_TURN_COUNT] = { 12, 13, 14, 15, 16, 17, 1, 4, 7, 10 };
+
+// Storage filled by two_phase_build(), or the tables point into a mapped
+// table file. Phase 2 pruning entries are the exact distance to solved
+// within H by the corners or the U and D layer edges together with the
+// order of the slice edges.
+//
+// A flip and slice position (flip * SLICE_COUNT + where the slice edges
+// are) is in class flipslice_class[] of the symmetry classes, whose
+// smallest member flipslice_rep[] is what symmetry flipslice_sym[] makes
+// of it. twist_conj[sym][twist] is the twist seen through symmetry sym.
+// phase1_prune holds the distance to H mod 3, or DISTANCE_UNKNOWN, at
+// class * CORNER_TWIST_COUNT + the twist seen through the same symmetry.
+static uint16_t twist3_move_storage[CORNER_TWIST_COUNT][TURN_COUNT];
+static uint16_t flip_move_storage[FLIP_COUNT][TURN_COUNT];
+static uint16_t slice_move_storage[SLICE_SORTED_COUNT][TURN_COUNT];
+static uint16_t slice_comb_move_storage[SLICE_COUNT][TURN_COUNT];
+static uint16_t corner3_move_storage[CORNER_PERM_COUNT][PHASE2_TURN_COUNT];
+static uint16_t ud_edge_move_storage[UD_EDGE_PERM_COUNT][PHASE2_TURN_COUNT];
+static uint16_t slice_perm_move_storage[SLICE_PERM_COUNT][PHASE2_TURN_COUNT];
+static uint16_t flipslice_class_storage[FLIPSLICE_COUNT];
+static uint8_t flipslice_sym_storage[FLIPSLICE_COUNT];
+static uint32_t flipslice_rep_storage[FLIPSLICE_CLASS_COUNT];
+static uint16_t twist_conj_storage[UD_SYM_COUNT][CORNER_TWIST_COUNT];
+static uint32_t phase1_prune_storage[PHASE1_PRUNE_WORDS];
+static uint8_t corner_slice_prune_storage[CORNER_PERM_COUNT * SLICE_PERM_COUNT];
+static uint8_t edge_slice_prune_storage[UD_EDGE_PERM_COUNT * SLICE_PERM_COUNT];
+static const uint16_t (*twist3_move)[TURN_COUNT] = twist3_move_storage;
+static const uint16_t (*flip_move)[TURN_COUNT] = flip_move_storage;
+static const uint16_t (*slice_move)[TURN_COUNT] = slice_move_storage;
+static const uint16_t (*slice_comb_move)[TURN_COUNT] = slice_comb_move_storage;
+static const uint16_t (*corner3_move)[PHASE2_TURN_COUNT] = corner3_move_storage;
+static const uint16_t (*ud_edge_move)[PHASE2_TURN_COUNT] = ud_edge_move_storage;
+static const uint16_t (*slice_perm_move)[PHASE2_TURN_COUNT] = slice_perm_move_storage;
+static const uint16_t *flipslice_class = flipslice_class_storage;
+static const uint8_t *flipslice_sym = flipslice_sym_storage;
+static const uint32_t *flipslice_rep = flipslice_rep_storage;
+static const uint16_t (*twist_conj)[CORNER_TWIST_COUNT] = twist_conj_storage;
+static const uint32_t *phase1_prune = phase1_prune_storage;
+static const uint8_t *corner_slice_prune = corner_slice_prune_storage;
+static const uint8_t *edge_slice_prune = edge_slice_prune_storage;
+static bool two_phase_ready = false;
+static Mapped_file two_phase_mapping;
+
+static Cube3_state cube3_apply_turn(const Cube3_state &c, int turn)
+{
+  int face = turn / 3, k = turn % 3;
+  if (k == 2)
+    return cube3_apply_move(c, face * 2 + 1);
+  Cube3_state o = cube3_apply_move(c, face * 2);
+  return k == 1 ? cube3_apply_move(o, face * 2) : o;
+}
+
+// Face turn turn through a move table of quarter turns (cube_state.h).
+static int quarter_table_turn(const uint16_t (*table)[MOVE_COUNT], int x, int turn)
+{
+  int face = turn / 3, k = turn % 3;
+  if (k == 2)
+    return table[x][face * 2 + 1];
+  x = table[x][face * 2];
+  return k == 1 ? table[x][face * 2] : x;
+}
+
+// Edge flips of slots 0..10 in base 2, slot 11 is implied.
+static int flip_coord(const Cube3_state &c)
+{
+  int flip = 0;
+  for (int s = 0; s < EDGE_COUNT - 1; s++)
+    flip = flip * 2 + c.eo[s];
+  return flip;
+}
+
+static void set_flip_coord(Cube3_state *c, int flip)
+{
+  int sum = 0;
+  for (int s = EDGE_COUNT - 2; s >= 0; s--) {
+    c->eo[s] = flip & 1;
+    sum += flip & 1;
+    flip >>= 1;
+  }
+  c->eo[EDGE_COUNT - 1] = sum & 1;
+}
+
+static int binomial(int n, int k)
+{
+  if (k < 0 || k > n)
+    return 0;
+  int b = 1;
+  for (int i = 0; i < k; i++)
+    b = b * (n - i) / (i + 1);
+  return b;
+}
+
+// The slots of the slice edges (cubies 8..11) ranked with slot 11 first,
+// so that 0 has them all home, times 24, plus the order they are in.
+static int slice_coord(const Cube3_state &c)
+{
+  int comb = 0, k = 0;
+  uint8_t order[4];
+  for (int s = EDGE_COUNT - 1; s >= 0; s--) {
+    if (c.ep[s] < 8)
+      continue;
+    comb += binomial(EDGE_COUNT - 1 - s, k + 1);
+    order[3 - k++] = c.ep[s] - 8;
+  }
+  return comb * SLICE_PERM_COUNT + perm_rank(order, 4);
+}
+
+// Places the slice edges; the other slots get U and D layer edges in order.
+static void set_slice_coord(Cube3_state *c, int slice)
+{
+  uint8_t order[4];
+  perm_unrank(slice % SLICE_PERM_COUNT, order, 4);
+  int comb = slice / SLICE_PERM_COUNT, k = 4, other = 0;
+  for (int s = 0; s < EDGE_COUNT; s++) {
+    int r = EDGE_COUNT - 1 - s;
+    if (k > 0 && comb >= binomial(r, k)) {
+      comb -= binomial(r, k);
+      k--;
+      c->ep[s] = 8 + order[3 - k];
+    } else {
+      c->ep[s] = other++;
+    }
+  }
+}
+
+// Only meaningful in H, where slots 0..7 hold the U and D layer edges.
+static int ud_edge_coord(const Cube3_state &c)
+{
+  return perm_rank(c.ep, 8);
+}
+
+// Exact distances over pairs of coordinates, index a * b_count + b, by
+// breadth first search from the solved pair 0.
+static void two_phase_prune_build(uint8_t *table, int a_count, const uint16_t *a_move, int b_count,
+                                  const uint16_t *b_move, int moves)
+{
+  int count = a_count * b_count;
+  memset(table, 0xff, count);
+  table[0] = 0;
+  for (int depth = 0, found = 1; found; depth++) {
+    found = 0;
+    for (int i = 0; i < count; i++) {
+      if (table[i] != depth)
+        continue;
+      int a = i / b_count, b = i % b_count;
+      for (int m = 0; m < moves; m++) {
+        int j = a_move[a * moves + m] * b_count + b_move[b * moves + m];
+        if (table[j] == 0xff) {
+          table[j] = depth + 1;
+          found++;
+        }
+      }
+    }
+  }
+}
+
+// The face turn each face turn becomes in the cube seen through each of
+// the sixteen symmetries that keep the U-D axis: symmetry sym turns the
+// cube sym & 3 quarter turns about U, then half a turn about F if bit 2 is
+// set, then mirrors it left to right if bit 3 is. A mirror reverses turns.
+static void ud_sym_turns(int sym_turn[UD_SYM_COUNT][TURN_COUNT])
+{
+  const Rotation quarter_u = {{{ 0, 0, 1 }, { 0, 1, 0 }, { -1, 0, 0 }}};
+  const Rotation half_f = {{{ -1, 0, 0 }, { 0, -1, 0 }, { 0, 0, 1 }}};
+  const Rotation mirror = {{{ -1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 }}};
+  for (int sym = 0; sym < UD_SYM_COUNT; sym++) {
+    Rotation m = rotations[0];
+    for (int i = 0; i < (sym & 3); i++)
+      m = rotation_mul(quarter_u, m);
+    if (sym & 4)
+      m = rotation_mul(half_f, m);
+    if (sym & 8)
+      m = rotation_mul(mirror, m);
+    for (int t = 0; t < TURN_COUNT; t++) {
+      int face = nxn_face_of(rotate_ivec3(m, face_normal[t / 3])), k = t % 3;
+      sym_turn[sym][t] = face * 3 + (sym & 8 ? 2 - k : k);
+    }
+  }
+}
+
+// Writes to image what every pair of coordinates (laid out as in
+// two_phase_prune_build) is seen as through a symmetry: a position reached
+// by turns t1 t2 ... is seen as the one reached by sym_turn[t1]
+// sym_turn[t2] ..., so a breadth first search from solved, which every
+// symmetry keeps, finds them all.
+static void ud_sym_image(const uint16_t *a_move, int b_count, const uint16_t *b_move, int count,
+                         const int *sym_turn, uint32_t *image)
+{
+  std::vector<uint32_t> queue;
+  queue.reserve(count);
+  memset(image, 0xff, count * sizeof(uint32_t));
+  image[0] = 0;
+  queue.push_back(0);
+  for (size_t q = 0; q < queue.size(); q++) {
+    int i = queue[q], a = i / b_count, b = i % b_count;
+    int ia = image[i] / b_count, ib = image[i] % b_count;
+    for (int m = 0; m < TURN_COUNT; m++) {
+      int j = a_move[a * TURN_COUNT + m] * b_count + b_move[b * TURN_COUNT + m];
+      if (image[j] != 0xffffffff)
+        continue;
+      int t = sym_turn[m];
+      image[j] = a_move[ia * TURN_COUNT + t] * b_count + b_move[ib * TURN_COUNT + t];
+      queue.push_back(j);
+    }
+  }
+}
+
+static inline int phase1_prune_index(int twist, int flip, int comb)
+{
+  int fs = flip * SLICE_COUNT + comb;
+  return flipslice_class[fs] * CORNER_TWIST_COUNT + twist_conj[flipslice_sym[fs]][twist];
+}
+
+static inline void phase1_prune_set(int i, int d)
+{
+  phase1_prune_storage[i >> 4] &= ~((uint32_t)(DISTANCE_UNKNOWN ^ d % 3) << ((i & 15) * 2));
+}
+
+static inline int phase1_prune_neighbour(int i, int m)
+{
+  int fs = flipslice_rep[i / CORNER_TWIST_COUNT];
+  return phase1_prune_index(twist3_move[i % CORNER_TWIST_COUNT][m], flip_move[fs / SLICE_COUNT][m],
+                            slice_comb_move[fs % SLICE_COUNT][m]);
+}
+
+// Sorts flip and slice positions into symmetry classes and fills
+// phase1_prune by breadth first search over the classes. Each entry found
+// also fills the entries its representative's stabilizer takes it to, as
+// in sym_distance_table_build(). Once most entries are known, a layer is
+// found faster from the unknown side: an unknown entry is one further if
+// any neighbour holds the last layer's distance.
+static void phase1_prune_build()
+{
+  int sym_turn[UD_SYM_COUNT][TURN_COUNT];
+  ud_sym_turns(sym_turn);
+  static const uint16_t no_move[TURN_COUNT] = {};
+  std::vector<uint32_t> image(FLIPSLICE_COUNT), rep(FLIPSLICE_COUNT);
+  std::vector<uint16_t> stabilizer(FLIPSLICE_COUNT, 0);
+  uint32_t twist_image[CORNER_TWIST_COUNT];
+  for (int fs = 0; fs < FLIPSLICE_COUNT; fs++)
+    rep[fs] = fs;
+  memset(flipslice_sym_storage, 0, sizeof(flipslice_sym_storage));
+  for (int sym = 0; sym < UD_SYM_COUNT; sym++) {
+    ud_sym_image(flip_move_storage[0], SLICE_COUNT, slice_comb_move_storage[0], FLIPSLICE_COUNT, sym_turn[sym],
+                 image.data());
+    for (int fs = 0; fs < FLIPSLICE_COUNT; fs++) {
+      if (image[fs] < rep[fs]) {
+        rep[fs] = image[fs];
+        flipslice_sym_storage[fs] = sym;
+      }
+      if (image[fs] == (uint32_t)fs)
+        stabilizer[fs] |= 1 << sym;
+    }
+    ud_sym_image(twist3_move_storage[0], 1, no_move, CORNER_TWIST_COUNT, sym_turn[sym], twist_image);
+    for (int t = 0; t < CORNER_TWIST_COUNT; t++)
+      twist_conj_storage[sym][t] = twist_image[t];
+  }
+  std::vector<uint16_t> class_stabilizer(FLIPSLICE_CLASS_COUNT);
+  for (int fs = 0, classes = 0; fs < FLIPSLICE_COUNT; fs++) {
+    if (rep[fs] != (uint32_t)fs) {
+      flipslice_class_storage[fs] = flipslice_class_storage[rep[fs]];
+      continue;
+    }
+    class_stabilizer[classes] = stabilizer[fs];
+    flipslice_rep_storage[classes] = fs;
+    flipslice_class_storage[fs] = classes++;
+  }
+
+  memset(phase1_prune_storage, 0xff, sizeof(phase1_prune_storage));
+  phase1_prune_set(0, 0);
+  int64_t known = 1;
+  for (int depth = 0, found = 1; found; depth++) {
+    found = 0;
+    int last = depth % 3;
+    bool backward = known > PHASE1_PRUNE_COUNT / 2;
+    for (int i = 0; i < PHASE1_PRUNE_COUNT; i++) {
+      int v = distance_get(phase1_prune, i);
+      if (backward) {
+        if (v != DISTANCE_UNKNOWN)
+          continue;
+        for (int m = 0; m < TURN_COUNT; m++)
+          if (distance_get(phase1_prune, phase1_prune_neighbour(i, m)) == last) {
+            phase1_prune_set(i, depth + 1);
+            found++;
+            break;
+          }
+        continue;
+      }
+      // Entries from depth - 3 match too; their neighbours are all known.
+      if (v != last)
+        continue;
+      for (int m = 0; m < TURN_COUNT; m++) {
+        int j = phase1_prune_neighbour(i, m);
+        if (distance_get(phase1_prune, j) != DISTANCE_UNKNOWN)
+          continue;
+        phase1_prune_set(j, depth + 1);
+        found++;
+        int cls = j / CORNER_TWIST_COUNT, twist = j % CORNER_TWIST_COUNT;
+        for (int sym = 1; sym < UD_SYM_COUNT; sym++) {
+          if (!(class_stabilizer[cls] >> sym & 1))
+            continue;
+          int e = cls * CORNER_TWIST_COUNT + twist_conj[sym][twist];
+          if (distance_get(phase1_prune, e) == DISTANCE_UNKNOWN) {
+            phase1_prune_set(e, depth + 1);
+            found++;
+          }
+        }
+      }
+    }
+    known += found;
+  }
+}
+
+// Fills the storage and points the tables at it. Returns the time in
+// milliseconds.
+static double two_phase_build()
+{
+  auto start = std::chrono::steady_clock::now();
+  cube3_init();
+  for (int t = 0; t < CORNER_TWIST_COUNT; t++)
+    for (int m = 0; m < TURN_COUNT; m++)
+      twist3_move_storage[t][m] = quarter_table_turn(twist_move_table, t, m);
+  Cube3_state c = cube3_solved();
+  for (int f = 0; f < FLIP_COUNT; f++) {
+    set_flip_coord(&c, f);
+    for (int m = 0; m < TURN_COUNT; m++)
+      flip_move_storage[f][m] = flip_coord(cube3_apply_turn(c, m));
+  }
+  c = cube3_solved();
+  for (int s = 0; s < SLICE_SORTED_COUNT; s++) {
+    set_slice_coord(&c, s);
+    for (int m = 0; m < TURN_COUNT; m++)
+      slice_move_storage[s][m] = slice_coord(cube3_apply_turn(c, m));
+  }
+  for (int s = 0; s < SLICE_COUNT; s++)
+    for (int m = 0; m < TURN_COUNT; m++)
+      slice_comb_move_storage[s][m] = slice_move_storage[s * SLICE_PERM_COUNT][m] / SLICE_PERM_COUNT;
+  for (int p = 0; p < CORNER_PERM_COUNT; p++)
+    for (int i = 0; i < PHASE2_TURN_COUNT; i++)
+      corner3_move_storage[p][i] = quarter_table_turn(perm_move_table, p, phase2_turns[i]);
+  c = cube3_solved();
+  for (int p = 0; p < UD_EDGE_PERM_COUNT; p++) {
+    perm_unrank(p, c.ep, 8);
+    for (int i = 0; i < PHASE2_TURN_COUNT; i++)
+      ud_edge_move_storage[p][i] = ud_edge_coord(cube3_apply_turn(c, phase2_turns[i]));
+  }
+  c = cube3_solved();
+  for (int p = 0; p < SLICE_PERM_COUNT; p++) {
+    set_slice_coord(&c, p);
+    for (int i = 0; i < PHASE2_TURN_COUNT; i++)
+      slice_perm_move_storage[p][i] = slice_coord(cube3_apply_turn(c, phase2_turns[i]));
+  }
+
+  twist3_move = twist3_move_storage;
+  flip_move = flip_move_storage;
+  slice_move = slice_move_storage;
+  slice_comb_move = slice_comb_move_storage;
+  corner3_move = corner3_move_storage;
+  ud_edge_move = ud_edge_move_storage;
+  slice_perm_move = slice_perm_move_storage;
+  flipslice_class = flipslice_class_storage;
+  flipslice_sym = flipslice_sym_storage;
+  flipslice_rep = flipslice_rep_storage;
+  twist_conj = twist_conj_storage;
+  phase1_prune = phase1_prune_storage;
+  corner_slice_prune = corner_slice_prune_storage;
+  edge_slice_prune = edge_slice_prune_storage;
+
+  phase1_prune_build();
+  two_phase_prune_build(corner_slice_prune_storage, CORNER_PERM_COUNT, corner3_move_storage[0], SLICE_PERM_COUNT,
+                        slice_perm_move_storage[0], PHASE2_TURN_COUNT);
+  two_phase_prune_build(edge_slice_prune_storage, UD_EDGE_PERM_COUNT, ud_edge_move_storage[0], SLICE_PERM_COUNT,
+                        slice_perm_move_storage[0], PHASE2_TURN_COUNT);
+  two_phase_ready = true;
+  return elapsed_ms(start);
+}
+
+static void two_phase_sections(const void *data[TWO_PHASE_SECTION_COUNT], size_t size[TWO_PHASE_SECTION_COUNT])
+{
+  data[TWO_PHASE_TWIST_MOVE] = twist3_move;
+  size[TWO_PHASE_TWIST_MOVE] = sizeof(twist3_move_storage);
+  data[TWO_PHASE_FLIP_MOVE] = flip_move;
+  size[TWO_PHASE_FLIP_MOVE] = sizeof(flip_move_storage);
+  data[TWO_PHASE_SLICE_MOVE] = slice_move;
+  size[TWO_PHASE_SLICE_MOVE] = sizeof(slice_move_storage);
+  data[TWO_PHASE_SLICE_COMB_MOVE] = slice_comb_move;
+  size[TWO_PHASE_SLICE_COMB_MOVE] = sizeof(slice_comb_move_storage);
+  data[TWO_PHASE_CORNER_MOVE] = corner3_move;
+  size[TWO_PHASE_CORNER_MOVE] = sizeof(corner3_move_storage);
+  data[TWO_PHASE_EDGE_MOVE] = ud_edge_move;
+  size[TWO_PHASE_EDGE_MOVE] = sizeof(ud_edge_move_storage);
+  data[TWO_PHASE_SLICE_PERM_MOVE] = slice_perm_move;
+  size[TWO_PHASE_SLICE_PERM_MOVE] = sizeof(slice_perm_move_storage);
+  data[TWO_PHASE_FLIPSLICE_CLASS] = flipslice_class;
+  size[TWO_PHASE_FLIPSLICE_CLASS] = sizeof(flipslice_class_storage);
+  data[TWO_PHASE_FLIPSLICE_SYM] = flipslice_sym;
+  size[TWO_PHASE_FLIPSLICE_SYM] = sizeof(flipslice_sym_storage);
+  data[TWO_PHASE_FLIPSLICE_REP] = flipslice_rep;
+  size[TWO_PHASE_FLIPSLICE_REP] = sizeof(flipslice_rep_storage);
+  data[TWO_PHASE_TWIST_CONJ] = twist_conj;
+  size[TWO_PHASE_TWIST_CONJ] = sizeof(twist_conj_storage);
+  data[TWO_PHASE_PHASE1_PRUNE] = phase1_prune;
+  size[TWO_PHASE_PHASE1_PRUNE] = sizeof(phase1_prune_storage);
+  data[TWO_PHASE_CORNER_PRUNE] = corner_slice_prune;
+  size[TWO_PHASE_CORNER_PRUNE] = sizeof(corner_slice_prune_storage);
+  data[TWO_PHASE_EDGE_PRUNE] = edge_slice_prune;
+  size[TWO_PHASE_EDGE_PRUNE] = sizeof(edge_slice_prune_storage);
+}
+
+static bool two_phase_load(const char *path, bool verify)
+{
+  const void *expected[TWO_PHASE_SECTION_COUNT];
+  size_t size[TWO_PHASE_SECTION_COUNT];
+  two_phase_sections(expected, size);
+  Mapped_file f;
+  const uint8_t *section[TWO_PHASE_SECTION_COUNT];
+  if (!table_file_map_sections(path, TWO_PHASE_FILE_MAGIC, TWO_PHASE_FILE_VERSION, TWO_PHASE_SECTION_COUNT, size,
+                               verify, &f, section))
+    return false;
+
+  cube3_init();
+  twist3_move = (const uint16_t (*)[TURN_COUNT])section[TWO_PHASE_TWIST_MOVE];
+  flip_move = (const uint16_t (*)[TURN_COUNT])section[TWO_PHASE_FLIP_MOVE];
+  slice_move = (const uint16_t (*)[TURN_COUNT])section[TWO_PHASE_SLICE_MOVE];
+  slice_comb_move = (const uint16_t (*)[TURN_COUNT])section[TWO_PHASE_SLICE_COMB_MOVE];
+  corner3_move = (const uint16_t (*)[PHASE2_TURN_COUNT])section[TWO_PHASE_CORNER_MOVE];
+  ud_edge_move = (const uint16_t (*)[PHASE2_TURN_COUNT])section[TWO_PHASE_EDGE_MOVE];
+  slice_perm_move = (const uint16_t (*)[PHASE2_TURN_COUNT])section[TWO_PHASE_SLICE_PERM_MOVE];
+  flipslice_class = (const uint16_t *)section[TWO_PHASE_FLIPSLICE_CLASS];
+  flipslice_sym = section[TWO_PHASE_FLIPSLICE_SYM];
+  flipslice_rep = (const uint32_t *)section[TWO_PHASE_FLIPSLICE_REP];
+  twist_conj = (const uint16_t (*)[CORNER_TWIST_COUNT])section[TWO_PHASE_TWIST_CONJ];
+  phase1_prune = (const uint32_t *)section[TWO_PHASE_PHASE1_PRUNE];
+  corner_slice_prune = section[TWO_PHASE_CORNER_PRUNE];
+  edge_slice_prune = section[TWO_PHASE_EDGE_PRUNE];
+  two_phase_ready = true;
+
+  if (two_phase_mapping.data)
+    unmap_file(&two_phase_mapping);
+  two_phase_mapping = f;
+  return true;
+}
+
+// Maps the tables from path, or builds them and writes path for next time.
+static void two_phase_init(const char *path)
+{
+  if (two_phase_ready || two_phase_load(path, false))
+    return;
+  two_phase_build();
+  const void *data[TWO_PHASE_SECTION_COUNT];
+  size_t size[TWO_PHASE_SECTION_COUNT];
+  two_phase_sections(data, size);
+  if (!table_file_write_sections(path, TWO_PHASE_FILE_MAGIC, TWO_PHASE_FILE_VERSION, TWO_PHASE_SECTION_COUNT, data,
+                                 size))
+    fprintf(stderr, "could not write %s\n", path);
+}
+
+struct Two_phase_result {
+  // Face turns, or -1 if there is no solution.
+  int length;
+  int turns[TWO_PHASE_MAX_LENGTH];
+  double ms;
+  uint64_t nodes;
+};
+
+// State shared by the workers of one solve.
+struct Two_phase_search {
+  Cube3_state start;
+  int target_length;
+  bool has_deadline;
+  std::chrono::steady_clock::time_point deadline;
+  // Next first move to take, per phase 1 length.
+  std::atomic<int> next_first[PHASE1_MAX_DEPTH + 1];
+  std::atomic<int> best_length;
+  std::atomic<bool> stop;
+  // Set once the budget is spent without a solution.
+  std::atomic<bool> overtime;
+  std::atomic<uint64_t> nodes;
+  std::mutex best_lock;
+  int best[TWO_PHASE_MAX_LENGTH];
+};
+
+struct Two_phase_worker {
+  Two_phase_search *search;
+  int path[TWO_PHASE_MAX_LENGTH];
+  uint64_t nodes;
+};
+
+// Skips a turn of the face just turned, and of its opposite face in the
+// wrong order, since both commute.
+static inline bool redundant_turn(int turn, int prev)
+{
+  if (prev < 0)
+    return false;
+  int face = turn / 3, prev_face = prev / 3;
+  return face == prev_face || (face == nxn_opposite[prev_face] && face < prev_face);
+}
+
+// Counts a node and, every TWO_PHASE_CLOCK_NODES, stops the search if the
+// budget is spent and there is a solution, or marks it overtime if there
+// is none. True if the worker should stop.
+static inline bool two_phase_tick(Two_phase_worker *w)
+{
+  Two_phase_search *s = w->search;
+  if (++w->nodes % TWO_PHASE_CLOCK_NODES == 0 && s->has_deadline && std::chrono::steady_clock::now() >= s->deadline) {
+    if (s->best_length.load(std::memory_order_relaxed) <= TWO_PHASE_MAX_LENGTH)
+      s->stop = true;
+    else
+      s->overtime = true;
+  }
+  return s->stop.load(std::memory_order_relaxed);
+}
+
+// Distance to H of a neighbour of a position d from it: d - 1, d or d + 1,
+// told apart by the entry mod 3.
+static inline int phase1_next_distance(int d, int twist, int flip, int slice)
+{
+  int v = distance_get(phase1_prune, phase1_prune_index(twist, flip, slice / SLICE_PERM_COUNT));
+  return d + (v - d % 3 + 4) % 3 - 1;
+}
+
+// Exact distance to H: the number of turns down to it, each to the
+// neighbour holding one less mod 3. A damaged table without one ends the
+// walk early.
+static int phase1_distance(int twist, int flip, int slice)
+{
+  int v = distance_get(phase1_prune, phase1_prune_index(twist, flip, slice / SLICE_PERM_COUNT)), d = 0;
+  while ((twist != 0 || flip != 0 || slice >= SLICE_PERM_COUNT) && d < PHASE1_MAX_DEPTH) {
+    int want = (v + 2) % 3, m = 0;
+    for (; m < TURN_COUNT; m++) {
+      int t = twist3_move[twist][m], f = flip_move[flip][m], s = slice_move[slice][m];
+      if (distance_get(phase1_prune, phase1_prune_index(t, f, s / SLICE_PERM_COUNT)) == want) {
+        twist = t;
+        flip = f;
+        slice = s;
+        v = want;
+        d++;
+        break;
+      }
+    }
+    if (m == TURN_COUNT)
+      break;
+  }
+  return d;
+}
+
+static inline int phase2_estimate(int corner, int edge, int slice)
+{
+  return std::max(corner_slice_prune[corner * SLICE_PERM_COUNT + slice], edge_slice_prune[edge * SLICE_PERM_COUNT + slice]);
+}
+
+static bool phase2_search(Two_phase_worker *w, int corner, int edge, int slice, int depth, int togo)
+{
+  if (togo == 0)
+    return corner == 0 && edge == 0 && slice == 0;
+  if (two_phase_tick(w))
+    return false;
+  if (phase2_estimate(corner, edge, slice) > togo)
+    return false;
+  for (int i = 0; i < PHASE2_TURN_COUNT; i++) {
+    if (redundant_turn(phase2_turns[i], depth ? w->path[depth - 1] : -1))
+      continue;
+    w->path[depth] = phase2_turns[i];
+    if (phase2_search(w, corner3_move[corner][i], ud_edge_move[edge][i], slice_perm_move[slice][i], depth + 1, togo - 1))
+      return true;
+  }
+  return false;
+}
+
+// Finishes the phase 1 solution in path[0..length) with the shortest phase
+// 2 that makes a better solution than the best so far, if there is one.
+static void phase2_start(Two_phase_worker *w, int length)
+{
+  Two_phase_search *s = w->search;
+  int limit = std::min(s->best_length.load() - 1 - length, s->overtime ? PHASE2_MAX_DEPTH : PHASE2_SEARCH_DEPTH);
+  if (limit < 0)
+    return;
+  Cube3_state c = s->start;
+  for (int i = 0; i < length; i++)
+    c = cube3_apply_turn(c, w->path[i]);
+  int corner = c.corners.perm, edge = ud_edge_coord(c), slice = slice_coord(c);
+  for (int depth = phase2_estimate(corner, edge, slice); depth <= limit; depth++) {
+    if (!phase2_search(w, corner, edge, slice, length, depth))
+      continue;
+    std::lock_guard<std::mutex> lock(s->best_lock);
+    if (length + depth < s->best_length) {
+      memcpy(s->best, w->path, (length + depth) * sizeof(int));
+      s->best_length = length + depth;
+      if (length + depth <= s->target_length)
+        s->stop = true;
+    }
+    return;
+  }
+}
+
+// dist is the exact distance of the position to H.
+static void phase1_search(Two_phase_worker *w, int twist, int flip, int slice, int dist, int depth, int togo)
+{
+  if (togo == 0) {
+    // A phase 1 solution ending in an H move would have been found shorter.
+    int last = depth ? w->path[depth - 1] : -1;
+    if (twist == 0 && flip == 0 && slice < SLICE_PERM_COUNT && (last < 0 || (last / 3 < 4 && last % 3 != 1)))
+      phase2_start(w, depth);
+    return;
+  }
+  if (two_phase_tick(w))
+    return;
+  if (dist > togo)
+    return;
+  for (int m = 0; m < TURN_COUNT; m++) {
+    if (redundant_turn(m, depth ? w->path[depth - 1] : -1))
+      continue;
+    w->path[depth] = m;
+    int t = twist3_move[twist][m], f = flip_move[flip][m], s = slice_move[slice][m];
+    phase1_search(w, t, f, s, phase1_next_distance(dist, t, f, s), depth + 1, togo - 1);
+  }
+}
+
+static void two_phase_worker(Two_phase_worker *w)
+{
+  Two_phase_search *s = w->search;
+  int twist = s->start.corners.twist, flip = flip_coord(s->start), slice = slice_coord(s->start);
+  int dist = phase1_distance(twist, flip, slice);
+  for (int length = dist; length <= PHASE1_MAX_DEPTH && length < s->best_length && !s->stop; length++) {
+    int firsts = length ? TURN_COUNT : 1;
+    for (int m; !s->stop && (m = s->next_first[length]++) < firsts;) {
+      if (length == 0) {
+        phase1_search(w, twist, flip, slice, dist, 0, 0);
+        continue;
+      }
+      w->path[0] = m;
+      int t = twist3_move[twist][m], f = flip_move[flip][m], sl = slice_move[slice][m];
+      phase1_search(w, t, f, sl, phase1_next_distance(dist, t, f, sl), 1, length - 1);
+    }
+  }
+  s->nodes += w->nodes;
+}
+
+// Solves c on threads threads (the calling one included). Stops at the
+// first solution of target_length face turns or fewer, or once budget_ms
+// have passed and there is any solution; budget_ms <= 0 means no budget.
+// result->length is -1 only if phase 1 runs out of depth, which a damaged
+// table can cause. two_phase_init() must have been called.
+static void two_phase_solve(const Cube3_state &c, int threads, double budget_ms, int target_length,
+                            Two_phase_result *result)
+{
+  auto start = std::chrono::steady_clock::now();
+  Two_phase_search s;
+  s.start = c;
+  s.target_length = target_length;
+  s.has_deadline = budget_ms > 0;
+  s.deadline = start + std::chrono::microseconds((int64_t)(budget_ms * 1000));
+  for (int i = 0; i <= PHASE1_MAX_DEPTH; i++)
+    s.next_first[i] = 0;
+  s.best_length = TWO_PHASE_MAX_LENGTH + 1;
+  s.stop = false;
+  s.overtime = false;
+  s.nodes = 0;
+
+  if (threads < 1)
+    threads = 1;
+  std::vector<Two_phase_worker> workers(threads);
+  std::vector<std::thread> helpers;
+  for (int i = 0; i < threads; i++) {
+    workers[i].search = &s;
+    workers[i].nodes = 0;
+    if (i > 0)
+      helpers.push_back(std::thread(two_phase_worker, &workers[i]));
+  }
+  two_phase_worker(&workers[0]);
+  for (auto &t : helpers)
+    t.join();
+
+  result->length = s.best_length <= TWO_PHASE_MAX_LENGTH ? (int)s.best_length : -1;
+  if (result->length > 0)
+    memcpy(result->turns, s.best, result->length * sizeof(int));
+  result->nodes = s.nodes;
+  result->ms = elapsed_ms(start);
+}
+
+// Writes face turns as quarter turn moves (cube_state.h), a half turn as
+// two, and returns how many. format_moves() writes them back as half turns.
+static int two_phase_moves(const int *turns, int n, int *moves)
+{
+  int count = 0;
+  for (int i = 0; i < n; i++) {
+    int face = turns[i] / 3, k = turns[i] % 3;
+    moves[count++] = face * 2 + (k == 2);
+    if (k == 1)
+      moves[count++] = face * 2;
+  }
+  return count;
+}
+
+// --solve3 [input] [budget_ms] [threads]: solves one 3x3x3 per line of
+// input (stdin by default, "-" for stdin), given as 54 facelet letters or
+// as moves from solved, within budget_ms each (default 10), or later if no
+// solution is found by then. A cube the search finds none for at all gets
+// an error line and counts as a failure.
+static int two_phase_main(int argc, char *argv[])
+{
+  FILE *in = stdin;
+  if (argc > 2 && strcmp(argv[2], "-") != 0 && !(in = fopen(argv[2], "rb"))) {
+    fprintf(stderr, "could not open %s\n", argv[2]);
+    return 1;
+  }
+  double budget_ms = argc > 3 ? atof(argv[3]) : TWO_PHASE_BUDGET_MS;
+  int threads = argc > 4 ? atoi(argv[4]) : (int)std::thread::hardware_concurrency();
+  if (threads < 1)
+    threads = 1;
+
+  auto start = std::chrono::steady_clock::now();
+  two_phase_init(TWO_PHASE_FILE_NAME);
+  double init_ms = elapsed_ms(start);
+
+  static char line[TWO_PHASE_LINE_MAX];
+  char out[4 * TWO_PHASE_MAX_LENGTH];
+  int lines = 0, errors = 0, failures = 0, within_target = 0;
+  uint64_t turns_total = 0;
+  double ms_total = 0, ms_max = 0;
+  while (fgets(line, sizeof(line), in)) {
+    lines++;
+    size_t len = strcspn(line, "\r\n");
+    line[len] = 0;
+    Cube3_state c = cube3_solved();
+    bool ok = len == CUBE3_FACELETS && !strchr(line, ' ') ? cube3_from_facelets(line, &c)
+                                                            : cube3_apply_move_text(&c, line);
+    if (!ok) {
+      puts("error: bad cube");
+      errors++;
+      continue;
+    }
+    Two_phase_result r;
+    two_phase_solve(c, threads, budget_ms, TWO_PHASE_TARGET_LENGTH, &r);
+    ms_total += r.ms;
+    ms_max = std::max(ms_max, r.ms);
+    if (r.length < 0) {
+      puts("error: no solution");
+      failures++;
+      continue;
+    }
+    int moves[2 * TWO_PHASE_MAX_LENGTH];
+    format_moves(moves, two_phase_moves(r.turns, r.length, moves), out, sizeof(out));
+    puts(out);
+    turns_total += r.length;
+    within_target += r.length <= TWO_PHASE_TARGET_LENGTH;
+  }
+  int searched = lines - errors, solved = searched - failures;
+  fprintf(stderr, "%d cubes on %d threads, %d errors, %d failures, %.2f face turns per solution, %d within %d, "
+          "%.2f ms mean, %.2f ms max, tables %.1f ms\n",
+          lines, threads, errors, failures, solved ? (double)turns_total / solved : 0.0, within_target,
+          TWO_PHASE_TARGET_LENGTH, searched ? ms_total / searched : 0.0, ms_max, init_ms);
+  if (in != stdin)
+    fclose(in);
+  return errors || failures ? 2 : 0;
+}